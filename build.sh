@@ -1 +1,4 @@
-gcc fs.c main.c -o fs_main
+gcc fs.c main.c -o fs_main -lpthread
+gcc fs.c fsck.c -o fs_fsck -lpthread
+gcc fs.c fs_replay.c -o fs_replay -lpthread
+gcc fs.c fs_load.c -o fs_load -lpthread -lm
@@ -2,6 +2,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/resource.h>
 #include "fs.h"
 
 #define COMPREHENSIVE_DISK "comprehensive_disk.img"
@@ -61,6 +66,7 @@ void test_different_sizes() {
     // Test different file sizes
     int sizes[] = {1, 100, 1000, 4000, 8000, 16000, 32000};
     int num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    while (sizes[num_sizes - 1] > MAX_DIRECT_BLOCKS * BLOCK_SIZE) num_sizes--; // beyond the largest file
     
     for (int i = 0; i < num_sizes; i++) {
         char filename[30];
@@ -361,6 +367,1764 @@ void test_error_conditions() {
     printf("PASSED: All error conditions tested successfully\n");
 }
 
+// Test 6: Offset-based reads and readahead
+void test_offset_reads() {
+    printf("=== Test 6: Offset Reads and Readahead ===\n");
+    
+    setup_comprehensive_disk();
+    
+    const int size = MAX_DIRECT_BLOCKS * BLOCK_SIZE;
+    char* data = malloc(size);
+    for (int i = 0; i < size; i++) {
+        data[i] = 'a' + (i % 23);
+    }
+    
+    if (fs_create("stream.bin") != 0 || fs_write("stream.bin", data, size) != 0) {
+        printf("FAILED: Could not create stream file\n");
+        free(data);
+        return;
+    }
+    
+    // Stream through the file in 1000-byte chunks (not block aligned)
+    fs_reset_stats();
+    char chunk[1000];
+    int offset = 0;
+    while (offset < size) {
+        int n = fs_read_at("stream.bin", chunk, sizeof(chunk), offset);
+        int expected = (size - offset < (int)sizeof(chunk)) ? size - offset : (int)sizeof(chunk);
+        if (n != expected || memcmp(chunk, data + offset, n) != 0) {
+            printf("FAILED: Offset read at %d returned %d, expected %d\n", offset, n, expected);
+            free(data);
+            return;
+        }
+        offset += n;
+    }
+    
+    // Reading at or past the end returns 0; a negative offset is an error
+    if (fs_read_at("stream.bin", chunk, sizeof(chunk), size) != 0) {
+        printf("FAILED: Read at end of file should return 0\n");
+        free(data);
+        return;
+    }
+    if (fs_read_at("stream.bin", chunk, sizeof(chunk), -1) != -3) {
+        printf("FAILED: Negative offset should return -3\n");
+        free(data);
+        return;
+    }
+    
+    fs_stats st;
+    fs_get_stats(&st);
+    if (st.readahead_blocks == 0 || st.readahead_hits == 0) {
+        printf("FAILED: Sequential reads did not trigger readahead\n");
+        free(data);
+        return;
+    }
+    printf("Readahead: %lu blocks prefetched, %lu hits, %lu disk reads\n",
+           st.readahead_blocks, st.readahead_hits, st.disk_reads);
+    
+    free(data);
+    printf("PASSED: Offset reads and readahead\n");
+    fs_unmount();
+}
+
+// Test 7: O_DIRECT mount with aligned and unaligned buffers
+void test_direct_mount() {
+    printf("=== Test 7: Direct I/O Mount ===\n");
+    
+    setup_comprehensive_disk();
+    fs_unmount();
+    if (fs_mount_opts(COMPREHENSIVE_DISK, FS_MOUNT_DIRECT) != 0) {
+        printf("FAILED: Could not mount with FS_MOUNT_DIRECT\n");
+        return;
+    }
+    
+    const int size = 5 * BLOCK_SIZE + 123;
+    char* aligned = aligned_alloc(BLOCK_SIZE, 6 * BLOCK_SIZE);
+    char* unaligned = malloc(size + 1) + 1;
+    for (int i = 0; i < size; i++) {
+        aligned[i] = 'a' + (i % 17);
+        unaligned[i] = 'A' + (i % 19);
+    }
+    
+    if (fs_create("aligned.bin") != 0 || fs_write("aligned.bin", aligned, size) != 0 ||
+        fs_create("unaligned.bin") != 0 || fs_write("unaligned.bin", unaligned, size) != 0) {
+        printf("FAILED: Could not write files in direct mode\n");
+        return;
+    }
+    
+    // Remount so the reads come from disk rather than the block cache
+    fs_unmount();
+    if (fs_mount_opts(COMPREHENSIVE_DISK, FS_MOUNT_DIRECT) != 0) {
+        printf("FAILED: Could not remount with FS_MOUNT_DIRECT\n");
+        return;
+    }
+    
+    char* readback = aligned_alloc(BLOCK_SIZE, 6 * BLOCK_SIZE);
+    if (fs_read("unaligned.bin", readback, size) != size || memcmp(readback, unaligned, size) != 0) {
+        printf("FAILED: Aligned read of unaligned.bin mismatched\n");
+        return;
+    }
+    if (fs_read("aligned.bin", readback + 1, size) != size || memcmp(readback + 1, aligned, size) != 0) {
+        printf("FAILED: Unaligned read of aligned.bin mismatched\n");
+        return;
+    }
+    if (fs_read_at("aligned.bin", readback, 100, 2 * BLOCK_SIZE + 7) != 100 ||
+        memcmp(readback, aligned + 2 * BLOCK_SIZE + 7, 100) != 0) {
+        printf("FAILED: Offset read in direct mode mismatched\n");
+        return;
+    }
+    
+    free(aligned);
+    free(unaligned - 1);
+    free(readback);
+    printf("PASSED: Direct I/O mount\n");
+    fs_unmount();
+}
+
+// Compare the bytes exposed by a read view against an expected buffer
+int view_matches(struct iovec* iov, int count, const char* expected, int size) {
+    int offset = 0;
+    for (int i = 0; i < count; i++) {
+        if (offset + (int)iov[i].iov_len > size) return 0;
+        if (memcmp(iov[i].iov_base, expected + offset, iov[i].iov_len) != 0) return 0;
+        offset += iov[i].iov_len;
+    }
+    return offset == size;
+}
+
+// Test 8: Zero-copy read views
+void test_read_views() {
+    printf("=== Test 8: Zero-Copy Read Views ===\n");
+    
+    setup_comprehensive_disk();
+    
+    const int size = 3 * BLOCK_SIZE + 500;
+    char original[3 * BLOCK_SIZE + 500];
+    char updated[3 * BLOCK_SIZE + 500];
+    for (int i = 0; i < size; i++) {
+        original[i] = 'o' + (i % 5);
+        updated[i] = 'U' + (i % 3);
+    }
+    
+    if (fs_create("view.txt") != 0 || fs_write("view.txt", original, size) != 0) {
+        printf("FAILED: Could not create view file\n");
+        return;
+    }
+    
+    struct iovec* iov;
+    int count;
+    if (fs_read_view("view.txt", &iov, &count) != size || count != 4 ||
+        !view_matches(iov, count, original, size)) {
+        printf("FAILED: View does not expose the file contents\n");
+        return;
+    }
+    
+    // A second view of the same file shares the cached blocks
+    struct iovec* iov2;
+    int count2;
+    if (fs_read_view("view.txt", &iov2, &count2) != size || iov2[0].iov_base != iov[0].iov_base) {
+        printf("FAILED: Second view did not share the cached blocks\n");
+        return;
+    }
+    fs_release_view(iov2);
+    
+    // Overwrite the file, then churn the freed blocks and the cache
+    if (fs_write("view.txt", updated, size) != 0) {
+        printf("FAILED: Could not overwrite viewed file\n");
+        return;
+    }
+    char churn[BLOCK_SIZE];
+    memset(churn, 'C', sizeof(churn));
+    char filename[30];
+    for (int i = 0; i < 80; i++) {
+        snprintf(filename, sizeof(filename), "churn_%d.txt", i);
+        fs_create(filename);
+        fs_write(filename, churn, sizeof(churn));
+        fs_read(filename, churn, sizeof(churn));
+    }
+    
+    if (!view_matches(iov, count, original, size)) {
+        printf("FAILED: View changed after a concurrent write\n");
+        return;
+    }
+    if (fs_release_view(iov) != 0 || fs_release_view(iov) != -1) {
+        printf("FAILED: View release semantics\n");
+        return;
+    }
+    
+    // A fresh view sees the new contents
+    if (fs_read_view("view.txt", &iov, &count) != size || !view_matches(iov, count, updated, size)) {
+        printf("FAILED: New view does not expose the updated contents\n");
+        return;
+    }
+    fs_release_view(iov);
+    
+    if (fs_read_view("missing.txt", &iov, &count) != -1) {
+        printf("FAILED: View of a missing file should return -1\n");
+        return;
+    }
+    
+    printf("PASSED: Zero-copy read views\n");
+    fs_unmount();
+}
+
+// Test 9: Sending file contents to a pipe
+void test_sendfile() {
+    printf("=== Test 9: Sendfile to a Pipe ===\n");
+    
+    setup_comprehensive_disk();
+    
+    const int size = 3 * BLOCK_SIZE + 500;
+    char data[3 * BLOCK_SIZE + 500];
+    for (int i = 0; i < size; i++) {
+        data[i] = '0' + (i % 10);
+    }
+    
+    // Interleave two files so "a.bin" is split into non-contiguous runs
+    fs_create("a.bin");
+    fs_create("b.bin");
+    fs_write("a.bin", data, BLOCK_SIZE);
+    fs_write("b.bin", data, BLOCK_SIZE);
+    fs_delete("b.bin");
+    fs_create("filler.bin");
+    fs_write("filler.bin", data, 2 * BLOCK_SIZE);
+    if (fs_write("a.bin", data, size) != 0) {
+        printf("FAILED: Could not write a.bin\n");
+        return;
+    }
+    
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) {
+        printf("FAILED: Could not create pipe\n");
+        return;
+    }
+    
+    // Whole file, then a range that starts mid-block
+    int sent = fs_sendfile("a.bin", pipe_fds[1], 0, size);
+    int sent_range = fs_sendfile("a.bin", pipe_fds[1], 100, 5000);
+    close(pipe_fds[1]);
+    
+    char received[3 * BLOCK_SIZE + 500 + 5000];
+    int total = 0;
+    int n;
+    while ((n = read(pipe_fds[0], received + total, sizeof(received) - total)) > 0) {
+        total += n;
+    }
+    close(pipe_fds[0]);
+    
+    if (sent != size || sent_range != 5000 || total != size + 5000) {
+        printf("FAILED: Sent %d and %d bytes, received %d\n", sent, sent_range, total);
+        return;
+    }
+    if (memcmp(received, data, size) != 0 || memcmp(received + size, data + 100, 5000) != 0) {
+        printf("FAILED: Sendfile data mismatch\n");
+        return;
+    }
+    if (fs_sendfile("a.bin", 1, size, 10) != 0 || fs_sendfile("nope.bin", 1, 0, 10) != -1) {
+        printf("FAILED: Sendfile boundary/error handling\n");
+        return;
+    }
+    
+    // An error after part of the file went out still reports what was sent
+    struct rlimit limit;
+    getrlimit(RLIMIT_FSIZE, &limit);
+    struct rlimit small = {1000, limit.rlim_max};
+    signal(SIGXFSZ, SIG_IGN);
+    int out_fd = open("sendfile_limit.out", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    setrlimit(RLIMIT_FSIZE, &small);
+    int partial = fs_sendfile("a.bin", out_fd, 0, size);
+    setrlimit(RLIMIT_FSIZE, &limit);
+    signal(SIGXFSZ, SIG_DFL);
+    close(out_fd);
+    remove("sendfile_limit.out");
+    if (partial != 1000) {
+        printf("FAILED: Sendfile cut short after 1000 bytes returned %d\n", partial);
+        return;
+    }
+    
+    printf("PASSED: Sendfile to a pipe\n");
+    fs_unmount();
+}
+
+// Test 10: Checksums catch on-disk corruption
+void test_checksums() {
+    printf("=== Test 10: Block Checksums ===\n");
+    
+    // Known CRC32C test vector
+    if (fs_crc32c(0, "123456789", 9) != 0xE3069283) {
+        printf("FAILED: CRC32C test vector mismatch\n");
+        return;
+    }
+    
+    setup_comprehensive_disk();
+    char data[2 * BLOCK_SIZE];
+    for (int i = 0; i < (int)sizeof(data); i++) {
+        data[i] = 'c' + (i % 9);
+    }
+    if (fs_create("guarded.bin") != 0 || fs_write("guarded.bin", data, sizeof(data)) != 0) {
+        printf("FAILED: Could not write guarded file\n");
+        return;
+    }
+    fs_unmount();
+    
+    // Flip one byte in the file's second block (the first file gets the
+    // first free data blocks)
+    int fd = open(COMPREHENSIVE_DISK, O_RDWR);
+    off_t pos = (off_t)(FIRST_DATA_BLOCK + 1) * BLOCK_SIZE + 17;
+    char byte;
+    pread(fd, &byte, 1, pos);
+    byte ^= 0x40;
+    pwrite(fd, &byte, 1, pos);
+    close(fd);
+    
+    char buffer[2 * BLOCK_SIZE];
+    fs_mount(COMPREHENSIVE_DISK);
+    if (fs_read("guarded.bin", buffer, sizeof(buffer)) != -3) {
+        printf("FAILED: Corrupted block was not detected\n");
+        return;
+    }
+    // The untouched first block still reads fine
+    if (fs_read("guarded.bin", buffer, BLOCK_SIZE) != BLOCK_SIZE || memcmp(buffer, data, BLOCK_SIZE) != 0) {
+        printf("FAILED: Intact block should still be readable\n");
+        return;
+    }
+    fs_stats st;
+    fs_get_stats(&st);
+    if (st.checksum_errors == 0) {
+        printf("FAILED: Checksum error was not counted\n");
+        return;
+    }
+    fs_unmount();
+    
+    // Verification can be turned off at mount time
+    fs_mount_opts(COMPREHENSIVE_DISK, FS_MOUNT_NO_VERIFY);
+    if (fs_read("guarded.bin", buffer, sizeof(buffer)) != (int)sizeof(buffer)) {
+        printf("FAILED: Read with verification off should succeed\n");
+        return;
+    }
+    
+    printf("PASSED: Block checksums\n");
+    fs_unmount();
+}
+
+// Fill a buffer with JSON-like records
+void fill_json(char* buf, int size) {
+    int pos = 0;
+    for (int id = 0; pos < size; id++) {
+        char record[128];
+        int n = snprintf(record, sizeof(record),
+                         "{\"id\": %d, \"name\": \"user_%d\", \"active\": %s, \"score\": %d},\n",
+                         id, id % 97, (id % 3) ? "true" : "false", (id * 37) % 1000);
+        for (int i = 0; i < n && pos < size; i++) buf[pos++] = record[i];
+    }
+}
+
+// Test 11: Transparent per-file compression
+void test_compression() {
+    printf("=== Test 11: Transparent Compression ===\n");
+    
+    setup_comprehensive_disk();
+    
+    const int size = MAX_DIRECT_BLOCKS * BLOCK_SIZE * 13 / 16; // Most of the largest file
+    char* json = malloc(size);
+    char* noise = malloc(size);
+    char* buffer = malloc(size);
+    fill_json(json, size);
+    for (int i = 0; i < size; i++) {
+        noise[i] = rand();
+    }
+    
+    if (fs_create("data.json") != 0 || fs_set_compression("data.json", 1) != 0 ||
+        fs_create("noise.bin") != 0 || fs_set_compression("noise.bin", 1) != 0) {
+        printf("FAILED: Could not create compressed files\n");
+        return;
+    }
+    if (fs_set_compression("missing.json", 1) != -1) {
+        printf("FAILED: Enabling compression on a missing file should return -1\n");
+        return;
+    }
+    
+    fs_reset_stats();
+    if (fs_write("data.json", json, size) != 0 || fs_write("noise.bin", noise, size) != 0) {
+        printf("FAILED: Could not write compressed files\n");
+        return;
+    }
+    fs_stats st;
+    fs_get_stats(&st);
+    if (st.compress_blocks_saved == 0) {
+        printf("FAILED: Compressible data did not save any blocks\n");
+        return;
+    }
+    
+    // Remount so the data comes back from disk
+    fs_unmount();
+    fs_mount(COMPREHENSIVE_DISK);
+    if (fs_read("data.json", buffer, size) != size || memcmp(buffer, json, size) != 0) {
+        printf("FAILED: Compressed file did not round-trip\n");
+        return;
+    }
+    if (fs_read("noise.bin", buffer, size) != size || memcmp(buffer, noise, size) != 0) {
+        printf("FAILED: Incompressible file did not round-trip\n");
+        return;
+    }
+    if (fs_read("data.json", buffer, 100) != 100 || memcmp(buffer, json, 100) != 0 ||
+        fs_read_at("data.json", buffer, size / 8, size * 3 / 4) != size / 8 ||
+        memcmp(buffer, json + size * 3 / 4, size / 8) != 0) {
+        printf("FAILED: Partial reads of a compressed file mismatched\n");
+        return;
+    }
+    
+    struct iovec* iov;
+    int count;
+    if (fs_read_view("data.json", &iov, &count) != -3) {
+        printf("FAILED: Views of compressed files should be rejected\n");
+        return;
+    }
+    
+    // Turning compression off stores the next write raw
+    fs_set_compression("data.json", 0);
+    fs_write("data.json", json, size);
+    if (fs_read_view("data.json", &iov, &count) != size) {
+        printf("FAILED: File should be stored raw after disabling compression\n");
+        return;
+    }
+    fs_release_view(iov);
+    
+    free(json);
+    free(noise);
+    free(buffer);
+    printf("PASSED: Transparent compression (%lu blocks saved)\n", st.compress_blocks_saved);
+    fs_unmount();
+}
+
+// Return the number of free data blocks
+int free_blocks() {
+    fs_stats st;
+    fs_get_stats(&st);
+    return st.free_blocks;
+}
+
+// Test 12: Block deduplication with reference counts
+void test_dedup() {
+    printf("=== Test 12: Block Deduplication ===\n");
+    
+    setup_comprehensive_disk();
+    fs_unmount();
+    fs_mount_opts(COMPREHENSIVE_DISK, FS_MOUNT_DEDUP);
+    
+    // Three distinct blocks plus a partial tail
+    const int size = 3 * BLOCK_SIZE + 1000;
+    char template[3 * BLOCK_SIZE + 1000];
+    char other[3 * BLOCK_SIZE + 1000];
+    char buffer[3 * BLOCK_SIZE + 1000];
+    for (int i = 0; i < size; i++) {
+        template[i] = 'a' + (i / BLOCK_SIZE) + (i % 7);
+    }
+    memcpy(other, template, size);
+    memset(other + BLOCK_SIZE, 'z', BLOCK_SIZE); // differs only in block 1
+    
+    int initial = free_blocks();
+    fs_create("first.txt");
+    fs_create("copy.txt");
+    fs_create("other.txt");
+    fs_write("first.txt", template, size);
+    if (free_blocks() != initial - 4) {
+        printf("FAILED: First write should take 4 blocks\n");
+        return;
+    }
+    fs_write("copy.txt", template, size);
+    fs_write("other.txt", other, size);
+    if (free_blocks() != initial - 5) {
+        printf("FAILED: Duplicates should be shared, %d blocks used\n", initial - free_blocks());
+        return;
+    }
+    
+    // Overwriting or deleting one sharer leaves the others intact
+    fs_write("first.txt", "short", 5);
+    fs_delete("other.txt");
+    if (fs_read("copy.txt", buffer, size) != size || memcmp(buffer, template, size) != 0) {
+        printf("FAILED: Shared blocks were disturbed by an overwrite or delete\n");
+        return;
+    }
+    if (free_blocks() != initial - 5) {
+        printf("FAILED: Expected 5 blocks in use after overwrite and delete, got %d\n", initial - free_blocks());
+        return;
+    }
+    
+    // Identical blocks within one file share too
+    char zeros[12 * BLOCK_SIZE] = {0};
+    fs_create("zeros.bin");
+    fs_write("zeros.bin", zeros, sizeof(zeros));
+    if (free_blocks() != initial - 6) {
+        printf("FAILED: Identical blocks of one file should share a single block\n");
+        return;
+    }
+    
+    // Reference counts persist; a plain mount reads and frees them correctly
+    fs_unmount();
+    fs_mount(COMPREHENSIVE_DISK);
+    if (fs_read("copy.txt", buffer, size) != size || memcmp(buffer, template, size) != 0) {
+        printf("FAILED: Shared file did not survive a remount\n");
+        return;
+    }
+    fs_create("plain.txt");
+    fs_write("plain.txt", template, size);
+    if (free_blocks() != initial - 10) {
+        printf("FAILED: Writes should not be deduplicated without FS_MOUNT_DEDUP\n");
+        return;
+    }
+    fs_delete("first.txt");
+    fs_delete("copy.txt");
+    fs_delete("zeros.bin");
+    fs_delete("plain.txt");
+    if (free_blocks() != initial) {
+        printf("FAILED: Deleting every sharer should free all blocks (%d leaked)\n", initial - free_blocks());
+        return;
+    }
+    
+    printf("PASSED: Block deduplication\n");
+    fs_unmount();
+}
+
+// Test 13: Copy-on-write clones
+void test_clone() {
+    printf("=== Test 13: Copy-on-Write Clone ===\n");
+    
+    setup_comprehensive_disk();
+    
+    const int size = 5 * BLOCK_SIZE + 123;
+    char original[5 * BLOCK_SIZE + 123];
+    char changed[5 * BLOCK_SIZE + 123];
+    char buffer[5 * BLOCK_SIZE + 123];
+    for (int i = 0; i < size; i++) {
+        original[i] = 'A' + (i % 26);
+        changed[i] = '0' + (i % 10);
+    }
+    fs_create("source.txt");
+    fs_write("source.txt", original, size);
+    
+    int before = free_blocks();
+    if (fs_clone("source.txt", "clone.txt") != 0) {
+        printf("FAILED: Could not clone file\n");
+        return;
+    }
+    if (free_blocks() != before) {
+        printf("FAILED: Clone should not allocate data blocks\n");
+        return;
+    }
+    if (fs_read("clone.txt", buffer, size) != size || memcmp(buffer, original, size) != 0) {
+        printf("FAILED: Clone contents differ from the source\n");
+        return;
+    }
+    
+    // Writing the source leaves the clone untouched, and vice versa
+    fs_write("source.txt", changed, size);
+    if (fs_read("clone.txt", buffer, size) != size || memcmp(buffer, original, size) != 0) {
+        printf("FAILED: Writing the source changed the clone\n");
+        return;
+    }
+    fs_clone("clone.txt", "clone2.txt");
+    fs_write("clone2.txt", "tiny", 4);
+    if (fs_read("clone.txt", buffer, size) != size || memcmp(buffer, original, size) != 0) {
+        printf("FAILED: Writing a clone changed its origin\n");
+        return;
+    }
+    
+    // Deleting the source keeps the clone's blocks alive until it goes too
+    fs_unmount();
+    fs_mount(COMPREHENSIVE_DISK);
+    fs_delete("source.txt");
+    if (fs_read("clone.txt", buffer, size) != size || memcmp(buffer, original, size) != 0) {
+        printf("FAILED: Clone did not survive remount and source delete\n");
+        return;
+    }
+    int used = free_blocks();
+    fs_delete("clone.txt");
+    if (free_blocks() != used + 6) {
+        printf("FAILED: Deleting the last copy should free its blocks\n");
+        return;
+    }
+    
+    // Error handling
+    if (fs_clone("missing.txt", "x.txt") != -1 || fs_clone("clone2.txt", "clone2.txt") != -1) {
+        printf("FAILED: Clone of a missing file or onto an existing name should return -1\n");
+        return;
+    }
+    
+    // A block a file points at twice stops being shared before its one-byte
+    // reference count would wrap
+    fs_unmount();
+    setup_comprehensive_disk();
+    fs_unmount();
+    fs_mount_opts(COMPREHENSIVE_DISK, FS_MOUNT_DEDUP);
+    memset(buffer, 'd', 2 * BLOCK_SIZE);
+    fs_create("twice.txt");
+    fs_write("twice.txt", buffer, 2 * BLOCK_SIZE);
+    int initial = free_blocks();
+    char name[MAX_FILENAME];
+    int clones = 0;
+    int result = 0;
+    while (clones < MAX_FILES - 1) {
+        snprintf(name, sizeof(name), "twice_%d", clones);
+        if ((result = fs_clone("twice.txt", name)) != 0) break;
+        clones++;
+    }
+    if (clones < MAX_FILES - 1 && (result != -2 || 2 + 2 * clones > 255)) {
+        printf("FAILED: Clone %d of a doubly shared block returned %d\n", clones, result);
+        return;
+    }
+    for (int i = 0; i < clones; i++) {
+        snprintf(name, sizeof(name), "twice_%d", i);
+        fs_delete(name);
+    }
+    if (free_blocks() != initial || fs_read("twice.txt", buffer, 2 * BLOCK_SIZE) != 2 * BLOCK_SIZE || buffer[0] != 'd') {
+        printf("FAILED: Reference counts wrapped after %d clones\n", clones);
+        return;
+    }
+    
+    printf("PASSED: Copy-on-write clone\n");
+    fs_unmount();
+}
+
+// Test 14: Incremental defragmentation
+void test_defrag() {
+    printf("=== Test 14: Defragmentation ===\n");
+    
+    setup_comprehensive_disk();
+    
+    // Interleave small files, delete every other one in each block group,
+    // then write larger files that have to be scattered over the holes
+    char filename[30];
+    char data[6 * BLOCK_SIZE];
+    char buffer[6 * BLOCK_SIZE];
+    for (int i = 0; i < 40; i++) {
+        snprintf(filename, sizeof(filename), "small_%d", i);
+        memset(data, 'a' + i % 26, BLOCK_SIZE);
+        fs_create(filename);
+        fs_write(filename, data, BLOCK_SIZE);
+    }
+    for (int i = 0; i < 40; i++) {
+        if ((i / BLOCK_GROUPS) % 2 != 0) continue;
+        snprintf(filename, sizeof(filename), "small_%d", i);
+        fs_delete(filename);
+    }
+    for (int i = 0; i < 5; i++) {
+        snprintf(filename, sizeof(filename), "big_%d", i);
+        for (int j = 0; j < (int)sizeof(data); j++) data[j] = (j * 7 + i) % 251;
+        fs_create(filename);
+        fs_write(filename, data, sizeof(data));
+    }
+    fs_clone("big_1", "big_1_clone");
+    
+    fs_frag_report before;
+    if (fs_fragmentation(&before) <= 0 || before.fragmented_files == 0) {
+        printf("FAILED: Churned filesystem should report fragmentation (%d, %d)\n", before.score, before.fragmented_files);
+        return;
+    }
+    
+    // Small steps, checking the data stays readable in between
+    int steps = 0;
+    int moved;
+    while ((moved = fs_defrag(4)) > 0) {
+        if (moved > 4) {
+            printf("FAILED: Step relocated %d blocks with a budget of 4\n", moved);
+            return;
+        }
+        steps++;
+        if (fs_read("big_1_clone", buffer, sizeof(buffer)) != (int)sizeof(buffer) || buffer[100] != (char)((700 + 1) % 251)) {
+            printf("FAILED: Data unreadable during defragmentation\n");
+            return;
+        }
+    }
+    if (moved < 0 || steps < 2) {
+        printf("FAILED: Defragmentation should take several steps (%d, last %d)\n", steps, moved);
+        return;
+    }
+    
+    fs_frag_report after;
+    fs_fragmentation(&after);
+    if (after.score != 0 || after.fragmented_files != 0 || after.free_extents != 1) {
+        printf("FAILED: Expected a contiguous layout, score %d, %d fragmented, %d free extents\n",
+               after.score, after.fragmented_files, after.free_extents);
+        return;
+    }
+    
+    // Everything survives a remount
+    fs_unmount();
+    fs_mount(COMPREHENSIVE_DISK);
+    for (int i = 0; i < 5; i++) {
+        snprintf(filename, sizeof(filename), "big_%d", i);
+        for (int j = 0; j < (int)sizeof(data); j++) data[j] = (j * 7 + i) % 251;
+        if (fs_read(filename, buffer, sizeof(buffer)) != (int)sizeof(buffer) || memcmp(buffer, data, sizeof(data)) != 0) {
+            printf("FAILED: %s corrupted by defragmentation\n", filename);
+            return;
+        }
+    }
+    for (int i = 0; i < 40; i++) {
+        if ((i / BLOCK_GROUPS) % 2 == 0) continue;
+        snprintf(filename, sizeof(filename), "small_%d", i);
+        if (fs_read(filename, buffer, BLOCK_SIZE) != BLOCK_SIZE || buffer[0] != 'a' + i % 26 || buffer[BLOCK_SIZE - 1] != 'a' + i % 26) {
+            printf("FAILED: %s corrupted by defragmentation\n", filename);
+            return;
+        }
+    }
+    if (fs_defrag(4) != 0) {
+        printf("FAILED: Defragmented layout should not change after remount\n");
+        return;
+    }
+    
+    // Blocks held by an open writer move with it
+    fs_unmount();
+    setup_comprehensive_disk();
+    fs_create("streamed");
+    fs_create("plain");
+    int writer = fs_writer_open("streamed");
+    memset(data, 'B', BLOCK_SIZE);
+    fs_writer_write(writer, data, BLOCK_SIZE);
+    memset(data, 'A', BLOCK_SIZE);
+    fs_write("plain", data, BLOCK_SIZE);
+    if (fs_defrag(100) <= 0 || fs_writer_commit(writer) != 0) {
+        printf("FAILED: Defrag or commit with an open writer\n");
+        return;
+    }
+    if (fs_read("streamed", buffer, BLOCK_SIZE) != BLOCK_SIZE || buffer[0] != 'B' || buffer[BLOCK_SIZE - 1] != 'B' ||
+        fs_read("plain", buffer, BLOCK_SIZE) != BLOCK_SIZE || buffer[0] != 'A' || buffer[BLOCK_SIZE - 1] != 'A') {
+        printf("FAILED: Defrag moved data into an open writer's block\n");
+        return;
+    }
+    fs_delete("streamed");
+    fs_delete("plain");
+    if (free_blocks() != MAX_BLOCKS - FIRST_DATA_BLOCK) {
+        printf("FAILED: Defrag with an open writer leaked %d blocks\n", MAX_BLOCKS - FIRST_DATA_BLOCK - free_blocks());
+        return;
+    }
+    
+    printf("PASSED: Defragmentation (score %d -> %d in %d steps)\n", before.score, after.score, steps);
+    fs_unmount();
+}
+
+// Return the host disk space used by an image, in KB
+long image_kb(const char* path) {
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+    return (long)st.st_blocks * 512 / 1024;
+}
+
+// Test 15: Punching holes for freed blocks
+void test_discard() {
+    printf("=== Test 15: Discarding Freed Blocks ===\n");
+    
+    setup_comprehensive_disk();
+    fs_unmount();
+    long formatted = image_kb(COMPREHENSIVE_DISK);
+    if (formatted > 512) {
+        printf("FAILED: Freshly formatted image should be sparse (%ld KB)\n", formatted);
+        return;
+    }
+    
+    // Fill most of the disk
+    fs_mount_opts(COMPREHENSIVE_DISK, FS_MOUNT_DISCARD);
+    int num_files = (MAX_BLOCKS - FIRST_DATA_BLOCK) * 7 / 10 / MAX_DIRECT_BLOCKS;
+    if (num_files > MAX_FILES - 1) num_files = MAX_FILES - 1;
+    const long file_kb = MAX_DIRECT_BLOCKS * BLOCK_SIZE / 1024;
+    char filename[30];
+    char data[MAX_DIRECT_BLOCKS * BLOCK_SIZE];
+    char buffer[MAX_DIRECT_BLOCKS * BLOCK_SIZE];
+    memset(data, 'D', sizeof(data));
+    for (int i = 0; i < num_files; i++) {
+        snprintf(filename, sizeof(filename), "bulk_%d.bin", i);
+        fs_create(filename);
+        fs_write(filename, data, sizeof(data));
+    }
+    fs_unmount();
+    long full = image_kb(COMPREHENSIVE_DISK);
+    
+    // Mass deletion returns the space to the host in merged calls
+    fs_mount_opts(COMPREHENSIVE_DISK, FS_MOUNT_DISCARD);
+    for (int i = 0; i < num_files; i++) {
+        snprintf(filename, sizeof(filename), "bulk_%d.bin", i);
+        fs_delete(filename);
+    }
+    // Reuse some just-freed blocks before the queue is flushed
+    memset(data, 'R', sizeof(data));
+    fs_create("reused.bin");
+    fs_write("reused.bin", data, sizeof(data));
+    fs_stats st;
+    fs_get_stats(&st);
+    fs_unmount();
+    long emptied = image_kb(COMPREHENSIVE_DISK);
+    
+    if (full < num_files * file_kb || emptied > formatted + 2 * file_kb + 64) {
+        printf("FAILED: Image used %ld KB full and %ld KB after deleting (formatted %ld KB)\n", full, emptied, formatted);
+        return;
+    }
+    if (st.discard_calls == 0 || st.discard_calls * 4 > st.discarded_blocks) {
+        printf("FAILED: Discards should be merged (%lu calls for %lu blocks)\n", st.discard_calls, st.discarded_blocks);
+        return;
+    }
+    
+    fs_mount(COMPREHENSIVE_DISK);
+    if (fs_read("reused.bin", buffer, sizeof(buffer)) != (int)sizeof(buffer) || memcmp(buffer, data, sizeof(data)) != 0) {
+        printf("FAILED: A reused block was discarded\n");
+        return;
+    }
+    
+    printf("PASSED: Discard (%ld KB -> %ld KB, %lu calls)\n", full, emptied, st.discard_calls);
+    fs_unmount();
+}
+
+// Test 16: Lazy inode table loading
+void test_lazy_mount() {
+    printf("=== Test 16: Lazy Mount ===\n");
+    
+    setup_comprehensive_disk();
+    const int num_files = MAX_FILES * 25 / 32; // most of the inode table
+    char filename[30];
+    char data[64];
+    char buffer[64];
+    for (int i = 0; i < num_files; i++) {
+        snprintf(filename, sizeof(filename), "lazy_%d", i);
+        snprintf(data, sizeof(data), "contents of file %d", i);
+        fs_create(filename);
+        fs_write(filename, data, strlen(data) + 1);
+    }
+    fs_unmount();
+    
+    // Reading a file only loads the table up to its inode
+    fs_mount_opts(COMPREHENSIVE_DISK, FS_MOUNT_LAZY);
+    fs_stats st;
+    fs_get_stats(&st);
+    if (st.inode_chunks_loaded != 0) {
+        printf("FAILED: Lazy mount should not read the inode table\n");
+        return;
+    }
+    if (fs_read("lazy_3", buffer, sizeof(buffer)) <= 0 || strcmp(buffer, "contents of file 3") != 0) {
+        printf("FAILED: Could not read a file right after a lazy mount\n");
+        return;
+    }
+    fs_get_stats(&st);
+    if (st.inode_chunks_loaded != 1) {
+        printf("FAILED: Expected 1 inode chunk loaded, got %lu\n", st.inode_chunks_loaded);
+        return;
+    }
+    
+    // Deleting before the table is complete, then creating, reuses the slot
+    fs_delete("lazy_5");
+    if (fs_create("replacement") != 0 || fs_write("replacement", "new", 4) != 0) {
+        printf("FAILED: Could not create a file on a lazy mount\n");
+        return;
+    }
+    char names[MAX_FILES][MAX_FILENAME];
+    if (fs_list(names, MAX_FILES) != num_files || strcmp(names[5], "replacement") != 0) {
+        printf("FAILED: Lowest free inode should be reused after a lazy mount\n");
+        return;
+    }
+    fs_unmount();
+    
+    // With prefetching, files are readable at once and nothing is lost
+    fs_mount_opts(COMPREHENSIVE_DISK, FS_MOUNT_LAZY | FS_MOUNT_PREFETCH);
+    snprintf(filename, sizeof(filename), "lazy_%d", num_files - 1);
+    snprintf(data, sizeof(data), "contents of file %d", num_files - 1);
+    if (fs_read(filename, buffer, sizeof(buffer)) <= 0 || strcmp(buffer, data) != 0) {
+        printf("FAILED: Could not read a file during prefetch\n");
+        return;
+    }
+    fs_unmount();
+    
+    fs_mount(COMPREHENSIVE_DISK);
+    for (int i = 0; i < num_files; i++) {
+        snprintf(filename, sizeof(filename), "lazy_%d", i);
+        snprintf(data, sizeof(data), "contents of file %d", i);
+        int n = fs_read(filename, buffer, sizeof(buffer));
+        if (i == 5 ? n != -1 : (n <= 0 || strcmp(buffer, data) != 0)) {
+            printf("FAILED: %s wrong after lazy mounts\n", filename);
+            return;
+        }
+    }
+    
+    printf("PASSED: Lazy mount\n");
+    fs_unmount();
+}
+
+// Test 17: Listing cursors with prefix filtering
+void test_list_cursor() {
+    printf("=== Test 17: Listing Cursors ===\n");
+    
+    setup_comprehensive_disk();
+    char filename[30];
+    const char* groups[] = {"log_", "img_", "logs", "cfg_"};
+    for (int g = 0; g < 4; g++) {
+        for (int i = 0; i < 10; i++) {
+            snprintf(filename, sizeof(filename), "%s%02d", groups[g], 9 - i);
+            fs_create(filename);
+            fs_write(filename, filename, i + 1);
+        }
+    }
+    
+    // Prefix listing in small batches comes back sorted and complete
+    int cursor = fs_list_begin("log_");
+    fs_dirent entries[3];
+    char seen[10][MAX_FILENAME];
+    int total = 0, n;
+    while ((n = fs_list_next(cursor, entries, 3)) > 0) {
+        for (int i = 0; i < n; i++) {
+            if (total >= 10 || strncmp(entries[i].name, "log_", 4) != 0) {
+                printf("FAILED: Unexpected entry %s in prefix listing\n", entries[i].name);
+                return;
+            }
+            strcpy(seen[total++], entries[i].name);
+            if (entries[i].size != 10 - atoi(entries[i].name + 4)) {
+                printf("FAILED: Wrong size %d for %s\n", entries[i].size, entries[i].name);
+                return;
+            }
+        }
+        // Changes between batches neither skip nor repeat names
+        if (total == 3) {
+            fs_delete("log_03");
+            fs_create("log_00a");
+        }
+    }
+    // log_03 was deleted ahead of the cursor, log_00a created behind it
+    if (n != 0 || total != 9) {
+        printf("FAILED: Expected 9 entries, got %d (last %d)\n", total, n);
+        return;
+    }
+    for (int i = 1; i < total; i++) {
+        if (strcmp(seen[i - 1], seen[i]) >= 0) {
+            printf("FAILED: Listing not in name order (%s, %s)\n", seen[i - 1], seen[i]);
+            return;
+        }
+    }
+    if (strcmp(seen[3], "log_04") != 0) {
+        printf("FAILED: Deleted name should be skipped, got %s\n", seen[3]);
+        return;
+    }
+    fs_list_end(cursor);
+    if (fs_list_next(cursor, entries, 3) != -1 || fs_list_end(cursor) != -1) {
+        printf("FAILED: Closed cursor should be rejected\n");
+        return;
+    }
+    
+    // An empty prefix lists everything; a missing prefix lists nothing
+    cursor = fs_list_begin(NULL);
+    fs_dirent all[64];
+    if (fs_list_next(cursor, all, 64) != 40 || strcmp(all[0].name, "cfg_00") != 0) {
+        printf("FAILED: Full listing should return all 40 files in order\n");
+        return;
+    }
+    fs_list_end(cursor);
+    cursor = fs_list_begin("zzz");
+    if (fs_list_next(cursor, all, 64) != 0) {
+        printf("FAILED: Listing a missing prefix should be empty\n");
+        return;
+    }
+    fs_list_end(cursor);
+    
+    // The cursor pool is bounded
+    int open_cursors[17];
+    int opened = 0;
+    while (opened < 17 && (open_cursors[opened] = fs_list_begin("")) >= 0) opened++;
+    if (opened != 16 || open_cursors[16] != -2) {
+        printf("FAILED: Expected -2 after 16 open cursors\n");
+        return;
+    }
+    for (int i = 0; i < opened; i++) fs_list_end(open_cursors[i]);
+    
+    printf("PASSED: Listing cursors\n");
+    fs_unmount();
+}
+
+// Test 18: Metadata queries
+void test_stat() {
+    printf("=== Test 18: File Metadata ===\n");
+    
+    setup_comprehensive_disk();
+    char data[3 * BLOCK_SIZE + 10] = {0};
+    fs_create("empty.txt");
+    fs_create("data.bin");
+    fs_write("data.bin", data, sizeof(data));
+    fs_write("data.bin", data, sizeof(data));
+    
+    fs_file_stat st;
+    if (fs_stat("data.bin", &st) != 0 || st.size != (int)sizeof(data) || st.blocks != 4 || st.mod_count != 2) {
+        printf("FAILED: Wrong metadata for data.bin\n");
+        return;
+    }
+    if (fs_stat("empty.txt", &st) != 0 || st.size != 0 || st.blocks != 0 || st.mod_count != 0 || st.inode != 0) {
+        printf("FAILED: Wrong metadata for empty.txt\n");
+        return;
+    }
+    if (fs_stat("missing.txt", &st) != -1) {
+        printf("FAILED: fs_stat of a missing file should return -1\n");
+        return;
+    }
+    
+    // Stats come from memory: no data block is read
+    fs_unmount();
+    fs_mount(COMPREHENSIVE_DISK);
+    const char* names[] = {"data.bin", "missing.txt", "empty.txt"};
+    fs_file_stat many[3];
+    if (fs_stat_many(names, 3, many) != 2 || many[0].size != (int)sizeof(data) ||
+        many[1].inode != -1 || many[2].inode != 0 || many[0].mod_count != 2) {
+        printf("FAILED: Wrong results from fs_stat_many\n");
+        return;
+    }
+    fs_stats io;
+    fs_get_stats(&io);
+    if (io.disk_reads != 0) {
+        printf("FAILED: Metadata queries should not read data blocks\n");
+        return;
+    }
+    
+    printf("PASSED: File metadata\n");
+    fs_unmount();
+}
+
+// Test 19: Renaming files in place
+void test_rename() {
+    printf("=== Test 19: Rename ===\n");
+    
+    setup_comprehensive_disk();
+    char a[2 * BLOCK_SIZE], b[BLOCK_SIZE];
+    memset(a, 'a', sizeof(a));
+    memset(b, 'b', sizeof(b));
+    fs_create("old.txt");
+    fs_write("old.txt", a, sizeof(a));
+    fs_create("other.txt");
+    fs_write("other.txt", b, sizeof(b));
+    fs_unmount();
+    fs_mount(COMPREHENSIVE_DISK);
+    
+    // A rename touches neither data blocks nor the modification counter
+    if (fs_rename("old.txt", "new.txt", 0) != 0) {
+        printf("FAILED: Could not rename old.txt\n");
+        return;
+    }
+    fs_stats io;
+    fs_get_stats(&io);
+    if (io.disk_reads != 0) {
+        printf("FAILED: Rename should read no data blocks\n");
+        return;
+    }
+    fs_file_stat st;
+    if (fs_stat("old.txt", &st) != -1 || fs_stat("new.txt", &st) != 0 || st.mod_count != 1) {
+        printf("FAILED: Rename did not move the name\n");
+        return;
+    }
+    
+    // Error codes
+    if (fs_rename("missing.txt", "x.txt", 0) != -1 ||
+        fs_rename("new.txt", "other.txt", 0) != -2 ||
+        fs_rename("new.txt", "new.txt", 0) != 0 ||
+        fs_rename("new.txt", "this_name_is_far_too_long_for_an_inode.txt", 0) != -3) {
+        printf("FAILED: Wrong rename error codes\n");
+        return;
+    }
+    
+    // Replacing the target frees its blocks and keeps the renamed contents
+    int before = free_blocks();
+    if (fs_rename("new.txt", "other.txt", FS_RENAME_REPLACE) != 0 || free_blocks() != before + 1) {
+        printf("FAILED: Could not replace other.txt\n");
+        return;
+    }
+    fs_unmount();
+    fs_mount(COMPREHENSIVE_DISK);
+    char buf[sizeof(a)];
+    char names[MAX_FILES][MAX_FILENAME];
+    if (fs_list(names, MAX_FILES) != 1 || fs_read("other.txt", buf, sizeof(buf)) != (int)sizeof(a) || memcmp(buf, a, sizeof(a)) != 0) {
+        printf("FAILED: Replaced file has the wrong contents\n");
+        return;
+    }
+    
+    printf("PASSED: Rename\n");
+    fs_unmount();
+}
+
+// Test 20: Appending to and truncating files
+void test_append_truncate() {
+    printf("=== Test 20: Append and Truncate ===\n");
+    
+    setup_comprehensive_disk();
+    const int max_size = MAX_DIRECT_BLOCKS * BLOCK_SIZE;
+    char* expected = malloc(max_size);
+    char* buffer = malloc(max_size);
+    
+    // Log-style appends of 100-byte records up to the maximum file size
+    fs_create("log.txt");
+    char record[100];
+    int size = 0;
+    for (int i = 0; size + (int)sizeof(record) <= max_size; i++) {
+        memset(record, 'A' + i % 26, sizeof(record));
+        if (fs_append("log.txt", record, sizeof(record)) != 0) {
+            printf("FAILED: Append %d failed\n", i);
+            return;
+        }
+        memcpy(expected + size, record, sizeof(record));
+        size += sizeof(record);
+    }
+    if (fs_append("log.txt", record, sizeof(record)) != -3 ||
+        fs_read("log.txt", buffer, max_size) != size || memcmp(buffer, expected, size) != 0) {
+        printf("FAILED: Appended log has the wrong contents\n");
+        return;
+    }
+    
+    // Shrinking frees the trailing blocks and keeps the head
+    int before = free_blocks();
+    if (fs_truncate("log.txt", 5000) != 0 || free_blocks() != before + MAX_DIRECT_BLOCKS - (5000 + BLOCK_SIZE - 1) / BLOCK_SIZE ||
+        fs_read("log.txt", buffer, max_size) != 5000 || memcmp(buffer, expected, 5000) != 0) {
+        printf("FAILED: Truncate down\n");
+        return;
+    }
+    // Growing exposes zeros, not the bytes cut off before
+    memset(expected + 5000, 0, 1000);
+    if (fs_truncate("log.txt", 6000) != 0 ||
+        fs_read("log.txt", buffer, max_size) != 6000 || memcmp(buffer, expected, 6000) != 0) {
+        printf("FAILED: Truncate up\n");
+        return;
+    }
+    
+    // A tail block shared with a clone is copied, and a view keeps its snapshot
+    fs_clone("log.txt", "copy.txt");
+    struct iovec* iov;
+    int count;
+    fs_read_view("log.txt", &iov, &count);
+    memset(record, 'z', sizeof(record));
+    fs_append("log.txt", record, sizeof(record));
+    if (fs_read("copy.txt", buffer, max_size) != 6000 || memcmp(buffer, expected, 6000) != 0 ||
+        !view_matches(iov, count, expected, 6000)) {
+        printf("FAILED: Append changed a clone or a view\n");
+        return;
+    }
+    fs_release_view(iov);
+    memcpy(expected + 6000, record, sizeof(record));
+    
+    // Contents survive a remount; compressed files are rewritten whole
+    fs_unmount();
+    fs_mount(COMPREHENSIVE_DISK);
+    fs_create("packed.txt");
+    fs_set_compression("packed.txt", 1);
+    fs_write("packed.txt", expected, 6000);
+    fs_append("packed.txt", record, sizeof(record));
+    fs_truncate("packed.txt", 5500);
+    fs_file_stat st;
+    if (fs_read("log.txt", buffer, max_size) != 6100 || memcmp(buffer, expected, 6100) != 0 ||
+        fs_read("packed.txt", buffer, max_size) != 5500 || memcmp(buffer, expected, 5500) != 0 ||
+        fs_stat("log.txt", &st) != 0 || st.mod_count != max_size / sizeof(record) + 3) {
+        printf("FAILED: Wrong contents after remount\n");
+        return;
+    }
+    if (fs_truncate("missing.txt", 0) != -1 || fs_truncate("log.txt", max_size + 1) != -3 ||
+        fs_append("missing.txt", record, 1) != -1) {
+        printf("FAILED: Wrong error codes\n");
+        return;
+    }
+    
+    // A failed disk write leaves the file as it was and leaks no blocks
+    struct rlimit limit;
+    getrlimit(RLIMIT_FSIZE, &limit);
+    struct rlimit metadata_only = {(rlim_t)FIRST_DATA_BLOCK * BLOCK_SIZE, limit.rlim_max};
+    before = free_blocks();
+    signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &metadata_only);
+    int rewritten = fs_write("log.txt", expected, 2000);
+    int appended = fs_append("log.txt", record, sizeof(record));
+    setrlimit(RLIMIT_FSIZE, &limit);
+    signal(SIGXFSZ, SIG_DFL);
+    fs_unmount();
+    fs_mount(COMPREHENSIVE_DISK);
+    if (rewritten != -3 || appended != -3 || free_blocks() != before ||
+        fs_read("log.txt", buffer, max_size) != 6100 || memcmp(buffer, expected, 6100) != 0) {
+        printf("FAILED: A failed write changed the file\n");
+        return;
+    }
+    
+    free(expected);
+    free(buffer);
+    printf("PASSED: Append and truncate\n");
+    fs_unmount();
+}
+
+// Test 21: Streaming writers
+// Writes 16-byte records of one letter through a writer shared with other threads
+typedef struct {
+    int writer;
+    char letter;
+    int records;
+} record_writer;
+
+void* write_records(void* arg) {
+    record_writer* w = arg;
+    char record[16];
+    memset(record, w->letter, sizeof(record));
+    for (int i = 0; i < w->records; i++) fs_writer_write(w->writer, record, sizeof(record));
+    return NULL;
+}
+
+void test_stream_writer() {
+    printf("=== Test 21: Streaming Writer ===\n");
+    
+    setup_comprehensive_disk();
+    const int max_size = MAX_DIRECT_BLOCKS * BLOCK_SIZE;
+    char* expected = malloc(max_size);
+    char* buffer = malloc(max_size);
+    for (int i = 0; i < max_size; i++) expected[i] = (char)(i * 7 + i / 251);
+    fs_create("stream.bin");
+    fs_write("stream.bin", "old contents", 12);
+    int initial = free_blocks();
+    
+    // Pieces of awkward sizes, including whole blocks and empty ones
+    int writer = fs_writer_open("stream.bin");
+    const int pieces[] = {1, 37, BLOCK_SIZE, 0, 5000, 3 * BLOCK_SIZE + 1, 100};
+    int size = 0;
+    for (int i = 0; i < (int)(sizeof(pieces) / sizeof(pieces[0])); i++) {
+        if (fs_writer_write(writer, expected + size, pieces[i]) != 0) {
+            printf("FAILED: Writer rejected a piece of %d bytes\n", pieces[i]);
+            return;
+        }
+        size += pieces[i];
+    }
+    
+    // Readers see the old contents until the commit
+    if (fs_read("stream.bin", buffer, max_size) != 12 || memcmp(buffer, "old contents", 12) != 0) {
+        printf("FAILED: Uncommitted data is visible\n");
+        return;
+    }
+    if (fs_writer_commit(writer) != 0 || fs_writer_commit(writer) != -1 ||
+        fs_read("stream.bin", buffer, max_size) != size || memcmp(buffer, expected, size) != 0 ||
+        free_blocks() != initial + 1 - (size + BLOCK_SIZE - 1) / BLOCK_SIZE) {
+        printf("FAILED: Committed contents are wrong\n");
+        return;
+    }
+    
+    // Threads sharing one writer each add whole records
+    initial = free_blocks();
+    writer = fs_writer_open("stream.bin");
+    record_writer workers[4];
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        workers[i] = (record_writer){writer, 'a' + i, max_size / 16 / 4};
+        pthread_create(&threads[i], NULL, write_records, &workers[i]);
+    }
+    for (int i = 0; i < 4; i++) pthread_join(threads[i], NULL);
+    int shared_size = 4 * workers[0].records * 16;
+    int whole_records = fs_writer_commit(writer) == 0 && fs_read("stream.bin", buffer, max_size) == shared_size;
+    for (int i = 0; i < shared_size && whole_records; i++) {
+        whole_records = buffer[i] >= 'a' && buffer[i] <= 'd' && buffer[i] == buffer[i - i % 16];
+    }
+    if (!whole_records || free_blocks() != initial + (size + BLOCK_SIZE - 1) / BLOCK_SIZE -
+                                          (shared_size + BLOCK_SIZE - 1) / BLOCK_SIZE) {
+        printf("FAILED: Concurrent writes through one writer\n");
+        return;
+    }
+    fs_write("stream.bin", expected, size);
+    
+    // Aborting, or deleting the file under a writer, gives the blocks back
+    initial = free_blocks();
+    writer = fs_writer_open("stream.bin");
+    fs_writer_write(writer, expected, 2 * BLOCK_SIZE);
+    if (fs_writer_abort(writer) != 0 || free_blocks() != initial ||
+        fs_read("stream.bin", buffer, max_size) != size) {
+        printf("FAILED: Abort changed the file\n");
+        return;
+    }
+    fs_create("doomed.bin");
+    writer = fs_writer_open("doomed.bin");
+    fs_writer_write(writer, expected, 2 * BLOCK_SIZE);
+    fs_delete("doomed.bin");
+    fs_create("doomed.bin");
+    if (fs_writer_commit(writer) != -1 || free_blocks() != initial ||
+        fs_read("doomed.bin", buffer, max_size) != 0) {
+        printf("FAILED: Commit to a deleted file\n");
+        return;
+    }
+    
+    // Limits and errors
+    writer = fs_writer_open("stream.bin");
+    if (fs_writer_write(writer, expected, max_size) != 0 || fs_writer_write(writer, expected, 1) != -3) {
+        printf("FAILED: Writer size limit\n");
+        return;
+    }
+    int extra[8];
+    int opened = 0;
+    while (opened < 8 && (extra[opened] = fs_writer_open("stream.bin")) >= 0) opened++;
+    if (opened != 7 || fs_writer_open("missing.bin") != -1 || fs_writer_write(99, expected, 1) != -1) {
+        printf("FAILED: Wrong writer error codes\n");
+        return;
+    }
+    for (int i = 0; i < opened; i++) fs_writer_abort(extra[i]);
+    fs_writer_commit(writer);
+    
+    // Commits persist; writers left open are dropped at unmount
+    writer = fs_writer_open("doomed.bin");
+    fs_writer_write(writer, expected, 3 * BLOCK_SIZE);
+    fs_unmount();
+    fs_mount(COMPREHENSIVE_DISK);
+    if (fs_read("stream.bin", buffer, max_size) != max_size || memcmp(buffer, expected, max_size) != 0 ||
+        fs_read("doomed.bin", buffer, max_size) != 0 || free_blocks() != initial - MAX_DIRECT_BLOCKS + (size + BLOCK_SIZE - 1) / BLOCK_SIZE) {
+        printf("FAILED: Wrong contents after remount\n");
+        return;
+    }
+    
+    free(expected);
+    free(buffer);
+    printf("PASSED: Streaming writer\n");
+    fs_unmount();
+}
+
+// Collects streamed pieces into a buffer; stops once limit bytes have arrived
+typedef struct {
+    char* buffer;
+    int received;
+    int calls;
+    int limit;
+} stream_sink;
+
+int collect_piece(void* ctx, const void* data, int len) {
+    stream_sink* sink = ctx;
+    memcpy(sink->buffer + sink->received, data, len);
+    sink->received += len;
+    sink->calls++;
+    // Reads made from inside the callback must not disturb the stream
+    char other[BLOCK_SIZE];
+    fs_read("other.bin", other, sizeof(other));
+    return sink->limit > 0 && sink->received >= sink->limit;
+}
+
+// Test 22: Callback-driven streaming reads
+void test_read_stream() {
+    printf("=== Test 22: Streaming Reader ===\n");
+    
+    setup_comprehensive_disk();
+    const int max_size = MAX_DIRECT_BLOCKS * BLOCK_SIZE;
+    char* expected = malloc(max_size);
+    char* buffer = malloc(max_size);
+    for (int i = 0; i < max_size; i++) expected[i] = (char)(i % 253);
+    int size = max_size - 1000;
+    fs_create("stream.bin");
+    fs_write("stream.bin", expected, size);
+    fs_create("other.bin");
+    fs_write("other.bin", expected, 3 * BLOCK_SIZE);
+    fs_unmount();
+    fs_mount(COMPREHENSIVE_DISK);
+    
+    // Every block arrives in order, in a few coalesced disk reads
+    stream_sink sink = {buffer, 0, 0, 0};
+    if (fs_read_stream("stream.bin", collect_piece, &sink) != size || sink.received != size ||
+        sink.calls != MAX_DIRECT_BLOCKS || memcmp(buffer, expected, size) != 0) {
+        printf("FAILED: Streamed contents are wrong\n");
+        return;
+    }
+    fs_stats io;
+    fs_get_stats(&io);
+    if (io.disk_reads > MAX_DIRECT_BLOCKS / 4 + 1) {
+        printf("FAILED: Streaming took %lu disk reads\n", io.disk_reads);
+        return;
+    }
+    
+    // The callback can stop early
+    sink = (stream_sink){buffer, 0, 0, 2 * BLOCK_SIZE};
+    if (fs_read_stream("stream.bin", collect_piece, &sink) != 2 * BLOCK_SIZE || sink.calls != 2) {
+        printf("FAILED: Stream did not stop when asked\n");
+        return;
+    }
+    
+    // Compressed files are expanded first, then arrive block by block and can stop too
+    fs_create("packed.txt");
+    fs_set_compression("packed.txt", 1);
+    memset(expected, 'p', 3 * BLOCK_SIZE);
+    fs_write("packed.txt", expected, 3 * BLOCK_SIZE);
+    sink = (stream_sink){buffer, 0, 0, 0};
+    if (fs_read_stream("packed.txt", collect_piece, &sink) != 3 * BLOCK_SIZE || sink.calls != 3 ||
+        memcmp(buffer, expected, 3 * BLOCK_SIZE) != 0) {
+        printf("FAILED: Compressed file streamed wrongly\n");
+        return;
+    }
+    sink = (stream_sink){buffer, 0, 0, BLOCK_SIZE};
+    if (fs_read_stream("packed.txt", collect_piece, &sink) != BLOCK_SIZE || sink.calls != 1) {
+        printf("FAILED: Compressed stream did not stop when asked\n");
+        return;
+    }
+    
+    fs_create("empty.txt");
+    if (fs_read_stream("empty.txt", collect_piece, &sink) != 0 ||
+        fs_read_stream("missing.txt", collect_piece, &sink) != -1 ||
+        fs_read_stream("stream.bin", NULL, &sink) != -3) {
+        printf("FAILED: Wrong streaming error codes\n");
+        return;
+    }
+    
+    free(expected);
+    free(buffer);
+    printf("PASSED: Streaming reader\n");
+    fs_unmount();
+}
+
+typedef struct {
+    int id;
+    int errors;
+} group_worker;
+
+void* churn_own_files(void* arg) {
+    group_worker* w = arg;
+    char filename[MAX_FILENAME];
+    char data[3 * BLOCK_SIZE];
+    char check[3 * BLOCK_SIZE];
+    for (int round = 0; round < 50; round++) {
+        snprintf(filename, sizeof(filename), "worker_%d_%d", w->id, round % 3);
+        memset(data, 'A' + w->id, sizeof(data));
+        data[0] = (char)round;
+        fs_create(filename);
+        if (fs_write(filename, data, 2 * BLOCK_SIZE) != 0 ||
+            fs_append(filename, data, BLOCK_SIZE) != 0 ||
+            fs_read(filename, check, sizeof(check)) != sizeof(check) ||
+            memcmp(check, data, 2 * BLOCK_SIZE) != 0 ||
+            memcmp(check + 2 * BLOCK_SIZE, data, BLOCK_SIZE) != 0) {
+            w->errors++;
+        }
+        if (round % 3 == 2) fs_delete(filename);
+    }
+    return NULL;
+}
+
+// Test 23: Block groups and concurrent callers
+void test_block_groups() {
+    printf("=== Test 23: Block Groups ===\n");
+    
+    setup_comprehensive_disk();
+    fs_group_info info[BLOCK_GROUPS];
+    if (fs_group_stats(info, BLOCK_GROUPS) != BLOCK_GROUPS) {
+        printf("FAILED: Wrong number of block groups\n");
+        return;
+    }
+    int total = 0;
+    for (int g = 0; g < BLOCK_GROUPS; g++) {
+        total += info[g].free_blocks;
+        if (info[g].inodes != MAX_FILES / BLOCK_GROUPS || info[g].free_inodes != info[g].inodes ||
+            info[g].first_block + info[g].blocks != (g + 1) * BLOCKS_PER_GROUP) {
+            printf("FAILED: Group %d has the wrong shape\n", g);
+            return;
+        }
+    }
+    if (total != free_blocks()) {
+        printf("FAILED: Group free counts (%d) disagree with the total (%d)\n", total, free_blocks());
+        return;
+    }
+    
+    // Consecutive files land in different groups and take their blocks from them
+    char filename[MAX_FILENAME];
+    char data[2 * BLOCK_SIZE];
+    memset(data, 'g', sizeof(data));
+    for (int i = 0; i < BLOCK_GROUPS; i++) {
+        snprintf(filename, sizeof(filename), "group_%d", i);
+        fs_create(filename);
+        fs_write(filename, data, sizeof(data));
+    }
+    fs_group_info after[BLOCK_GROUPS];
+    fs_group_stats(after, BLOCK_GROUPS);
+    for (int g = 0; g < BLOCK_GROUPS; g++) {
+        if (after[g].free_blocks != info[g].free_blocks - 2 || after[g].free_inodes != after[g].inodes - 1) {
+            printf("FAILED: Group %d did not hold one file's blocks\n", g);
+            return;
+        }
+    }
+    
+    // Threads working on their own files don't corrupt each other
+    pthread_t threads[BLOCK_GROUPS];
+    group_worker workers[BLOCK_GROUPS];
+    for (int i = 0; i < BLOCK_GROUPS; i++) {
+        workers[i] = (group_worker){i, 0};
+        pthread_create(&threads[i], NULL, churn_own_files, &workers[i]);
+    }
+    for (int i = 0; i < BLOCK_GROUPS; i++) {
+        pthread_join(threads[i], NULL);
+        if (workers[i].errors != 0) {
+            printf("FAILED: Worker %d saw %d bad reads or writes\n", i, workers[i].errors);
+            return;
+        }
+    }
+    fs_group_stats(after, BLOCK_GROUPS);
+    total = 0;
+    for (int g = 0; g < BLOCK_GROUPS; g++) total += after[g].free_blocks;
+    if (total != free_blocks()) {
+        printf("FAILED: Free counts drifted under concurrency\n");
+        return;
+    }
+    fs_unmount();
+    fs_mount(COMPREHENSIVE_DISK);
+    fs_group_stats(info, BLOCK_GROUPS);
+    for (int g = 0; g < BLOCK_GROUPS; g++) {
+        if (info[g].free_blocks != after[g].free_blocks) {
+            printf("FAILED: Group %d free count changed across a remount\n", g);
+            return;
+        }
+    }
+    
+    if (fs_group_stats(NULL, 1) != -3) {
+        printf("FAILED: fs_group_stats accepted a NULL array\n");
+        return;
+    }
+    printf("PASSED: Block groups\n");
+    fs_unmount();
+}
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int wrote;
+    int done;
+} parked_writer;
+
+void* write_and_wait(void* arg) {
+    parked_writer* p = arg;
+    char data[BLOCK_SIZE];
+    memset(data, 'w', sizeof(data));
+    fs_create("parked.txt");
+    int result = fs_write("parked.txt", data, sizeof(data));
+    pthread_mutex_lock(&p->lock);
+    p->wrote = (result == 0) ? 1 : -1;
+    pthread_cond_broadcast(&p->cond);
+    while (!p->done) pthread_cond_wait(&p->cond, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// Test 24: Per-thread block allocation caches
+void test_alloc_caches() {
+    printf("=== Test 24: Allocation Caches ===\n");
+    
+    setup_comprehensive_disk();
+    int initial = free_blocks();
+    const int max_size = MAX_DIRECT_BLOCKS * BLOCK_SIZE;
+    char* data = malloc(max_size);
+    memset(data, 'c', max_size);
+    
+    // A full-size file takes its blocks in a couple of batches, in order
+    fs_stats before, after;
+    fs_get_stats(&before);
+    fs_create("batched.bin");
+    fs_write("batched.bin", data, max_size);
+    fs_get_stats(&after);
+    unsigned long refills = after.alloc_cache_refills - before.alloc_cache_refills;
+    if (refills == 0 || refills > (MAX_DIRECT_BLOCKS + 7) / 8 + 1) {
+        printf("FAILED: Writing %d blocks took %lu refills\n", MAX_DIRECT_BLOCKS, refills);
+        return;
+    }
+    fs_frag_report frag;
+    fs_fragmentation(&frag);
+    if (frag.fragmented_files != 0 || free_blocks() != initial - MAX_DIRECT_BLOCKS) {
+        printf("FAILED: Cached allocation scattered the file or miscounted\n");
+        return;
+    }
+    
+    // Blocks still in the cache at unmount are written back as free
+    fs_unmount();
+    fs_mount(COMPREHENSIVE_DISK);
+    fs_group_info info[BLOCK_GROUPS];
+    fs_group_stats(info, BLOCK_GROUPS);
+    int total = 0;
+    for (int g = 0; g < BLOCK_GROUPS; g++) total += info[g].free_blocks;
+    if (total != initial - MAX_DIRECT_BLOCKS) {
+        printf("FAILED: Cached blocks were written back as used (%d free)\n", total);
+        return;
+    }
+    
+    // Blocks parked in another thread's cache are still usable
+    parked_writer parked = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0};
+    pthread_t thread;
+    pthread_create(&thread, NULL, write_and_wait, &parked);
+    pthread_mutex_lock(&parked.lock);
+    while (!parked.wrote) pthread_cond_wait(&parked.cond, &parked.lock);
+    pthread_mutex_unlock(&parked.lock);
+    char filename[MAX_FILENAME];
+    int failed = 0;
+    // A small inode table may run out before the disk does
+    int can_fill = (MAX_FILES - 3) * MAX_DIRECT_BLOCKS >= MAX_BLOCKS - FIRST_DATA_BLOCK;
+    for (int i = 0; free_blocks() > 0; i++) {
+        int blocks = free_blocks() < MAX_DIRECT_BLOCKS ? free_blocks() : MAX_DIRECT_BLOCKS;
+        snprintf(filename, sizeof(filename), "fill_%d", i);
+        if (fs_create(filename) != 0) {
+            failed = can_fill;
+            break;
+        }
+        if (fs_write(filename, data, blocks * BLOCK_SIZE) != 0) {
+            failed = 1;
+            break;
+        }
+    }
+    pthread_mutex_lock(&parked.lock);
+    parked.done = 1;
+    pthread_cond_broadcast(&parked.cond);
+    pthread_mutex_unlock(&parked.lock);
+    pthread_join(thread, NULL);
+    if (parked.wrote != 1 || failed || (can_fill && free_blocks() != 0)) {
+        printf("FAILED: Could not use every free block (%d left)\n", free_blocks());
+        return;
+    }
+    
+    // Nothing leaks once the files are gone and the thread has exited
+    fs_delete("parked.txt");
+    fs_delete("batched.bin");
+    for (int i = 0; ; i++) {
+        snprintf(filename, sizeof(filename), "fill_%d", i);
+        if (fs_delete(filename) != 0) break;
+    }
+    fs_group_stats(info, BLOCK_GROUPS);
+    total = 0;
+    for (int g = 0; g < BLOCK_GROUPS; g++) total += info[g].free_blocks;
+    if (free_blocks() != initial || total != initial) {
+        printf("FAILED: Blocks leaked (%d free, %d in groups, %d expected)\n", free_blocks(), total, initial);
+        return;
+    }
+    
+    free(data);
+    printf("PASSED: Allocation caches\n");
+    fs_unmount();
+}
+
+// Test 25: Disk geometry and the layout derived from it
+void test_geometry() {
+    printf("=== Test 25: Geometry ===\n");
+    
+    setup_comprehensive_disk();
+    fs_unmount();
+    
+    // The metadata regions follow one another and leave the rest for data
+    if (INODE_TABLE_BLOCKS * BLOCK_SIZE < MAX_FILES * (int)sizeof(inode) ||
+        CRC_TABLE_BLOCKS * BLOCK_SIZE < MAX_BLOCKS * 4 ||
+        FIRST_DATA_BLOCK != INODE_TABLE_START + INODE_TABLE_BLOCKS + CRC_TABLE_BLOCKS ||
+        BLOCK_GROUPS * BLOCKS_PER_GROUP != MAX_BLOCKS) {
+        printf("FAILED: Layout regions don't fit the geometry\n");
+        return;
+    }
+    
+    // The image records the geometry it was formatted with
+    superblock sb;
+    struct stat st;
+    int fd = open(COMPREHENSIVE_DISK, O_RDWR);
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size != (off_t)MAX_BLOCKS * BLOCK_SIZE ||
+        pread(fd, &sb, sizeof(sb), 0) != sizeof(sb) || sb.total_blocks != MAX_BLOCKS ||
+        sb.block_size != BLOCK_SIZE || sb.total_inodes != MAX_FILES ||
+        sb.direct_blocks != MAX_DIRECT_BLOCKS || sb.free_blocks != MAX_BLOCKS - FIRST_DATA_BLOCK) {
+        printf("FAILED: Image doesn't match the geometry\n");
+        return;
+    }
+    
+    // An image formatted for another geometry is refused
+    superblock other = sb;
+    other.total_blocks = MAX_BLOCKS / 2;
+    pwrite(fd, &other, sizeof(other), 0);
+    if (fs_mount(COMPREHENSIVE_DISK) != -1) {
+        printf("FAILED: Mounted an image with another block count\n");
+        return;
+    }
+    other = sb;
+    other.block_size = BLOCK_SIZE * 2;
+    pwrite(fd, &other, sizeof(other), 0);
+    if (fs_mount(COMPREHENSIVE_DISK) != -1) {
+        printf("FAILED: Mounted an image with another block size\n");
+        return;
+    }
+    other = sb;
+    other.direct_blocks = MAX_DIRECT_BLOCKS + 4;
+    pwrite(fd, &other, sizeof(other), 0);
+    if (fs_mount(COMPREHENSIVE_DISK) != -1) {
+        printf("FAILED: Mounted an image with another inode size\n");
+        return;
+    }
+    pwrite(fd, &sb, sizeof(sb), 0);
+    close(fd);
+    if (fs_mount(COMPREHENSIVE_DISK) != 0) {
+        printf("FAILED: Could not mount the restored image\n");
+        return;
+    }
+    
+    printf("PASSED: Geometry (%d blocks of %d bytes, %d inodes, data from block %d)\n",
+           MAX_BLOCKS, BLOCK_SIZE, MAX_FILES, FIRST_DATA_BLOCK);
+    fs_unmount();
+}
+
+// Test 26: Recording a trace of the calls made
+void test_trace() {
+    printf("=== Test 26: Trace Recording ===\n");
+    
+    if (getenv("FS_TRACE")) {
+        printf("PASSED: Trace recording (skipped while FS_TRACE records the whole run)\n");
+        return;
+    }
+    setup_comprehensive_disk();
+    const char* trace_path = "comprehensive.trace";
+    if (fs_trace_stop() != -1 || fs_trace_start(trace_path) != 0 || fs_trace_start(trace_path) != -2) {
+        printf("FAILED: Wrong results starting a trace\n");
+        fs_unmount();
+        return;
+    }
+    
+    // Five calls, one of them with a NULL name
+    char buffer[64];
+    fs_file_stat st;
+    fs_create("traced.txt");
+    fs_write("traced.txt", "traced data", 11);
+    fs_read_at("traced.txt", buffer, sizeof(buffer), 7);
+    fs_stat(NULL, &st);
+    fs_delete("traced.txt");
+    if (fs_trace_stop() != 0 || fs_trace_stop() != -1) {
+        printf("FAILED: Wrong results stopping a trace\n");
+        fs_unmount();
+        return;
+    }
+    fs_create("untraced.txt");
+    
+    // Walk the records back
+    char trace[4096];
+    int fd = open(trace_path, O_RDONLY);
+    int len = (fd < 0) ? -1 : read(fd, trace, sizeof(trace));
+    if (fd >= 0) close(fd);
+    remove(trace_path);
+    fs_trace_header header;
+    if (len < (int)sizeof(header)) {
+        printf("FAILED: Trace file is missing or short\n");
+        fs_unmount();
+        return;
+    }
+    memcpy(&header, trace, sizeof(header));
+    if (memcmp(header.magic, FS_TRACE_MAGIC, 4) != 0 || header.version != FS_TRACE_VERSION ||
+        header.max_blocks != MAX_BLOCKS || header.block_size != BLOCK_SIZE || header.max_files != MAX_FILES) {
+        printf("FAILED: Trace header is wrong\n");
+        fs_unmount();
+        return;
+    }
+    int expected_ops[] = {FS_OP_CREATE, FS_OP_WRITE, FS_OP_READ_AT, FS_OP_STAT, FS_OP_DELETE};
+    int expected_results[] = {0, 0, 4, -3, 0};
+    int pos = sizeof(header);
+    int records = 0;
+    uint64_t last_start = 0;
+    while (pos + (int)sizeof(fs_trace_record) <= len) {
+        fs_trace_record rec;
+        memcpy(&rec, trace + pos, sizeof(rec));
+        pos += sizeof(rec);
+        int name_bytes = (rec.name_len == FS_TRACE_NULL_NAME) ? 0 : rec.name_len;
+        if (records >= 5 || rec.op != expected_ops[records] || rec.result != expected_results[records] ||
+            rec.start_ns < last_start || (rec.op == FS_OP_STAT) != (rec.name_len == FS_TRACE_NULL_NAME) ||
+            (rec.op == FS_OP_READ_AT && (rec.size != 64 || rec.arg != 7)) ||
+            (name_bytes && (name_bytes != 10 || memcmp(trace + pos, "traced.txt", 10) != 0))) {
+            printf("FAILED: Record %d doesn't match the call made\n", records);
+            fs_unmount();
+            return;
+        }
+        last_start = rec.start_ns;
+        pos += name_bytes;
+        records++;
+    }
+    if (records != 5 || pos != len) {
+        printf("FAILED: Trace holds %d records, expected 5\n", records);
+        fs_unmount();
+        return;
+    }
+    
+    printf("PASSED: Trace recording (%d bytes for %d calls)\n", len, records);
+    fs_unmount();
+}
+
 int main() {
     printf("Starting Comprehensive Tests...\n\n");
     
@@ -369,6 +2133,27 @@ int main() {
     test_fill_capacity();
     test_delete_and_reuse();
     test_error_conditions();
+    test_offset_reads();
+    test_direct_mount();
+    test_read_views();
+    test_sendfile();
+    test_checksums();
+    test_compression();
+    test_dedup();
+    test_clone();
+    test_defrag();
+    test_discard();
+    test_lazy_mount();
+    test_list_cursor();
+    test_stat();
+    test_rename();
+    test_append_truncate();
+    test_stream_writer();
+    test_read_stream();
+    test_block_groups();
+    test_alloc_caches();
+    test_geometry();
+    test_trace();
     
     printf("\n=== All Comprehensive Tests Completed Successfully! ===\n");
     return 0;
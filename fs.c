@@ -1,23 +1,319 @@
+#define _GNU_SOURCE // O_DIRECT
 #include "fs.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+// Number of blocks held in the block cache
+#define CACHE_BLOCKS 256
+
+// Readahead window bounds, in blocks
+#define READAHEAD_MIN 2
+#define READAHEAD_MAX MAX_DIRECT_BLOCKS
+
+// fs_read_stream fetches this many blocks at a time, with the next run
+// already requested from the host while the callback works on this one
+#define STREAM_RUN 4
+
+// Outstanding zero-copy read views, and the cache slots kept unpinned so
+// ordinary reads can always make progress
+#define MAX_VIEWS 64
+#define CACHE_RESERVED_SLOTS (2 * MAX_DIRECT_BLOCKS)
+
+// Aligned bounce buffers for metadata and unaligned data I/O, in blocks:
+// enough for a whole file or the largest metadata region
+#define MAX_OF(a, b) ((a) > (b) ? (a) : (b))
+#define IO_POOL_BLOCKS MAX_OF(MAX_DIRECT_BLOCKS, MAX_OF(INODE_TABLE_BLOCKS, CRC_TABLE_BLOCKS))
+
+_Static_assert(CACHE_BLOCKS >= MAX_DIRECT_BLOCKS + READAHEAD_MAX,
+               "block cache must hold a full read plus its readahead window");
+_Static_assert(IO_POOL_BLOCKS >= INODE_TABLE_BLOCKS && IO_POOL_BLOCKS >= CRC_TABLE_BLOCKS,
+               "I/O pool must hold the whole inode and checksum table regions");
+_Static_assert(CRC_TABLE_BLOCKS * BLOCK_SIZE >= MAX_BLOCKS * sizeof(uint32_t),
+               "checksum table must have an entry for every block");
+_Static_assert(FIRST_DATA_BLOCK == CRC_TABLE_START + CRC_TABLE_BLOCKS,
+               "data blocks start right after the checksum table");
+
+// Geometry (see fs.h)
+_Static_assert(BLOCK_SIZE >= 512 && (BLOCK_SIZE & (BLOCK_SIZE - 1)) == 0,
+               "blocks must be a power of two of at least one sector for O_DIRECT");
+_Static_assert(MAX_FILES * sizeof(inode) <= INODE_TABLE_BLOCKS * BLOCK_SIZE,
+               "inode table must fit its region");
+_Static_assert(MAX_DIRECT_BLOCKS > 0 && FIRST_DATA_BLOCK < MAX_BLOCKS,
+               "the disk must have room for data");
+_Static_assert(MAX_BLOCKS <= 32767 && MAX_FILES <= 32767,
+               "block and inode numbers must fit the short indexes");
+
+// LZ4-style block codec parameters
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_LAST_LITERALS 5   // the final bytes are always emitted as literals
+#define LZ_MATCH_LIMIT 12    // no match may start this close to the end
+#define LZ_MAX_OFFSET 65535
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+// Lazy mounts load the inode table in chunks of as many inodes as fit in a
+// block, so a chunk spans at most two table blocks; the last may be shorter
+#define INODE_CHUNK ((int)(BLOCK_SIZE / sizeof(inode)))
+#define INODE_CHUNKS ((MAX_FILES + INODE_CHUNK - 1) / INODE_CHUNK)
+
+// Outstanding fs_list cursors
+#define MAX_CURSORS 16
+
+// Streaming writers open at once
+#define MAX_WRITERS 8
+
+// Threads with their own block allocation cache, and the blocks each cache
+// holds per group (taken from the group in one batch)
+#define ALLOC_CACHES 16
+#define ALLOC_CACHE_BLOCKS 8
+
+// Reference counts are one byte per block; a block shared this many times
+// is not shared any further
+#define BLOCK_REF_MAX 255
+_Static_assert(MAX_BLOCKS <= BLOCK_SIZE, "reference counts must fit in one block");
+
+// Block groups (see fs.h)
+_Static_assert(MAX_BLOCKS % BLOCKS_PER_GROUP == 0, "block groups must divide the disk");
+_Static_assert(FIRST_DATA_BLOCK < BLOCKS_PER_GROUP, "metadata must fit in the first group");
+
+// Buckets in the dedup fingerprint index (a power of two)
+#define DEDUP_BUCKETS 4096
+
+// Freed blocks queued before their holes are punched in one merged pass
+#define DISCARD_BATCH 64
+
+// CRC32C (Castagnoli) polynomial, reflected
+#define CRC32C_POLY 0x82f63b78
+// Stream length for the three-way interleaved hardware CRC
+#define CRC32C_SHORT 256
 
 // Global variables for in-memory filesystem state
 static superblock sb;
 static inode inode_table[MAX_FILES];
-static unsigned char block_bitmap[BLOCK_SIZE];
+static unsigned char block_refs[BLOCK_SIZE] __attribute__((aligned(BLOCK_SIZE)));
 static int disk_fd = -1;
+static int direct_io = 0; // disk_fd was opened with O_DIRECT
+static int verify_reads = 1; // check block checksums when reading from disk
+static int dedup_writes = 0; // share identical blocks on write
+static int discard_freed = 0; // punch holes in the image for freed blocks
+
+// Freed blocks whose holes have not been punched yet
+static unsigned char discard_pending[MAX_BLOCKS];
+static int discard_count = 0;
+
+// Per-block CRC32C of every data block, indexed by block number
+static uint32_t crc_table[CRC_TABLE_BLOCKS * BLOCK_SIZE / sizeof(uint32_t)] __attribute__((aligned(BLOCK_SIZE)));
+
+// Dedup fingerprint index: every used data block chained into the bucket of
+// its checksum. Checksum matches are only candidates; the contents decide.
+static short dedup_head[DEDUP_BUCKETS];
+static short dedup_next[MAX_BLOCKS];
+
+// Pool of block-aligned buffers every unaligned transfer is staged through,
+// so that all I/O against disk_fd satisfies O_DIRECT's alignment rules.
+// One per thread, so concurrent writers don't share it.
+static __thread unsigned char io_pool[IO_POOL_BLOCKS][BLOCK_SIZE] __attribute__((aligned(BLOCK_SIZE)));
+
+// Stack of free inode indices, rebuilt from the used flags at format/mount.
+// The lowest free index sits on top so allocation order matches a first-fit scan.
+static int free_inode_stack[MAX_FILES];
+static int free_inode_top = 0;
+static int free_inodes_ready = 0; // the stack reflects the whole table
+
+// Lazy inode table loading: chunks are read on first touch, or ahead of time
+// by a prefetch thread. Loads are serialized by inode_load_lock and publish
+// inode_chunk_ready with release semantics, so a chunk marked ready can be
+// used without the lock.
+static unsigned char inode_chunk_ready[INODE_CHUNKS];
+static pthread_mutex_t inode_load_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char inode_io[2][BLOCK_SIZE] __attribute__((aligned(BLOCK_SIZE)));
+static pthread_t inode_prefetcher;
+static int inode_prefetching = 0;
+static int inode_prefetch_stop = 0;
+
+// Inode numbers of the used inodes sorted by name, for O(log n) lookups and
+// prefix listings. Built once the whole inode table is in memory; until then
+// (lazy mounts) lookups scan the table.
+static short name_index[MAX_FILES];
+static int name_count = 0;
+static int name_index_ready = 0;
+
+// A listing cursor resumes after the last name it returned, so files created
+// or deleted between batches never make it skip or repeat a name
+typedef struct {
+    int in_use;
+    int started;
+    int prefix_len;
+    char prefix[MAX_FILENAME];
+    char last[MAX_FILENAME];
+} list_cursor;
+
+static list_cursor cursors[MAX_CURSORS];
+
+// A streaming writer builds the file's new contents in blocks of its own and
+// swaps them into the inode on commit. Only the block being filled is
+// buffered; inode is -1 once the file has been deleted.
+typedef struct {
+    int in_use;
+    int inode;
+    int size;
+    int count;
+    int blocks[MAX_DIRECT_BLOCKS];
+    unsigned char buffer[BLOCK_SIZE] __attribute__((aligned(BLOCK_SIZE)));
+} stream_writer;
+
+static stream_writer writers[MAX_WRITERS];
+
+// Block cache: each slot holds one disk block. cache_index maps a disk block
+// to its slot (or -1), and slots are recycled least-recently-used first.
+// Slots pinned by a read view are never recycled; if their block is freed
+// they are detached from cache_index but keep their contents until unpinned.
+typedef struct {
+    int block;                 // Disk block held in this slot, or -1 if empty/detached
+    int readahead;             // Filled by readahead and not yet consumed
+    int pins;                  // Read views referencing this slot
+    unsigned long last_used;   // Cache tick of the last access
+} cache_slot;
+
+static unsigned char cache_data[CACHE_BLOCKS][BLOCK_SIZE] __attribute__((aligned(BLOCK_SIZE)));
+static cache_slot cache_slots[CACHE_BLOCKS];
+static short cache_index[MAX_BLOCKS];
+static unsigned long cache_tick = 0;
+static int pinned_slots = 0;
+static int cache_loading = 0;  // Slots reserved by reads in progress
+
+// A zero-copy read view: the iovecs handed to the caller and the slots they pin
+typedef struct {
+    int in_use;
+    int count;
+    int slots[MAX_DIRECT_BLOCKS];
+    struct iovec iov[MAX_DIRECT_BLOCKS];
+} read_view;
+
+static read_view views[MAX_VIEWS];
+
+// Per-inode sequential access state used to size the readahead window
+typedef struct {
+    int next_offset;  // Byte offset where a sequential read would continue
+    int window;       // Current readahead window in blocks (0 = random access)
+} readahead_state;
+
+static readahead_state ra_state[MAX_FILES];
+static fs_stats stats;
+
+// Statistics are bumped by concurrent readers and writers
+#define STAT_ADD(field, n) __atomic_fetch_add(&stats.field, (n), __ATOMIC_RELAXED)
+
+// A block group. free_blocks counts blocks with no references in the group
+// and is read without the lock to skip full groups; first_free is a lower
+// bound on the group's first free block.
+typedef struct {
+    pthread_mutex_t lock;
+    int free_blocks;
+    int first_free;
+} block_group;
+
+static block_group groups[BLOCK_GROUPS] = {[0 ... BLOCK_GROUPS - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER}};
+
+// A thread's block allocation cache: free blocks taken from each group in a
+// batch, so most allocations only touch the thread's own cache. Cached
+// blocks already hold a reference and are reserved: they count neither as
+// free in their group nor in sb.free_blocks (cached_blocks keeps their
+// total for the statistics). Every reservation made with reserve_blocks()
+// is therefore backed by a free block in some group. The lock is only
+// contended when another thread drains the cache.
+typedef struct {
+    pthread_mutex_t lock;
+    int in_use;
+    int count[BLOCK_GROUPS];
+    int blocks[BLOCK_GROUPS][ALLOC_CACHE_BLOCKS];
+} alloc_cache;
+
+static alloc_cache alloc_caches[ALLOC_CACHES] = {[0 ... ALLOC_CACHES - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER}};
+static pthread_mutex_t alloc_cache_lock = PTHREAD_MUTEX_INITIALIZER; // guards in_use
+static int cached_blocks = 0; // blocks held by all the caches
+static pthread_key_t alloc_cache_key;
+static pthread_once_t alloc_cache_once = PTHREAD_ONCE_INIT;
+static __thread alloc_cache* my_cache = NULL;
+static __thread int my_cache_tried = 0; // set once the thread has asked for a cache
+
+// Locking. Namespace and whole-filesystem operations hold fs_lock
+// exclusively; data operations hold it shared plus the file's inode lock,
+// or a streaming writer's own lock for writes through that writer.
+// Below those, dedup_lock serializes writes on a dedup mount (the
+// fingerprint index and the sharing of blocks), a group's lock guards its
+// reference counts, and cache_lock and discard_lock guard the block cache
+// (with the read views) and the discard queue. Locks are taken in that order;
+// a thread's allocation cache lock comes before the group locks. Disk reads
+// into the cache happen with cache_lock dropped (see cache_fill).
+// Public functions that need fs_lock exclusively wrap a static body that
+// expects it held.
+static pthread_rwlock_t fs_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t inode_locks[MAX_FILES] = {[0 ... MAX_FILES - 1] = PTHREAD_MUTEX_INITIALIZER};
+static pthread_mutex_t writer_locks[MAX_WRITERS] = {[0 ... MAX_WRITERS - 1] = PTHREAD_MUTEX_INITIALIZER};
+static pthread_mutex_t dedup_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cache_filled = PTHREAD_COND_INITIALIZER; // A read into the cache finished
+static pthread_mutex_t discard_lock = PTHREAD_MUTEX_INITIALIZER;
 
 // Helper function prototypes
 static int find_inode(const char* filename);
-static int find_free_inode();
-static int find_free_block();
-static void mark_block_used(int block_num);
-static void mark_block_free(int block_num);
+static int alloc_inode();
+static void release_inode(int inode_num);
+static void rebuild_free_inodes();
+static int load_inode_chunk(int chunk);
+static int load_all_inodes();
+static int name_lower_bound(const char* name);
+static int alloc_block(int group);
+static void drain_all_caches();
+static void block_ref(int block_num);
+static void block_unref(int block_num);
+static void dedup_insert(int block_num);
+static void discard_queue(int block_num);
+static void discard_cancel(int block_num);
+static void dedup_remove(int block_num);
+static void cache_reset();
+static int cache_lookup(int block_num);
+static int cache_fill(const int* block_nums, int count, int first_readahead);
+static int cache_fetch(const int* block_nums, int count);
+static void cache_invalidate(int block_num);
+static int verify_block(int block_num, const void* data);
+static int read_region(int first_block, void* buf, int len);
+static int write_region(int first_block, const void* buf, int len);
+static int write_blocks(const int* block_nums, const char* data, int size, const char* skip);
+static int load_block(int block_num, void* buf);
+static void writer_abort(stream_writer* writer);
+static void trace_from_env();
+static uint64_t trace_begin();
+static void trace_end(uint64_t start, int op, const char* name, const char* name2, int size, int arg, int result);
+static void trace_end_many(uint64_t start, int op, const char* const* names, int count, int result);
+static int trace_view(const struct iovec* iov, int opening);
 static void read_inode(int inode_num, inode* target);
 static void write_inode(int inode_num, const inode* source);
 
-// Find the index of the inode with the given filename, or -1 if not found
+// Find the index of the inode with the given filename, or -1 if not found.
+// On a lazy mount the table is loaded only as far as the scan gets.
 static int find_inode(const char* filename) {
+    if (name_index_ready) {
+        int pos = name_lower_bound(filename);
+        if (pos < name_count && strncmp(inode_table[name_index[pos]].name, filename, MAX_FILENAME) == 0) {
+            return name_index[pos];
+        }
+        return -1;
+    }
     for (int i = 0; i < MAX_FILES; i++) {
+        if (i % INODE_CHUNK == 0 && load_inode_chunk(i / INODE_CHUNK) != 0) return -1;
         if (inode_table[i].used && strncmp(inode_table[i].name, filename, MAX_FILENAME) == 0) {
             return i;
         }
@@ -25,328 +321,3038 @@ static int find_inode(const char* filename) {
     return -1;
 }
 
-// Find the index of a free inode, or -1 if none are free
-static int find_free_inode() {
-    for (int i = 0; i < MAX_FILES; i++) {
+// Pop a free inode index off the free stack, or -1 if none are free.
+// After a lazy mount the stack is built on first use.
+static int alloc_inode() {
+    if (!free_inodes_ready) {
+        if (load_all_inodes() != 0) return -1;
+        rebuild_free_inodes();
+    }
+    if (free_inode_top == 0) return -1;
+    return free_inode_stack[--free_inode_top];
+}
+
+// Push a released inode index back onto the free stack (if it is built yet)
+static void release_inode(int inode_num) {
+    if (!free_inodes_ready) return;
+    free_inode_stack[free_inode_top++] = inode_num;
+}
+
+// Rebuild the free inode stack from the in-memory inode table
+static void rebuild_free_inodes() {
+    free_inode_top = 0;
+    for (int i = MAX_FILES - 1; i >= 0; i--) {
         if (!inode_table[i].used) {
-            return i;
+            free_inode_stack[free_inode_top++] = i;
         }
     }
-    return -1;
+    free_inodes_ready = 1;
 }
 
-// Find the index of a free data block (blocks 10+), or -1 if none are free
-static int find_free_block() {
-    for (int i = 10; i < MAX_BLOCKS; i++) {
-        int byte = i / 8;
-        int bit = i % 8;
-        if (!(block_bitmap[byte] & (1 << bit))) {
-            return i;
+// Make sure a chunk of the inode table is in memory. Returns 0 or -1.
+static int load_inode_chunk(int chunk) {
+    if (__atomic_load_n(&inode_chunk_ready[chunk], __ATOMIC_ACQUIRE)) return 0;
+    int rc = 0;
+    pthread_mutex_lock(&inode_load_lock);
+    if (!inode_chunk_ready[chunk]) {
+        // Read the one or two table blocks the chunk spans
+        size_t start = (size_t)chunk * INODE_CHUNK * sizeof(inode);
+        int inodes = (chunk == INODE_CHUNKS - 1) ? MAX_FILES - chunk * INODE_CHUNK : INODE_CHUNK;
+        size_t len = (size_t)inodes * sizeof(inode);
+        int first = start / BLOCK_SIZE;
+        int last = (start + len - 1) / BLOCK_SIZE;
+        ssize_t want = (ssize_t)(last - first + 1) * BLOCK_SIZE;
+        if (pread(disk_fd, inode_io, want, (off_t)(INODE_TABLE_START + first) * BLOCK_SIZE) == want) {
+            memcpy((char*)inode_table + start, (char*)inode_io + (start - (size_t)first * BLOCK_SIZE), len);
+            STAT_ADD(inode_chunks_loaded, 1);
+            __atomic_store_n(&inode_chunk_ready[chunk], 1, __ATOMIC_RELEASE);
+        } else {
+            rc = -1;
         }
     }
-    return -1;
+    pthread_mutex_unlock(&inode_load_lock);
+    return rc;
 }
 
-// Mark a block as used in the bitmap
-static void mark_block_used(int block_num) {
-    int byte = block_num / 8;
-    int bit = block_num % 8;
-    block_bitmap[byte] |= (1 << bit);
+// Index of the first name in the name index that is not less than name
+static int name_lower_bound(const char* name) {
+    int lo = 0, hi = name_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (strncmp(inode_table[name_index[mid]].name, name, MAX_FILENAME) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
 }
 
-// Mark a block as free in the bitmap
-static void mark_block_free(int block_num) {
-    int byte = block_num / 8;
-    int bit = block_num % 8;
-    block_bitmap[byte] &= ~(1 << bit);
+static int compare_inode_names(const void* a, const void* b) {
+    return strncmp(inode_table[*(const short*)a].name, inode_table[*(const short*)b].name, MAX_FILENAME);
 }
 
-
-
-int fs_format(const char* disk_path) {
-    // Open or create the disk file
-    int fd = open(disk_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
-    if (fd < 0) return -1;
-
-    // Initialize superblock
-    sb.total_blocks = MAX_BLOCKS;
-    sb.block_size = BLOCK_SIZE;
-    sb.free_blocks = MAX_BLOCKS - 10; // 10 metadata blocks used
-    sb.total_inodes = MAX_FILES;
-    sb.free_inodes = MAX_FILES;
-
-    // Initialize block bitmap: set all to 0, then mark blocks 0-9 as used
-    for (int i = 0; i < BLOCK_SIZE; i++) block_bitmap[i] = 0;
-    for (int i = 0; i < 10; i++) mark_block_used(i);
-
-    // Initialize inode table: mark all as unused and clear fields
+// Rebuild the name index from the (fully loaded) inode table
+static void rebuild_name_index() {
+    name_count = 0;
     for (int i = 0; i < MAX_FILES; i++) {
-        inode_table[i].used = 0;
-        for (int j = 0; j < MAX_FILENAME; j++) inode_table[i].name[j] = 0;
-        inode_table[i].size = 0;
-        for (int j = 0; j < MAX_DIRECT_BLOCKS; j++) inode_table[i].blocks[j] = 0;
+        if (inode_table[i].used) name_index[name_count++] = i;
     }
+    qsort(name_index, name_count, sizeof(name_index[0]), compare_inode_names);
+    name_index_ready = 1;
+}
 
-    // Write superblock to block 0
-    lseek(fd, 0, SEEK_SET);
-    write(fd, &sb, sizeof(sb));
-    // Pad the rest of block 0
-    char zero_buf[BLOCK_SIZE] = {0};
-    write(fd, zero_buf, BLOCK_SIZE - sizeof(sb));
-
-    // Write block bitmap to block 1
-    lseek(fd, BLOCK_SIZE * 1, SEEK_SET);
-    write(fd, block_bitmap, BLOCK_SIZE);
+// Add a newly named inode to the name index (if it is built yet)
+static void name_index_insert(int inode_num) {
+    if (!name_index_ready) return;
+    int pos = name_lower_bound(inode_table[inode_num].name);
+    memmove(&name_index[pos + 1], &name_index[pos], (name_count - pos) * sizeof(name_index[0]));
+    name_index[pos] = inode_num;
+    name_count++;
+}
 
-    // Write inode table to blocks 2-9
-    lseek(fd, BLOCK_SIZE * 2, SEEK_SET);
-    write(fd, inode_table, sizeof(inode_table));
+// Remove an inode from the name index (if it is built yet); call while the
+// inode still has its name
+static void name_index_remove(int inode_num) {
+    if (!name_index_ready) return;
+    int pos = name_lower_bound(inode_table[inode_num].name);
+    if (pos == name_count || name_index[pos] != inode_num) return;
+    memmove(&name_index[pos], &name_index[pos + 1], (name_count - pos - 1) * sizeof(name_index[0]));
+    name_count--;
+}
 
-    // Fill the rest of the disk file with zeros (data blocks)
-    lseek(fd, BLOCK_SIZE * 10, SEEK_SET);
-    for (int i = 0; i < (MAX_BLOCKS - 10); i++) {
-        write(fd, zero_buf, BLOCK_SIZE);
+// Make sure the whole inode table, and with it the name index, is in
+// memory. Returns 0 or -1.
+static int load_all_inodes() {
+    for (int c = 0; c < INODE_CHUNKS; c++) {
+        if (load_inode_chunk(c) != 0) return -1;
     }
-
-    close(fd);
+    if (!name_index_ready) rebuild_name_index();
     return 0;
 }
 
-int fs_mount(const char* disk_path) {
-    if (disk_fd != -1) return -1; // Already mounted
-    disk_fd = open(disk_path, O_RDWR);
-    if (disk_fd < 0) return -1;
-
-    // Read superblock
-    lseek(disk_fd, 0, SEEK_SET);
-    if (read(disk_fd, &sb, sizeof(sb)) != sizeof(sb)) {
-        close(disk_fd); disk_fd = -1; return -1;
+// Prefetch thread for lazy mounts: load every chunk not touched yet
+static void* inode_prefetch(void* arg) {
+    (void)arg;
+    for (int c = 0; c < INODE_CHUNKS && !__atomic_load_n(&inode_prefetch_stop, __ATOMIC_ACQUIRE); c++) {
+        load_inode_chunk(c);
     }
+    return NULL;
+}
 
-    // Validate superblock fields
-    if (sb.total_blocks != MAX_BLOCKS || sb.block_size != BLOCK_SIZE ||
-        sb.total_inodes != MAX_FILES) {
-        close(disk_fd); disk_fd = -1; return -1;
+// Find the index of a free data block in a group, or -1 if none are free.
+// Called with the group's lock held.
+static int find_free_block(int group) {
+    block_group* g = &groups[group];
+    int end = (group + 1) * BLOCKS_PER_GROUP;
+    for (int i = g->first_free; i < end; i++) {
+        if (block_refs[i] == 0) {
+            g->first_free = i;
+            return i;
+        }
     }
+    g->first_free = end;
+    return -1;
+}
 
-    // Read block bitmap
-    lseek(disk_fd, BLOCK_SIZE * 1, SEEK_SET);
-    if (read(disk_fd, block_bitmap, BLOCK_SIZE) != BLOCK_SIZE) {
-        close(disk_fd); disk_fd = -1; return -1;
+// Recount every group's free blocks from the reference counts
+static void rebuild_groups() {
+    for (int g = 0; g < BLOCK_GROUPS; g++) {
+        groups[g].free_blocks = 0;
+        groups[g].first_free = (g == 0) ? FIRST_DATA_BLOCK : g * BLOCKS_PER_GROUP;
     }
-
-    // Read inode table
-    lseek(disk_fd, BLOCK_SIZE * 2, SEEK_SET);
-    if (read(disk_fd, inode_table, sizeof(inode_table)) != sizeof(inode_table)) {
-        close(disk_fd); disk_fd = -1; return -1;
+    for (int i = FIRST_DATA_BLOCK; i < MAX_BLOCKS; i++) {
+        if (block_refs[i] == 0) groups[i / BLOCKS_PER_GROUP].free_blocks++;
     }
-
-    return 0;
 }
 
-void fs_unmount() {
-    if (disk_fd == -1) return; // Not mounted
-
-    // Write superblock back to disk
-    lseek(disk_fd, 0, SEEK_SET);
-    write(disk_fd, &sb, sizeof(sb));
+// Set aside count free blocks for an allocation, so that the alloc_block
+// calls that follow can't fail. When too few are free the blocks parked in
+// the allocation caches are given back first. Returns 0, or -1 if fewer
+// are free.
+static int reserve_blocks(int count) {
+    for (int pass = 0; pass < 2; pass++) {
+        int free_now = __atomic_load_n(&sb.free_blocks, __ATOMIC_RELAXED);
+        while (free_now >= count) {
+            if (__atomic_compare_exchange_n(&sb.free_blocks, &free_now, free_now - count, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                return 0;
+            }
+        }
+        if (pass == 1 || __atomic_load_n(&cached_blocks, __ATOMIC_RELAXED) == 0) break;
+        drain_all_caches();
+    }
+    return -1;
+}
 
-    // Write block bitmap back to disk
-    lseek(disk_fd, BLOCK_SIZE * 1, SEEK_SET);
-    write(disk_fd, block_bitmap, BLOCK_SIZE);
+// Reserve as many of count blocks as are free, without failing. Returns how
+// many were reserved.
+static int reserve_some_blocks(int count) {
+    int free_now = __atomic_load_n(&sb.free_blocks, __ATOMIC_RELAXED);
+    int got;
+    do {
+        got = (free_now < count) ? free_now : count;
+        if (got <= 0) return 0;
+    } while (!__atomic_compare_exchange_n(&sb.free_blocks, &free_now, free_now - got, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return got;
+}
 
-    // Write inode table back to disk
-    lseek(disk_fd, BLOCK_SIZE * 2, SEEK_SET);
-    write(disk_fd, inode_table, sizeof(inode_table));
+// Give back reservations that were not used
+static void unreserve_blocks(int count) {
+    if (count > 0) __atomic_fetch_add(&sb.free_blocks, count, __ATOMIC_RELAXED);
+}
 
-    // Close the disk file and reset state
-    close(disk_fd);
-    disk_fd = -1;
+// Take up to max free blocks of a group, giving each a single reference.
+// Returns how many were taken.
+static int take_blocks(int group, int* block_nums, int max) {
+    if (__atomic_load_n(&groups[group].free_blocks, __ATOMIC_RELAXED) == 0) return 0;
+    int taken = 0;
+    pthread_mutex_lock(&groups[group].lock);
+    while (taken < max) {
+        int block_num = find_free_block(group);
+        if (block_num == -1) break;
+        block_refs[block_num] = 1;
+        block_nums[taken++] = block_num;
+        // Under the group lock, so a queued punch can never hit it once reused
+        discard_cancel(block_num);
+    }
+    __atomic_fetch_sub(&groups[group].free_blocks, taken, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&groups[group].lock);
+    return taken;
 }
 
+// Give blocks taken by take_blocks() back to their group unused
+static void return_blocks(int group, const int* block_nums, int count) {
+    if (count == 0) return;
+    block_group* g = &groups[group];
+    pthread_mutex_lock(&g->lock);
+    for (int i = 0; i < count; i++) {
+        block_refs[block_nums[i]] = 0;
+        if (block_nums[i] < g->first_free) g->first_free = block_nums[i];
+        discard_queue(block_nums[i]);
+    }
+    __atomic_fetch_add(&g->free_blocks, count, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&g->lock);
+}
 
-int fs_create(const char* filename) {
-    // Per fs.h, -3 is for "other errors" like the FS not being mounted.
-    if (disk_fd == -1) return -3; 
+// Empty an allocation cache back into the groups
+static void drain_cache(alloc_cache* cache) {
+    int blocks[BLOCK_GROUPS][ALLOC_CACHE_BLOCKS];
+    int count[BLOCK_GROUPS];
+    pthread_mutex_lock(&cache->lock);
+    memcpy(blocks, cache->blocks, sizeof(blocks));
+    memcpy(count, cache->count, sizeof(count));
+    memset(cache->count, 0, sizeof(cache->count));
+    pthread_mutex_unlock(&cache->lock);
+    for (int g = 0; g < BLOCK_GROUPS; g++) {
+        return_blocks(g, blocks[g], count[g]);
+        __atomic_fetch_sub(&cached_blocks, count[g], __ATOMIC_RELAXED);
+        unreserve_blocks(count[g]);
+    }
+}
 
-    // Check for NULL filename
-    if (!filename) return -3;
+// Empty every thread's allocation cache, before anything that needs the
+// reference counts to be exact
+static void drain_all_caches() {
+    for (int c = 0; c < ALLOC_CACHES; c++) drain_cache(&alloc_caches[c]);
+}
 
-    // A filename of MAX_FILENAME length would not fit with a null terminator.
-    if (strlen(filename) >= MAX_FILENAME) return -3; 
-    
-    // Check if filename already exists.
-    if (find_inode(filename) != -1) return -1;
+// Thread exit: give the cache's blocks back and free its slot
+static void release_cache(void* arg) {
+    alloc_cache* cache = arg;
+    pthread_rwlock_rdlock(&fs_lock);
+    drain_cache(cache);
+    pthread_rwlock_unlock(&fs_lock);
+    pthread_mutex_lock(&alloc_cache_lock);
+    cache->in_use = 0;
+    pthread_mutex_unlock(&alloc_cache_lock);
+}
 
-    // Find a free inode
-    int inode_idx = find_free_inode();
-    if (inode_idx == -1) return -2; // No free inodes available
+static void make_cache_key() {
+    pthread_key_create(&alloc_cache_key, release_cache);
+}
 
-    // Initialize the inode
-    inode* new_inode = &inode_table[inode_idx];
-    new_inode->used = 1;
-    strncpy(new_inode->name, filename, MAX_FILENAME);
-    new_inode->name[MAX_FILENAME - 1] = '\0'; // Ensure null termination
-    new_inode->size = 0;
-    for (int i = 0; i < MAX_DIRECT_BLOCKS; i++) {
-        new_inode->blocks[i] = 0; // No data blocks allocated yet
+// The calling thread's allocation cache, claimed on first use. NULL if all
+// are taken; such threads allocate from the groups directly.
+static alloc_cache* thread_cache() {
+    if (my_cache_tried) return my_cache;
+    my_cache_tried = 1;
+    pthread_once(&alloc_cache_once, make_cache_key);
+    pthread_mutex_lock(&alloc_cache_lock);
+    for (int c = 0; c < ALLOC_CACHES && !my_cache; c++) {
+        if (!alloc_caches[c].in_use) {
+            alloc_caches[c].in_use = 1;
+            my_cache = &alloc_caches[c];
+        }
     }
+    pthread_mutex_unlock(&alloc_cache_lock);
+    if (my_cache) pthread_setspecific(alloc_cache_key, my_cache);
+    return my_cache;
+}
 
-    // Update the superblock
-    sb.free_inodes--;
+// Take a reserved block with a single reference: from the thread's cache
+// for the given group, else from that group (reserving a batch more to
+// refill the cache), else the groups after it. A reserved block is always
+// free in some group, so this can't fail; the search only repeats when
+// blocks move between groups under it.
+static int alloc_block(int group) {
+    alloc_cache* cache = thread_cache();
+    for (int n = 0;; n++) {
+        int g = (group + n) % BLOCK_GROUPS;
+        if (!cache) {
+            int block_num;
+            if (take_blocks(g, &block_num, 1) == 1) return block_num;
+            continue;
+        }
+        pthread_mutex_lock(&cache->lock);
+        if (cache->count[g] > 0) {
+            // The cached block was reserved already; the caller's reservation goes back
+            int block_num = cache->blocks[g][--cache->count[g]];
+            pthread_mutex_unlock(&cache->lock);
+            __atomic_fetch_sub(&cached_blocks, 1, __ATOMIC_RELAXED);
+            unreserve_blocks(1);
+            return block_num;
+        }
+        int batch[ALLOC_CACHE_BLOCKS];
+        int extra = reserve_some_blocks(ALLOC_CACHE_BLOCKS - 1);
+        int taken = take_blocks(g, batch, 1 + extra);
+        unreserve_blocks(extra - (taken > 0 ? taken - 1 : 0));
+        if (taken > 1) {
+            // Hand out the lowest blocks first so a file's blocks stay in order
+            for (int i = 1; i < taken; i++) cache->blocks[g][taken - 1 - i] = batch[i];
+            cache->count[g] = taken - 1;
+            __atomic_fetch_add(&cached_blocks, taken - 1, __ATOMIC_RELAXED);
+            STAT_ADD(alloc_cache_refills, 1);
+        }
+        pthread_mutex_unlock(&cache->lock);
+        if (taken > 0) return batch[0];
+    }
+}
 
-    return 0; // Success
+// Add a reference to a block that already has one
+static void block_ref(int block_num) {
+    block_group* g = &groups[block_num / BLOCKS_PER_GROUP];
+    pthread_mutex_lock(&g->lock);
+    block_refs[block_num]++;
+    pthread_mutex_unlock(&g->lock);
 }
 
-int fs_delete(const char* filename) {
-    // 1. Pre-condition Checks
-    if (disk_fd == -1) return -2; // "Other errors" for not mounted
+// Drop one reference to a block, freeing it when the last one goes
+static void block_unref(int block_num) {
+    block_group* g = &groups[block_num / BLOCKS_PER_GROUP];
+    pthread_mutex_lock(&g->lock);
+    int freed = (--block_refs[block_num] == 0);
+    if (freed) {
+        __atomic_fetch_add(&g->free_blocks, 1, __ATOMIC_RELAXED);
+        if (block_num < g->first_free) g->first_free = block_num;
+        dedup_remove(block_num);
+        cache_invalidate(block_num);
+        discard_queue(block_num);
+    }
+    pthread_mutex_unlock(&g->lock);
+    if (freed) __atomic_fetch_add(&sb.free_blocks, 1, __ATOMIC_RELAXED);
+}
 
-    // Check for NULL filename
-    if (!filename) return -3;
+// Punch holes in the image for all queued blocks, one fallocate per run of
+// consecutive blocks. Host filesystems that can't punch holes turn discard
+// off. Called with discard_lock held.
+static void discard_flush() {
+    int b = FIRST_DATA_BLOCK;
+    while (discard_count > 0 && b < MAX_BLOCKS) {
+        if (!discard_pending[b]) { b++; continue; }
+        int run = 0;
+        while (b + run < MAX_BLOCKS && discard_pending[b + run]) {
+            discard_pending[b + run] = 0;
+            run++;
+        }
+        discard_count -= run;
+        if (discard_freed) {
+            if (fallocate(disk_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                          (off_t)b * BLOCK_SIZE, (off_t)run * BLOCK_SIZE) == 0) {
+                STAT_ADD(discard_calls, 1);
+                STAT_ADD(discarded_blocks, run);
+            } else if (errno == EOPNOTSUPP) {
+                discard_freed = 0;
+            }
+        }
+        b += run;
+    }
+}
 
-    // check if the filename is valid
-    if (strlen(filename) >= MAX_FILENAME) return -3; 
+// Queue a freed block for discard, flushing once a batch has built up
+static void discard_queue(int block_num) {
+    pthread_mutex_lock(&discard_lock);
+    if (discard_freed && !discard_pending[block_num]) {
+        discard_pending[block_num] = 1;
+        if (++discard_count >= DISCARD_BATCH) discard_flush();
+    }
+    pthread_mutex_unlock(&discard_lock);
+}
 
-    // Find the file's inode
-    int inode_idx = find_inode(filename);
-    if (inode_idx == -1) return -1; // File doesn't exist
+// Take a block off the discard queue because it is being reused
+static void discard_cancel(int block_num) {
+    pthread_mutex_lock(&discard_lock);
+    if (discard_pending[block_num]) {
+        discard_pending[block_num] = 0;
+        discard_count--;
+    }
+    pthread_mutex_unlock(&discard_lock);
+}
 
-    inode* target_inode = &inode_table[inode_idx];
+// Add a block (whose checksum is current) to the dedup index
+static void dedup_insert(int block_num) {
+    int bucket = crc_table[block_num] & (DEDUP_BUCKETS - 1);
+    dedup_next[block_num] = dedup_head[bucket];
+    dedup_head[bucket] = block_num;
+}
 
-    // 2. Mark all of the file's blocks as free in the bitmap
-    for (int i = 0; i < MAX_DIRECT_BLOCKS; i++) {
-        if (target_inode->blocks[i] != 0) {
-            mark_block_free(target_inode->blocks[i]);
-            sb.free_blocks++; // Update superblock
-            target_inode->blocks[i] = 0; // Clear the block pointer in the inode
+// Remove a block from the dedup index if it is there
+static void dedup_remove(int block_num) {
+    short* link = &dedup_head[crc_table[block_num] & (DEDUP_BUCKETS - 1)];
+    while (*link != -1) {
+        if (*link == block_num) {
+            *link = dedup_next[block_num];
+            return;
         }
+        link = &dedup_next[*link];
     }
+}
 
-    // 3. Mark the inode as free
-    target_inode->used = 0;
-    target_inode->name[0] = '\0'; // Clear name
-    target_inode->size = 0;
-
-    // 4. Update the superblock's free inode count
-    sb.free_inodes++;
+// Rebuild the dedup index from the reference counts; empty unless dedup is on
+static void dedup_rebuild() {
+    for (int i = 0; i < DEDUP_BUCKETS; i++) dedup_head[i] = -1;
+    if (!dedup_writes) return;
+    for (int i = FIRST_DATA_BLOCK; i < MAX_BLOCKS; i++) {
+        if (block_refs[i] > 0) dedup_insert(i);
+    }
+}
 
-    return 0; // Success
+// Find a block on disk holding exactly the given block contents that can take
+// another reference, or -1. Candidates are read through the block cache.
+static int dedup_find(const void* data, uint32_t crc) {
+    for (int b = dedup_head[crc & (DEDUP_BUCKETS - 1)]; b != -1; b = dedup_next[b]) {
+        if (crc_table[b] != crc || block_refs[b] >= BLOCK_REF_MAX) continue;
+        pthread_mutex_lock(&cache_lock);
+        int slot = cache_lookup(b);
+        if (slot == -1 && cache_fill(&b, 1, 1) == 0) slot = cache_lookup(b);
+        int same = slot != -1 && memcmp(cache_data[slot], data, BLOCK_SIZE) == 0;
+        pthread_mutex_unlock(&cache_lock);
+        if (same) return b;
+    }
+    return -1;
 }
-int fs_list(char filenames[][MAX_FILENAME], int max_files) {
-   // check if the filesystem is mounted and the parameters are valid
-    if (disk_fd == -1 || !filenames || max_files <= 0 || max_files > MAX_FILES) return -1; 
 
-    int count = 0;
-    for (int i = 0; i < MAX_FILES && count < max_files; i++) {
-        if (inode_table[i].used) {
-            strncpy(filenames[count], inode_table[i].name, MAX_FILENAME);
-            filenames[count][MAX_FILENAME - 1] = '\0'; // Ensure null termination
-            count++;
+// Match the blocks of a size-byte payload for dedup. For each block, shared[i]
+// gets an existing identical block (whose reference is taken here) and
+// same_as[i] an identical earlier block of the same payload; both are -1 for
+// a block that needs a new one. Returns the number of new blocks needed.
+static int dedup_match(const char* data, int size, int* shared, int* same_as) {
+    int count = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    unsigned char tail[BLOCK_SIZE];
+    const void* src[MAX_DIRECT_BLOCKS];
+    uint32_t crcs[MAX_DIRECT_BLOCKS];
+    int fresh = 0;
+    for (int i = 0; i < count; i++) {
+        // The last block is compared as stored: zero-padded to a full block
+        int len = (i == count - 1) ? size - i * BLOCK_SIZE : BLOCK_SIZE;
+        src[i] = data + (size_t)i * BLOCK_SIZE;
+        if (len < BLOCK_SIZE) {
+            memcpy(tail, src[i], len);
+            memset(tail + len, 0, BLOCK_SIZE - len);
+            src[i] = tail;
         }
+        crcs[i] = fs_crc32c(0, src[i], BLOCK_SIZE);
+
+        same_as[i] = -1;
+        shared[i] = dedup_find(src[i], crcs[i]);
+        if (shared[i] != -1) {
+            block_ref(shared[i]);
+            continue;
+        }
+        for (int j = 0; j < i && same_as[i] == -1; j++) {
+            if (shared[j] == -1 && same_as[j] == -1 && crcs[j] == crcs[i] &&
+                memcmp(src[j], src[i], BLOCK_SIZE) == 0) {
+                same_as[i] = j;
+            }
+        }
+        if (same_as[i] == -1) fresh++;
     }
-    return count;
+    return fresh;
 }
-int fs_write(const char* filename, const void* data, int size) {
-    // check if the filesystem is mounted and the parameters are valid
-    if (disk_fd == -1 || !filename || !data || size <= 0) return -3;
 
-    // check if the filename is valid
-    if (strlen(filename) >= MAX_FILENAME) return -3; 
+// Drop every cached block, read view and all readahead state
+static void cache_reset() {
+    for (int i = 0; i < CACHE_BLOCKS; i++) {
+        cache_slots[i].block = -1;
+        cache_slots[i].readahead = 0;
+        cache_slots[i].pins = 0;
+        cache_slots[i].last_used = 0;
+    }
+    for (int i = 0; i < MAX_VIEWS; i++) views[i].in_use = 0;
+    pinned_slots = 0;
+    cache_loading = 0;
+    for (int i = 0; i < MAX_BLOCKS; i++) cache_index[i] = -1;
+    for (int i = 0; i < MAX_FILES; i++) {
+        ra_state[i].next_offset = 0;
+        ra_state[i].window = 0;
+    }
+    cache_tick = 0;
+}
 
-    // check if the file is too large
-    if (size > MAX_FILES * BLOCK_SIZE) return -3;
+// Return the cache slot holding a block, or -1 if it is not cached. The
+// cache functions below are called with cache_lock held unless noted.
+static int cache_lookup(int block_num) {
+    int slot = cache_index[block_num];
+    if (slot != -1) cache_slots[slot].last_used = ++cache_tick;
+    return slot;
+}
 
-    // Find the inode for the file
-    int inode_idx = find_inode(filename);
-    if (inode_idx == -1) return -1; // File doesn't exist
+// Pick a slot to (re)use: an empty one if available, otherwise the least
+// recently used. Pinned slots and slots being filled are skipped.
+static int cache_victim() {
+    int victim = -1;
+    for (int i = 0; i < CACHE_BLOCKS; i++) {
+        if (cache_slots[i].pins > 0 || cache_slots[i].block == -2) continue;
+        if (cache_slots[i].block == -1) return i;
+        if (victim == -1 || cache_slots[i].last_used < cache_slots[victim].last_used) victim = i;
+    }
+    return victim;
+}
 
-    inode* target_inode = &inode_table[inode_idx];
+// Read the given (uncached) blocks into the cache and verify their checksums.
+// Runs of consecutive block numbers are coalesced into a single preadv. Blocks
+// at position first_readahead and beyond are flagged as readahead. Returns 0
+// or -1 (read error or a requested block failed verification).
+// cache_lock is dropped around each read so that reads of other files run
+// meanwhile; the slots being filled are marked -2 and not found by lookups.
+// The requested blocks belong to a file the caller has locked, so they can't
+// be freed or rewritten in the meantime, but anything else may be evicted:
+// callers needing several blocks at once recheck them with cache_fetch.
+static int cache_fill(const int* block_nums, int count, int first_readahead) {
+    int i = 0;
+    while (i < count) {
+        // Extend the run while the disk blocks stay consecutive
+        int run = 1;
+        while (i + run < count && block_nums[i + run] == block_nums[i] + run) run++;
 
-    // Calculate the number of blocks needed
-    int needed_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
-    
-    // Check if there's enough space
-    if (sb.free_blocks < needed_blocks) return -2; // "Out of space"
+        // Reserve a slot per block; a shorter run is read if the cache runs short
+        struct iovec iov[CACHE_BLOCKS];
+        int slots[CACHE_BLOCKS];
+        int reserved = 0;
+        while (reserved < run) {
+            int slot = cache_victim();
+            if (slot == -1) break;
+            if (cache_slots[slot].block >= 0) cache_index[cache_slots[slot].block] = -1;
+            cache_slots[slot].block = -2; // Reserved until the read completes
+            cache_slots[slot].readahead = 0;
+            cache_slots[slot].last_used = ++cache_tick;
+            slots[reserved] = slot;
+            iov[reserved].iov_base = cache_data[slot];
+            iov[reserved].iov_len = BLOCK_SIZE;
+            reserved++;
+        }
+        if (reserved == 0) {
+            // Every slot is pinned or being filled; the latter free up as their reads finish
+            if (cache_loading == 0) return -1;
+            pthread_cond_wait(&cache_filled, &cache_lock);
+            continue;
+        }
+        run = reserved;
+        cache_loading += run;
 
-    // Free old blocks
-    for (int i = 0; i < MAX_DIRECT_BLOCKS; i++) {
-        if (target_inode->blocks[i] != 0) {
-            mark_block_free(target_inode->blocks[i]);
-            sb.free_blocks++;
-            target_inode->blocks[i] = 0;
+        pthread_mutex_unlock(&cache_lock);
+        STAT_ADD(disk_reads, 1);
+        ssize_t n = preadv(disk_fd, iov, run, (off_t)block_nums[i] * BLOCK_SIZE);
+        int bad[CACHE_BLOCKS];
+        for (int j = 0; j < run; j++) {
+            bad[j] = (n != (ssize_t)run * BLOCK_SIZE) || verify_block(block_nums[i + j], cache_data[slots[j]]) != 0;
         }
-    }
+        pthread_mutex_lock(&cache_lock);
+        cache_loading -= run;
+        pthread_cond_broadcast(&cache_filled);
 
-    // Allocate new blocks
-    const char* data_ptr = (const char*)data;
-    for (int i = 0; i < needed_blocks; i++) {
-        int block_idx = find_free_block();
-       
-        mark_block_used(block_idx);
-        sb.free_blocks--;
-        target_inode->blocks[i] = block_idx;
-
-        lseek(disk_fd, block_idx * BLOCK_SIZE, SEEK_SET);
-        int to_write;
-        // If the last block, write the remaining data. Otherwise, write a full block.
-        if (i == needed_blocks - 1) {
-            to_write = size - i * BLOCK_SIZE;
-        } else {
-            to_write = BLOCK_SIZE;
+        int failed = 0;
+        for (int j = 0; j < run; j++) {
+            // A bad speculative block is just not cached; a bad requested block
+            // fails the fill. A block another thread cached meanwhile keeps its slot.
+            if (bad[j] || cache_index[block_nums[i + j]] != -1) {
+                cache_slots[slots[j]].block = -1;
+                if (bad[j] && i + j < first_readahead) failed = 1;
+                continue;
+            }
+            cache_slots[slots[j]].block = block_nums[i + j];
+            cache_slots[slots[j]].readahead = (i + j >= first_readahead);
+            cache_index[block_nums[i + j]] = slots[j];
+            if (i + j >= first_readahead) STAT_ADD(readahead_blocks, 1);
         }
-        write(disk_fd, data_ptr + i * BLOCK_SIZE, to_write);
+        if (failed) return -1;
+        i += run;
+    }
+    return 0;
+}
 
-        // Zero the rest of the block if it's not a full block
-        if (to_write < BLOCK_SIZE) {
-            // Zero the rest of the block
-            char zero_buf[BLOCK_SIZE] = {0};
-            write(disk_fd, zero_buf, BLOCK_SIZE - to_write);
+// Make sure all the given blocks are cached at the same time, refilling any
+// that other threads evicted while cache_fill had cache_lock dropped.
+// Returns 0 or -1 (read error).
+static int cache_fetch(const int* block_nums, int count) {
+    for (;;) {
+        int missing[MAX_DIRECT_BLOCKS];
+        int missing_count = 0;
+        for (int i = 0; i < count; i++) {
+            if (cache_lookup(block_nums[i]) == -1) missing[missing_count++] = block_nums[i];
         }
+        if (missing_count == 0) return 0;
+        if (cache_fill(missing, missing_count, missing_count) != 0) return -1;
     }
-    // Zero out unused block pointers
-    for (int i = needed_blocks; i < MAX_DIRECT_BLOCKS; i++) target_inode->blocks[i] = 0;
-    // update the inode's size
-    target_inode->size = size;
-    return 0; // Success
 }
-int fs_read(const char* filename, void* data, int size) {
-    // check if the filesystem is mounted and the parameters are valid
-    if (disk_fd == -1 || !filename || !data || size <= 0) return -3;
 
-    // check if the filename is valid
-    if (strlen(filename) >= MAX_FILENAME) return -3;
+// Forget a cached block (called when the block is freed). A pinned slot keeps
+// its contents for the views referencing it and is recycled once unpinned.
+static void cache_invalidate(int block_num) {
+    pthread_mutex_lock(&cache_lock);
+    int slot = cache_index[block_num];
+    if (slot != -1) {
+        cache_slots[slot].block = -1;
+        cache_slots[slot].readahead = 0;
+        cache_index[block_num] = -1;
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
 
-    // Find the inode for the file
-    int inode_idx = find_inode(filename);
-    if (inode_idx == -1) return -1; // File doesn't exist
 
-    inode* target_inode = &inode_table[inode_idx];
-    // Determine the number of bytes to read (min of size and file size)
-    int bytes_to_read;
-    if (size > target_inode->size) {
-        bytes_to_read = target_inode->size;
-    } else {
-        bytes_to_read = size;
-    }
 
-    // count the number of bytes read
-    int bytes_read = 0;
-    char* data_ptr = (char*)data;
-    for (int i = 0; i < MAX_DIRECT_BLOCKS && bytes_read < bytes_to_read; i++) {
-        int block_idx = target_inode->blocks[i];
-        if (block_idx == 0) break; // No more blocks to
+// ---- Compression ----
+// A byte-oriented LZ77 codec modelled on the LZ4 block format: each sequence is a
+// token (literal length, match length), literals, a 2-byte offset and
+// optional length extension bytes. Greedy matching through a hash table.
 
-        lseek(disk_fd, block_idx * BLOCK_SIZE, SEEK_SET);
-        int chunk;
-        if (bytes_to_read - bytes_read < BLOCK_SIZE) {
-            chunk = bytes_to_read - bytes_read;
+static inline uint32_t load32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline int lz_hash(uint32_t v) {
+    return (int)((v * 2654435761u) >> (32 - LZ_HASH_BITS));
+}
+
+// Emit a length extension (the part of a length beyond the 4-bit token field)
+static int lz_put_length(unsigned char* dst, int op, int cap, int len) {
+    while (len >= 255) {
+        if (op >= cap) return -1;
+        dst[op++] = 255;
+        len -= 255;
+    }
+    if (op >= cap) return -1;
+    dst[op++] = (unsigned char)len;
+    return op;
+}
+
+// Compress n bytes into dst. Returns the compressed length, or -1 if it
+// would not fit in cap bytes.
+static int lz_compress(const unsigned char* src, int n, unsigned char* dst, int cap) {
+    int table[1 << LZ_HASH_BITS];
+    for (int i = 0; i < (1 << LZ_HASH_BITS); i++) table[i] = -1;
+
+    int ip = 0, anchor = 0, op = 0;
+    int limit = n - LZ_MATCH_LIMIT;
+    while (ip < limit) {
+        uint32_t seq = load32(src + ip);
+        int h = lz_hash(seq);
+        int ref = table[h];
+        table[h] = ip;
+        if (ref < 0 || ip - ref > LZ_MAX_OFFSET || load32(src + ref) != seq) {
+            ip++;
+            continue;
+        }
+
+        int match = LZ_MIN_MATCH;
+        while (ip + match < n - LZ_LAST_LITERALS && src[ref + match] == src[ip + match]) match++;
+
+        // token | literal length ext | literals | offset | match length ext
+        int lit = ip - anchor;
+        if (op >= cap) return -1;
+        int token = op++;
+        dst[token] = (unsigned char)(((lit < 15 ? lit : 15) << 4) |
+                                     (match - LZ_MIN_MATCH < 15 ? match - LZ_MIN_MATCH : 15));
+        if (lit >= 15 && (op = lz_put_length(dst, op, cap, lit - 15)) < 0) return -1;
+        if (op + lit + 2 > cap) return -1;
+        memcpy(dst + op, src + anchor, lit);
+        op += lit;
+        dst[op++] = (unsigned char)((ip - ref) & 0xff);
+        dst[op++] = (unsigned char)((ip - ref) >> 8);
+        if (match - LZ_MIN_MATCH >= 15 &&
+            (op = lz_put_length(dst, op, cap, match - LZ_MIN_MATCH - 15)) < 0) return -1;
+
+        ip += match;
+        anchor = ip;
+    }
+
+    // Final sequence: literals only
+    int lit = n - anchor;
+    if (op >= cap) return -1;
+    dst[op++] = (unsigned char)((lit < 15 ? lit : 15) << 4);
+    if (lit >= 15 && (op = lz_put_length(dst, op, cap, lit - 15)) < 0) return -1;
+    if (op + lit > cap) return -1;
+    memcpy(dst + op, src + anchor, lit);
+    return op + lit;
+}
+
+// Decompress n bytes from src into dst, stopping once cap bytes have been
+// produced. Returns the number of bytes produced, or -1 on malformed input.
+static int lz_decompress(const unsigned char* src, int n, unsigned char* dst, int cap) {
+    int ip = 0, op = 0;
+    while (ip < n && op < cap) {
+        int token = src[ip++];
+
+        int lit = token >> 4;
+        if (lit == 15) {
+            int b;
+            do {
+                if (ip >= n) return -1;
+                b = src[ip++];
+                lit += b;
+            } while (b == 255);
+        }
+        if (ip + lit > n) return -1;
+        int copy = (lit < cap - op) ? lit : cap - op;
+        memcpy(dst + op, src + ip, copy);
+        op += copy;
+        ip += lit;
+        if (ip >= n || op >= cap) break; // last sequence, or output full
+
+        if (ip + 2 > n) return -1;
+        int offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) return -1;
+
+        int match = token & 15;
+        if (match == 15) {
+            int b;
+            do {
+                if (ip >= n) return -1;
+                b = src[ip++];
+                match += b;
+            } while (b == 255);
+        }
+        match += LZ_MIN_MATCH;
+
+        // Copy in pieces no longer than the offset so source and destination never overlap
+        while (match > 0 && op < cap) {
+            int piece = match;
+            if (piece > offset) piece = offset;
+            if (piece > cap - op) piece = cap - op;
+            memcpy(dst + op, dst + op - offset, piece);
+            op += piece;
+            match -= piece;
+        }
+    }
+    return op;
+}
+
+// ---- CRC32C ----
+// Hardware CRC32 instructions are used when available. Three independent
+// streams are interleaved to hide the instruction latency and recombined with
+// a precomputed "shift by CRC32C_SHORT zero bytes" operator.
+
+static uint32_t crc32c_sw_table[8][256];      // slicing-by-8 tables
+static uint32_t crc32c_short_shift[4][256];   // crc -> crc of crc followed by CRC32C_SHORT zeros
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+static int crc32c_use_hw = 0;
+
+// Multiply a GF(2) 32x32 matrix by a vector
+static uint32_t gf2_matrix_times(const uint32_t* mat, uint32_t vec) {
+    uint32_t sum = 0;
+    while (vec) {
+        if (vec & 1) sum ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+// Square a GF(2) 32x32 matrix
+static void gf2_matrix_square(uint32_t* square, const uint32_t* mat) {
+    for (int n = 0; n < 32; n++) square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+// Build the tables that apply 'len' zero bytes to a raw CRC state
+static void crc32c_zeros(uint32_t zeros[][256], size_t len) {
+    uint32_t even[32], odd[32];
+    odd[0] = CRC32C_POLY; // operator for one zero bit
+    uint32_t row = 1;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+    gf2_matrix_square(even, odd); // two zero bits
+    gf2_matrix_square(odd, even); // four zero bits
+
+    // Square up to the byte count, keeping the result in 'even' or 'odd'
+    uint32_t* op = odd;
+    do {
+        gf2_matrix_square(even, odd);
+        op = even;
+        len >>= 1;
+        if (len == 0) break;
+        gf2_matrix_square(odd, even);
+        op = odd;
+        len >>= 1;
+    } while (len);
+
+    for (uint32_t n = 0; n < 256; n++) {
+        zeros[0][n] = gf2_matrix_times(op, n);
+        zeros[1][n] = gf2_matrix_times(op, n << 8);
+        zeros[2][n] = gf2_matrix_times(op, n << 16);
+        zeros[3][n] = gf2_matrix_times(op, n << 24);
+    }
+}
+
+static inline uint32_t crc32c_shift(uint32_t zeros[][256], uint32_t crc) {
+    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
+           zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+static inline uint64_t load64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Table-driven fallback, eight bytes at a time
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char* next, size_t len) {
+    uint32_t (*t)[256] = crc32c_sw_table;
+    crc = ~crc;
+    while (len && ((uintptr_t)next & 7)) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *next++) & 0xff];
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t w = load64(next) ^ crc;
+        crc = t[7][w & 0xff] ^ t[6][(w >> 8) & 0xff] ^ t[5][(w >> 16) & 0xff] ^
+              t[4][(w >> 24) & 0xff] ^ t[3][(w >> 32) & 0xff] ^ t[2][(w >> 40) & 0xff] ^
+              t[1][(w >> 48) & 0xff] ^ t[0][w >> 56];
+        next += 8;
+        len -= 8;
+    }
+    while (len--) crc = (crc >> 8) ^ t[0][(crc ^ *next++) & 0xff];
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+#define CRC32C_HW 1
+#define CRC32C_HW_TARGET __attribute__((target("sse4.2")))
+#define crc32c_hw_u8(crc, v) _mm_crc32_u8((uint32_t)(crc), (v))
+#define crc32c_hw_u64(crc, v) _mm_crc32_u64((crc), (v))
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CRC32C_HW 1
+#define CRC32C_HW_TARGET
+#define crc32c_hw_u8(crc, v) __crc32cb((uint32_t)(crc), (v))
+#define crc32c_hw_u64(crc, v) __crc32cd((uint32_t)(crc), (v))
+#endif
+
+#ifdef CRC32C_HW
+// SSE4.2 / ARMv8 CRC32 instructions, three interleaved streams
+CRC32C_HW_TARGET
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char* next, size_t len) {
+    uint64_t crc0 = ~crc;
+    while (len && ((uintptr_t)next & 7)) {
+        crc0 = crc32c_hw_u8(crc0, *next++);
+        len--;
+    }
+    while (len >= 3 * CRC32C_SHORT) {
+        uint64_t crc1 = 0, crc2 = 0;
+        const unsigned char* end = next + CRC32C_SHORT;
+        do {
+            crc0 = crc32c_hw_u64(crc0, load64(next));
+            crc1 = crc32c_hw_u64(crc1, load64(next + CRC32C_SHORT));
+            crc2 = crc32c_hw_u64(crc2, load64(next + 2 * CRC32C_SHORT));
+            next += 8;
+        } while (next < end);
+        crc0 = crc32c_shift(crc32c_short_shift, (uint32_t)crc0) ^ crc1;
+        crc0 = crc32c_shift(crc32c_short_shift, (uint32_t)crc0) ^ crc2;
+        next += 2 * CRC32C_SHORT;
+        len -= 3 * CRC32C_SHORT;
+    }
+    while (len >= 8) {
+        crc0 = crc32c_hw_u64(crc0, load64(next));
+        next += 8;
+        len -= 8;
+    }
+    while (len--) crc0 = crc32c_hw_u8(crc0, *next++);
+    return ~(uint32_t)crc0;
+}
+#endif
+
+// Build the lookup tables and pick the implementation. Run once, through
+// crc32c_once, since the first checksums may be taken by several threads.
+static void crc32c_init() {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++) crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc32c_sw_table[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = crc32c_sw_table[0][n];
+        for (int k = 1; k < 8; k++) {
+            crc = (crc >> 8) ^ crc32c_sw_table[0][crc & 0xff];
+            crc32c_sw_table[k][n] = crc;
+        }
+    }
+    crc32c_zeros(crc32c_short_shift, CRC32C_SHORT);
+#if defined(__x86_64__)
+    crc32c_use_hw = __builtin_cpu_supports("sse4.2");
+#elif defined(CRC32C_HW)
+    crc32c_use_hw = 1;
+#endif
+}
+
+unsigned int fs_crc32c(unsigned int crc, const void* data, size_t len) {
+    pthread_once(&crc32c_once, crc32c_init);
+#ifdef CRC32C_HW
+    if (crc32c_use_hw) return crc32c_hw(crc, (const unsigned char*)data, len);
+#endif
+    return crc32c_sw(crc, (const unsigned char*)data, len);
+}
+
+// Check a block read from disk against its recorded checksum. Returns 0 if it
+// matches (or verification is off), -1 on mismatch.
+static int verify_block(int block_num, const void* data) {
+    if (!verify_reads) return 0;
+    if (fs_crc32c(0, data, BLOCK_SIZE) == crc_table[block_num]) return 0;
+    STAT_ADD(checksum_errors, 1);
+    return -1;
+}
+
+// Number of data blocks an inode's stored contents occupy
+static int inode_blocks(const inode* node) {
+    return (node->stored_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+// Return 1 if a buffer can be handed to disk_fd as-is for a full-block transfer
+static int is_block_aligned(const void* p) {
+    return ((uintptr_t)p % BLOCK_SIZE) == 0;
+}
+
+// Read a metadata region of len bytes starting at first_block into buf,
+// staging through the I/O pool. Returns 0 or -1.
+static int read_region(int first_block, void* buf, int len) {
+    int blocks = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    ssize_t n = pread(disk_fd, io_pool, (size_t)blocks * BLOCK_SIZE, (off_t)first_block * BLOCK_SIZE);
+    if (n != (ssize_t)blocks * BLOCK_SIZE) return -1;
+    memcpy(buf, io_pool, len);
+    return 0;
+}
+
+// Write len bytes of metadata starting at first_block, zero-padding the last
+// block, staging through the I/O pool. Returns 0 or -1.
+static int write_region(int first_block, const void* buf, int len) {
+    int blocks = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    memcpy(io_pool, buf, len);
+    memset((char*)io_pool + len, 0, (size_t)blocks * BLOCK_SIZE - len);
+    ssize_t n = pwrite(disk_fd, io_pool, (size_t)blocks * BLOCK_SIZE, (off_t)first_block * BLOCK_SIZE);
+    return (n == (ssize_t)blocks * BLOCK_SIZE) ? 0 : -1;
+}
+
+// Write size bytes of file data into the given blocks, zero-padding the last
+// one, and record each block's checksum. Full blocks go straight from the caller's buffer unless O_DIRECT needs
+// an aligned copy; runs of consecutive blocks become one pwritev. Blocks
+// flagged in skip (may be NULL) already hold their data. Returns 0 or -1.
+static int write_blocks(const int* block_nums, const char* data, int size, const char* skip) {
+    int count = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int i = 0;
+    while (i < count) {
+        if (skip && skip[i]) { i++; continue; }
+        int run = 1;
+        while (i + run < count && block_nums[i + run] == block_nums[i] + run &&
+               !(skip && skip[i + run])) run++;
+
+        struct iovec iov[IO_POOL_BLOCKS];
+        for (int j = 0; j < run; j++) {
+            int b = i + j;
+            const char* src = data + (size_t)b * BLOCK_SIZE;
+            int len = (b == count - 1) ? size - b * BLOCK_SIZE : BLOCK_SIZE;
+            if (len == BLOCK_SIZE && (!direct_io || is_block_aligned(src))) {
+                iov[j].iov_base = (void*)src;
+            } else {
+                memcpy(io_pool[j], src, len);
+                memset(io_pool[j] + len, 0, BLOCK_SIZE - len);
+                iov[j].iov_base = io_pool[j];
+            }
+            iov[j].iov_len = BLOCK_SIZE;
+            crc_table[block_nums[b]] = fs_crc32c(0, iov[j].iov_base, BLOCK_SIZE);
+        }
+
+        ssize_t n = pwritev(disk_fd, iov, run, (off_t)block_nums[i] * BLOCK_SIZE);
+        if (n != (ssize_t)run * BLOCK_SIZE) return -1;
+        i += run;
+    }
+    return 0;
+}
+
+static int format_disk(const char* disk_path) {
+    // Open or create the disk file
+    int fd = open(disk_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+
+    // Initialize superblock
+    sb.total_blocks = MAX_BLOCKS;
+    sb.block_size = BLOCK_SIZE;
+    sb.free_blocks = MAX_BLOCKS - FIRST_DATA_BLOCK; // metadata blocks are used
+    sb.total_inodes = MAX_FILES;
+    sb.free_inodes = MAX_FILES;
+    sb.version = FS_LAYOUT_VERSION;
+    sb.direct_blocks = MAX_DIRECT_BLOCKS;
+
+    // Initialize reference counts: all blocks free except the metadata blocks
+    for (int i = 0; i < BLOCK_SIZE; i++) block_refs[i] = 0;
+    for (int i = 0; i < FIRST_DATA_BLOCK; i++) block_refs[i] = 1;
+
+    // No data block has been written yet
+    memset(crc_table, 0, sizeof(crc_table));
+
+    // Initialize inode table: mark all as unused and clear fields
+    for (int i = 0; i < MAX_FILES; i++) {
+        inode_table[i].used = 0;
+        for (int j = 0; j < MAX_FILENAME; j++) inode_table[i].name[j] = 0;
+        inode_table[i].size = 0;
+        for (int j = 0; j < MAX_DIRECT_BLOCKS; j++) inode_table[i].blocks[j] = 0;
+        inode_table[i].flags = 0;
+        inode_table[i].stored_size = 0;
+        inode_table[i].mod_count = 0;
+    }
+    rebuild_free_inodes();
+
+    // Write superblock to block 0
+    lseek(fd, 0, SEEK_SET);
+    write(fd, &sb, sizeof(sb));
+    // Pad the rest of block 0
+    char zero_buf[BLOCK_SIZE] = {0};
+    write(fd, zero_buf, BLOCK_SIZE - sizeof(sb));
+
+    // Write reference counts to block 1
+    lseek(fd, BLOCK_SIZE * 1, SEEK_SET);
+    write(fd, block_refs, BLOCK_SIZE);
+
+    // Write inode table to blocks 2-9
+    lseek(fd, BLOCK_SIZE * INODE_TABLE_START, SEEK_SET);
+    write(fd, inode_table, sizeof(inode_table));
+
+    // Write checksum table to blocks 10-12
+    lseek(fd, BLOCK_SIZE * CRC_TABLE_START, SEEK_SET);
+    write(fd, crc_table, sizeof(crc_table));
+
+    // Extend the disk file to its full size; the data blocks are left as a
+    // hole that reads back as zeros and takes no space on the host
+    if (ftruncate(fd, (off_t)MAX_BLOCKS * BLOCK_SIZE) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    return 0;
+}
+
+static int do_fs_format(const char* disk_path) {
+    pthread_rwlock_wrlock(&fs_lock);
+    int result = format_disk(disk_path);
+    pthread_rwlock_unlock(&fs_lock);
+    return result;
+}
+
+int fs_format(const char* disk_path) {
+    trace_from_env();
+    uint64_t start = trace_begin();
+    int result = do_fs_format(disk_path);
+    trace_end(start, FS_OP_FORMAT, disk_path, NULL, 0, 0, result);
+    return result;
+}
+
+int fs_mount(const char* disk_path) {
+    return fs_mount_opts(disk_path, 0);
+}
+
+static int mount_disk(const char* disk_path, int options) {
+    if (disk_fd != -1) return -1; // Already mounted
+
+    // Open the image, bypassing the host page cache if requested. Filesystems
+    // without O_DIRECT support (e.g. tmpfs) reject it with EINVAL; fall back
+    // to buffered I/O there.
+    direct_io = 0;
+    if (options & FS_MOUNT_DIRECT) {
+        disk_fd = open(disk_path, O_RDWR | O_DIRECT);
+        if (disk_fd >= 0) direct_io = 1;
+        else if (errno != EINVAL) return -1;
+    }
+    if (disk_fd < 0) disk_fd = open(disk_path, O_RDWR);
+    if (disk_fd < 0) return -1;
+
+    // Read superblock
+    if (read_region(0, &sb, sizeof(sb)) != 0) {
+        close(disk_fd); disk_fd = -1; return -1;
+    }
+
+    // Validate superblock fields
+    if (sb.total_blocks != MAX_BLOCKS || sb.block_size != BLOCK_SIZE ||
+        sb.total_inodes != MAX_FILES || sb.version != FS_LAYOUT_VERSION ||
+        sb.direct_blocks != MAX_DIRECT_BLOCKS) {
+        close(disk_fd); disk_fd = -1; return -1;
+    }
+
+    // Read reference counts
+    if (read_region(1, block_refs, BLOCK_SIZE) != 0) {
+        close(disk_fd); disk_fd = -1; return -1;
+    }
+    rebuild_groups();
+    for (int c = 0; c < ALLOC_CACHES; c++) memset(alloc_caches[c].count, 0, sizeof(alloc_caches[c].count));
+    cached_blocks = 0;
+
+    // Read inode table, unless it is loaded as it is touched
+    int lazy = (options & FS_MOUNT_LAZY) != 0;
+    if (!lazy && read_region(INODE_TABLE_START, inode_table, sizeof(inode_table)) != 0) {
+        close(disk_fd); disk_fd = -1; return -1;
+    }
+    memset(inode_chunk_ready, !lazy, sizeof(inode_chunk_ready));
+
+    // Read checksum table
+    if (read_region(CRC_TABLE_START, crc_table, sizeof(crc_table)) != 0) {
+        close(disk_fd); disk_fd = -1; return -1;
+    }
+    verify_reads = !(options & FS_MOUNT_NO_VERIFY);
+    dedup_writes = (options & FS_MOUNT_DEDUP) != 0;
+    dedup_rebuild();
+    discard_freed = (options & FS_MOUNT_DISCARD) != 0;
+    memset(discard_pending, 0, sizeof(discard_pending));
+    discard_count = 0;
+    name_index_ready = 0;
+    if (lazy) {
+        free_inodes_ready = 0;
+    } else {
+        rebuild_free_inodes();
+        rebuild_name_index();
+    }
+    for (int i = 0; i < MAX_CURSORS; i++) cursors[i].in_use = 0;
+    for (int i = 0; i < MAX_WRITERS; i++) writers[i].in_use = 0;
+    cache_reset();
+    fs_reset_stats();
+
+    // Optionally load the rest of the table in the background
+    if (lazy && (options & FS_MOUNT_PREFETCH)) {
+        inode_prefetch_stop = 0;
+        inode_prefetching = pthread_create(&inode_prefetcher, NULL, inode_prefetch, NULL) == 0;
+    }
+
+    return 0;
+}
+
+static int do_fs_mount_opts(const char* disk_path, int options) {
+    pthread_rwlock_wrlock(&fs_lock);
+    int result = mount_disk(disk_path, options);
+    pthread_rwlock_unlock(&fs_lock);
+    return result;
+}
+
+int fs_mount_opts(const char* disk_path, int options) {
+    trace_from_env();
+    uint64_t start = trace_begin();
+    int result = do_fs_mount_opts(disk_path, options);
+    trace_end(start, FS_OP_MOUNT, disk_path, NULL, 0, options, result);
+    return result;
+}
+
+static void unmount_disk() {
+    if (disk_fd == -1) return; // Not mounted
+
+    // Stop the prefetch thread, and load what is still missing of a lazily
+    // loaded inode table so it can be written back whole
+    if (inode_prefetching) {
+        __atomic_store_n(&inode_prefetch_stop, 1, __ATOMIC_RELEASE);
+        pthread_join(inode_prefetcher, NULL);
+        inode_prefetching = 0;
+    }
+    int inodes_loaded = (load_all_inodes() == 0);
+
+    // Uncommitted writers and the allocation caches give their blocks back
+    for (int w = 0; w < MAX_WRITERS; w++) {
+        if (writers[w].in_use) writer_abort(&writers[w]);
+    }
+    drain_all_caches();
+
+    // Write superblock back to disk
+    write_region(0, &sb, sizeof(sb));
+
+    // Write reference counts back to disk
+    write_region(1, block_refs, BLOCK_SIZE);
+
+    // Write inode table back to disk (never a partially loaded one)
+    if (inodes_loaded) write_region(INODE_TABLE_START, inode_table, sizeof(inode_table));
+
+    // Write checksum table back to disk
+    write_region(CRC_TABLE_START, crc_table, sizeof(crc_table));
+
+    // Punch the holes still queued
+    pthread_mutex_lock(&discard_lock);
+    discard_flush();
+    pthread_mutex_unlock(&discard_lock);
+
+    // Close the disk file and reset state
+    cache_reset();
+    close(disk_fd);
+    disk_fd = -1;
+    direct_io = 0;
+    dedup_writes = 0;
+    discard_freed = 0;
+}
+
+static void do_fs_unmount() {
+    pthread_rwlock_wrlock(&fs_lock);
+    unmount_disk();
+    pthread_rwlock_unlock(&fs_lock);
+}
+
+void fs_unmount() {
+    uint64_t start = trace_begin();
+    do_fs_unmount();
+    trace_end(start, FS_OP_UNMOUNT, "", NULL, 0, 0, 0);
+}
+
+
+static int create_file(const char* filename) {
+    // Per fs.h, -3 is for "other errors" like the FS not being mounted.
+    if (disk_fd == -1) return -3; 
+
+    // Check for NULL filename
+    if (!filename) return -3;
+
+    // A filename of MAX_FILENAME length would not fit with a null terminator.
+    if (strlen(filename) >= MAX_FILENAME) return -3; 
+    
+    // Check if filename already exists.
+    if (find_inode(filename) != -1) return -1;
+
+    // Find a free inode
+    int inode_idx = alloc_inode();
+    if (inode_idx == -1) return -2; // No free inodes available
+
+    // Initialize the inode
+    inode* new_inode = &inode_table[inode_idx];
+    new_inode->used = 1;
+    strncpy(new_inode->name, filename, MAX_FILENAME);
+    new_inode->name[MAX_FILENAME - 1] = '\0'; // Ensure null termination
+    new_inode->size = 0;
+    for (int i = 0; i < MAX_DIRECT_BLOCKS; i++) {
+        new_inode->blocks[i] = 0; // No data blocks allocated yet
+    }
+    new_inode->flags = 0;
+    new_inode->stored_size = 0;
+    new_inode->mod_count = 0;
+    name_index_insert(inode_idx);
+    ra_state[inode_idx].next_offset = 0;
+    ra_state[inode_idx].window = 0;
+
+    // Update the superblock
+    sb.free_inodes--;
+
+    return 0; // Success
+}
+
+static int do_fs_create(const char* filename) {
+    pthread_rwlock_wrlock(&fs_lock);
+    int result = create_file(filename);
+    pthread_rwlock_unlock(&fs_lock);
+    return result;
+}
+
+int fs_create(const char* filename) {
+    uint64_t start = trace_begin();
+    int result = do_fs_create(filename);
+    trace_end(start, FS_OP_CREATE, filename, NULL, 0, 0, result);
+    return result;
+}
+
+// Free a file's blocks and its inode
+static void free_file(int inode_idx) {
+    inode* target_inode = &inode_table[inode_idx];
+
+    // 2. Drop the file's reference to each of its blocks
+    for (int i = 0; i < MAX_DIRECT_BLOCKS; i++) {
+        if (target_inode->blocks[i] != 0) {
+            block_unref(target_inode->blocks[i]); // Frees it unless shared
+            target_inode->blocks[i] = 0; // Clear the block pointer in the inode
+        }
+    }
+
+    // 3. Mark the inode as free
+    name_index_remove(inode_idx);
+    target_inode->used = 0;
+    target_inode->name[0] = '\0'; // Clear name
+    target_inode->size = 0;
+    target_inode->flags = 0;
+    target_inode->stored_size = 0;
+    target_inode->mod_count = 0;
+
+    // 4. Return the inode to the free stack and update the superblock's free inode count
+    release_inode(inode_idx);
+    sb.free_inodes++;
+
+    // Writers still open on the file can no longer commit
+    for (int w = 0; w < MAX_WRITERS; w++) {
+        if (writers[w].in_use && writers[w].inode == inode_idx) writers[w].inode = -1;
+    }
+}
+
+static int delete_file(const char* filename) {
+    // 1. Pre-condition Checks
+    if (disk_fd == -1) return -2; // "Other errors" for not mounted
+
+    // Check for NULL filename
+    if (!filename) return -3;
+
+    // check if the filename is valid
+    if (strlen(filename) >= MAX_FILENAME) return -3; 
+
+    // Find the file's inode
+    int inode_idx = find_inode(filename);
+    if (inode_idx == -1) return -1; // File doesn't exist
+
+    // 2-4. Free its blocks and the inode
+    free_file(inode_idx);
+
+    return 0; // Success
+}
+
+static int do_fs_delete(const char* filename) {
+    pthread_rwlock_wrlock(&fs_lock);
+    int result = delete_file(filename);
+    pthread_rwlock_unlock(&fs_lock);
+    return result;
+}
+
+int fs_delete(const char* filename) {
+    uint64_t start = trace_begin();
+    int result = do_fs_delete(filename);
+    trace_end(start, FS_OP_DELETE, filename, NULL, 0, 0, result);
+    return result;
+}
+static int list_files(char filenames[][MAX_FILENAME], int max_files) {
+   // check if the filesystem is mounted and the parameters are valid
+    if (disk_fd == -1 || !filenames || max_files <= 0 || max_files > MAX_FILES) return -1; 
+    if (load_all_inodes() != 0) return -1;
+
+    int count = 0;
+    for (int i = 0; i < MAX_FILES && count < max_files; i++) {
+        if (inode_table[i].used) {
+            strncpy(filenames[count], inode_table[i].name, MAX_FILENAME);
+            filenames[count][MAX_FILENAME - 1] = '\0'; // Ensure null termination
+            count++;
+        }
+    }
+    return count;
+}
+
+static int do_fs_list(char filenames[][MAX_FILENAME], int max_files) {
+    pthread_rwlock_wrlock(&fs_lock);
+    int result = list_files(filenames, max_files);
+    pthread_rwlock_unlock(&fs_lock);
+    return result;
+}
+
+int fs_list(char filenames[][MAX_FILENAME], int max_files) {
+    uint64_t start = trace_begin();
+    int result = do_fs_list(filenames, max_files);
+    trace_end(start, FS_OP_LIST, "", NULL, max_files, 0, result);
+    return result;
+}
+
+static int list_begin(const char* prefix) {
+    if (disk_fd == -1) return -3;
+    if (prefix && strlen(prefix) >= MAX_FILENAME) return -3;
+    if (load_all_inodes() != 0) return -3;
+
+    for (int c = 0; c < MAX_CURSORS; c++) {
+        if (cursors[c].in_use) continue;
+        list_cursor* cursor = &cursors[c];
+        memset(cursor, 0, sizeof(*cursor));
+        cursor->in_use = 1;
+        if (prefix) {
+            strcpy(cursor->prefix, prefix);
+            cursor->prefix_len = strlen(prefix);
+        }
+        return c;
+    }
+    return -2; // Too many cursors open
+}
+
+static int do_fs_list_begin(const char* prefix) {
+    pthread_rwlock_wrlock(&fs_lock);
+    int result = list_begin(prefix);
+    pthread_rwlock_unlock(&fs_lock);
+    return result;
+}
+
+int fs_list_begin(const char* prefix) {
+    uint64_t start = trace_begin();
+    int result = do_fs_list_begin(prefix);
+    trace_end(start, FS_OP_LIST_BEGIN, prefix, NULL, 0, 0, result);
+    return result;
+}
+
+static int list_next(int cursor_id, fs_dirent* entries, int max_entries) {
+    if (disk_fd == -1 || !entries || max_entries <= 0) return -3;
+    if (cursor_id < 0 || cursor_id >= MAX_CURSORS || !cursors[cursor_id].in_use) return -1;
+    list_cursor* cursor = &cursors[cursor_id];
+
+    // Seek to the first name after the last one returned, or to the prefix
+    int pos;
+    if (cursor->started) {
+        pos = name_lower_bound(cursor->last);
+        if (pos < name_count && strncmp(inode_table[name_index[pos]].name, cursor->last, MAX_FILENAME) == 0) pos++;
+    } else {
+        pos = name_lower_bound(cursor->prefix);
+    }
+
+    // Names sharing the prefix are contiguous in the index
+    int count = 0;
+    while (count < max_entries && pos < name_count) {
+        const inode* node = &inode_table[name_index[pos++]];
+        if (strncmp(node->name, cursor->prefix, cursor->prefix_len) != 0) break;
+        strncpy(entries[count].name, node->name, MAX_FILENAME);
+        entries[count].name[MAX_FILENAME - 1] = '\0';
+        entries[count].size = node->size;
+        count++;
+    }
+    if (count > 0) {
+        strcpy(cursor->last, entries[count - 1].name);
+        cursor->started = 1;
+    }
+    return count;
+}
+
+static int do_fs_list_next(int cursor_id, fs_dirent* entries, int max_entries) {
+    pthread_rwlock_wrlock(&fs_lock);
+    int result = list_next(cursor_id, entries, max_entries);
+    pthread_rwlock_unlock(&fs_lock);
+    return result;
+}
+
+int fs_list_next(int cursor_id, fs_dirent* entries, int max_entries) {
+    uint64_t start = trace_begin();
+    int result = do_fs_list_next(cursor_id, entries, max_entries);
+    trace_end(start, FS_OP_LIST_NEXT, "", NULL, max_entries, cursor_id, result);
+    return result;
+}
+
+static int list_end(int cursor_id) {
+    if (cursor_id < 0 || cursor_id >= MAX_CURSORS || !cursors[cursor_id].in_use) return -1;
+    cursors[cursor_id].in_use = 0;
+    return 0;
+}
+
+static int do_fs_list_end(int cursor_id) {
+    pthread_rwlock_wrlock(&fs_lock);
+    int result = list_end(cursor_id);
+    pthread_rwlock_unlock(&fs_lock);
+    return result;
+}
+
+int fs_list_end(int cursor_id) {
+    uint64_t start = trace_begin();
+    int result = do_fs_list_end(cursor_id);
+    trace_end(start, FS_OP_LIST_END, "", NULL, 0, cursor_id, result);
+    return result;
+}
+// Take fs_lock shared and the named file's inode lock, plus dedup_lock for
+// a write on a dedup mount. Returns the inode number, or -1 (not found) or
+// -3 (not mounted) with nothing left locked.
+static int lock_file(const char* filename, int writing) {
+    pthread_rwlock_rdlock(&fs_lock);
+    int inode_idx = (disk_fd == -1) ? -3 : find_inode(filename);
+    if (inode_idx < 0) {
+        pthread_rwlock_unlock(&fs_lock);
+        return inode_idx;
+    }
+    pthread_mutex_lock(&inode_locks[inode_idx]);
+    if (writing && dedup_writes) pthread_mutex_lock(&dedup_lock);
+    return inode_idx;
+}
+
+// Release what lock_file took
+static void unlock_file(int inode_idx, int writing) {
+    if (writing && dedup_writes) pthread_mutex_unlock(&dedup_lock);
+    pthread_mutex_unlock(&inode_locks[inode_idx]);
+    pthread_rwlock_unlock(&fs_lock);
+}
+
+// Replace a file's contents. Called with the file locked for writing.
+static int write_file(int inode_idx, const void* data, int size) {
+    inode* target_inode = &inode_table[inode_idx];
+
+    // Calculate the number of blocks needed
+    int needed_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    // Compressed files store the compressed form when it saves at least a block
+    const char* payload = (const char*)data;
+    int stored_size = size;
+    unsigned char packed[LZ_BOUND(MAX_DIRECT_BLOCKS * BLOCK_SIZE)];
+    if (target_inode->flags & INODE_FLAG_COMPRESS) {
+        int packed_size = lz_compress((const unsigned char*)data, size, packed, sizeof(packed));
+        int packed_blocks = (packed_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (packed_size > 0 && packed_blocks < needed_blocks) {
+            STAT_ADD(compress_blocks_saved, needed_blocks - packed_blocks);
+            payload = (const char*)packed;
+            stored_size = packed_size;
+            needed_blocks = packed_blocks;
+        }
+    }
+    
+    // In dedup mode, blocks identical to one already on disk or to an earlier
+    // block of this write are shared rather than allocated
+    int shared[MAX_DIRECT_BLOCKS];
+    int same_as[MAX_DIRECT_BLOCKS];
+    int fresh_blocks = needed_blocks;
+    if (dedup_writes) {
+        fresh_blocks = dedup_match(payload, stored_size, shared, same_as);
+    } else {
+        for (int i = 0; i < needed_blocks; i++) shared[i] = same_as[i] = -1;
+    }
+
+    // Check if there's enough space
+    if (reserve_blocks(fresh_blocks) != 0) { // "Out of space"
+        for (int i = 0; i < needed_blocks; i++) {
+            if (shared[i] != -1) block_unref(shared[i]);
+        }
+        return -2;
+    }
+
+    // Allocate new blocks; shared ones are already on disk and skip the write
+    int new_blocks[MAX_DIRECT_BLOCKS] = {0};
+    char skip[MAX_DIRECT_BLOCKS];
+    for (int i = 0; i < needed_blocks; i++) {
+        skip[i] = 1;
+        if (shared[i] != -1) {
+            new_blocks[i] = shared[i];
+        } else if (same_as[i] != -1) {
+            new_blocks[i] = new_blocks[same_as[i]];
+            block_ref(new_blocks[i]);
         } else {
+            new_blocks[i] = alloc_block(inode_idx % BLOCK_GROUPS);
+            skip[i] = 0;
+        }
+    }
+
+    // Write the data, zero-padding the last block. Until it is on disk the
+    // inode keeps its old blocks, so a failed write leaves the file as it was.
+    if (write_blocks(new_blocks, payload, stored_size, skip) != 0) {
+        for (int i = 0; i < needed_blocks; i++) block_unref(new_blocks[i]);
+        return -3;
+    }
+    for (int i = 0; i < needed_blocks; i++) {
+        STAT_ADD(dedup_blocks_shared, skip[i]);
+        if (dedup_writes && !skip[i]) dedup_insert(new_blocks[i]);
+    }
+
+    // Release the old blocks and switch to the new ones (unused pointers are zero)
+    for (int i = 0; i < MAX_DIRECT_BLOCKS; i++) {
+        if (target_inode->blocks[i] != 0) block_unref(target_inode->blocks[i]);
+        target_inode->blocks[i] = new_blocks[i];
+    }
+    // update the inode's size and restart sequential detection
+    target_inode->size = size;
+    target_inode->stored_size = stored_size;
+    target_inode->mod_count++;
+    if (payload == (const char*)data) target_inode->flags &= ~INODE_FLAG_COMPRESSED;
+    else target_inode->flags |= INODE_FLAG_COMPRESSED;
+    ra_state[inode_idx].next_offset = 0;
+    ra_state[inode_idx].window = 0;
+    return 0; // Success
+}
+
+static int do_fs_write(const char* filename, const void* data, int size) {
+    // check if the parameters are valid
+    if (!filename || !data || size <= 0) return -3;
+
+    // check if the filename is valid
+    if (strlen(filename) >= MAX_FILENAME) return -3; 
+
+    // check if the file is too large
+    if (size > MAX_DIRECT_BLOCKS * BLOCK_SIZE) return -3;
+
+    int inode_idx = lock_file(filename, 1);
+    if (inode_idx < 0) return inode_idx;
+    int result = write_file(inode_idx, data, size);
+    unlock_file(inode_idx, 1);
+    return result;
+}
+
+int fs_write(const char* filename, const void* data, int size) {
+    uint64_t start = trace_begin();
+    int result = do_fs_write(filename, data, size);
+    trace_end(start, FS_OP_WRITE, filename, NULL, size, 0, result);
+    return result;
+}
+
+// Read len bytes at offset from a compressed file. The stored blocks are
+// fetched through the cache and decompressed straight into the caller's
+// buffer when reading from the start. Returns bytes read or -3.
+static int read_compressed(int inode_idx, char* data, int len, int offset) {
+    inode* target_inode = &inode_table[inode_idx];
+    int stored_blocks = inode_blocks(target_inode);
+
+    for (int i = 0; i < stored_blocks; i++) {
+        if (target_inode->blocks[i] == 0) return -3;
+    }
+
+    int missing[MAX_DIRECT_BLOCKS] = {0};
+    int missing_count = 0;
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < stored_blocks; i++) {
+        // Looking cached blocks up marks them recently used, so the fill can't evict them
+        if (cache_lookup(target_inode->blocks[i]) == -1) missing[missing_count++] = target_inode->blocks[i];
+    }
+    if (cache_fill(missing, missing_count, missing_count) != 0 ||
+        cache_fetch(target_inode->blocks, stored_blocks) != 0) { // Read error
+        pthread_mutex_unlock(&cache_lock);
+        return -3;
+    }
+    STAT_ADD(cache_misses, missing_count);
+    STAT_ADD(cache_hits, stored_blocks - missing_count);
+
+    // Gather the compressed stream, then expand as far as the read needs
+    unsigned char packed[MAX_DIRECT_BLOCKS * BLOCK_SIZE];
+    for (int i = 0; i < stored_blocks; i++) {
+        int slot = cache_lookup(target_inode->blocks[i]);
+        int chunk = target_inode->stored_size - i * BLOCK_SIZE;
+        if (chunk > BLOCK_SIZE) chunk = BLOCK_SIZE;
+        memcpy(packed + i * BLOCK_SIZE, cache_data[slot], chunk);
+    }
+    pthread_mutex_unlock(&cache_lock);
+    if (offset == 0) {
+        int n = lz_decompress(packed, target_inode->stored_size, (unsigned char*)data, len);
+        return (n == len) ? n : -3;
+    }
+    unsigned char raw[MAX_DIRECT_BLOCKS * BLOCK_SIZE];
+    int n = lz_decompress(packed, target_inode->stored_size, raw, offset + len);
+    if (n != offset + len) return -3;
+    memcpy(data, raw + offset, len);
+    return len;
+}
+
+// Fill a stat record from an in-memory inode
+static void stat_inode(int inode_idx, fs_file_stat* st) {
+    const inode* node = &inode_table[inode_idx];
+    st->inode = inode_idx;
+    st->size = node->size;
+    st->blocks = inode_blocks(node);
+    st->flags = node->flags;
+    st->mod_count = node->mod_count;
+}
+
+static int do_fs_stat(const char* filename, fs_file_stat* st) {
+    // check if the parameters are valid
+    if (!filename || !st) return -3;
+
+    // check if the filename is valid
+    if (strlen(filename) >= MAX_FILENAME) return -3;
+
+    int inode_idx = lock_file(filename, 0);
+    if (inode_idx < 0) return inode_idx;
+    stat_inode(inode_idx, st);
+    unlock_file(inode_idx, 0);
+    return 0;
+}
+
+int fs_stat(const char* filename, fs_file_stat* st) {
+    uint64_t start = trace_begin();
+    int result = do_fs_stat(filename, st);
+    trace_end(start, FS_OP_STAT, filename, NULL, 0, 0, result);
+    return result;
+}
+
+static int do_fs_stat_many(const char* const* filenames, int count, fs_file_stat* st) {
+    if (!filenames || !st || count < 0) return -3;
+
+    pthread_rwlock_rdlock(&fs_lock);
+    if (disk_fd == -1) {
+        pthread_rwlock_unlock(&fs_lock);
+        return -3;
+    }
+    int found = 0;
+    for (int i = 0; i < count; i++) {
+        int inode_idx = -1;
+        if (filenames[i] && strlen(filenames[i]) < MAX_FILENAME) inode_idx = find_inode(filenames[i]);
+        if (inode_idx == -1) {
+            memset(&st[i], 0, sizeof(st[i]));
+            st[i].inode = -1;
+            continue;
+        }
+        pthread_mutex_lock(&inode_locks[inode_idx]);
+        stat_inode(inode_idx, &st[i]);
+        pthread_mutex_unlock(&inode_locks[inode_idx]);
+        found++;
+    }
+    pthread_rwlock_unlock(&fs_lock);
+    return found;
+}
+
+int fs_stat_many(const char* const* filenames, int count, fs_file_stat* st) {
+    uint64_t start = trace_begin();
+    int result = do_fs_stat_many(filenames, count, st);
+    if (start) trace_end_many(start, FS_OP_STAT_MANY, filenames, count, result);
+    return result;
+}
+
+// Extend an uncompressed file by size bytes of data (zeros if data is NULL).
+// The partial tail block is copied into a new block together with the start
+// of the data, and whole new blocks are allocated for the rest. The inode
+// keeps its old blocks until the new ones are written, so a failed write
+// leaves the file as it was. Returns 0, -2 (out of space) or -3.
+static int append_blocks(int inode_idx, const char* data, int size) {
+    static const char zeros[MAX_DIRECT_BLOCKS * BLOCK_SIZE];
+    inode* target_inode = &inode_table[inode_idx];
+    int old_size = target_inode->size;
+    int needed_blocks = (old_size + size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int tail = old_size / BLOCK_SIZE;
+    int offset = old_size % BLOCK_SIZE;
+    int count = needed_blocks - tail; // New blocks, from the tail block on
+    int group = inode_idx % BLOCK_GROUPS;
+    unsigned char block[BLOCK_SIZE];
+    if (offset != 0 && load_block(target_inode->blocks[tail], block) != 0) return -3;
+    if (reserve_blocks(count) != 0) return -2; // "Out of space"
+    if (!data) data = zeros;
+
+    int new_blocks[MAX_DIRECT_BLOCKS] = {0};
+    for (int i = 0; i < count; i++) new_blocks[i] = alloc_block(group);
+
+    // Fill the copy of the tail block, then the rest goes into fresh blocks
+    int consumed = 0;
+    int rc = 0;
+    if (offset != 0) {
+        consumed = (size < BLOCK_SIZE - offset) ? size : BLOCK_SIZE - offset;
+        memcpy(block + offset, data, consumed);
+        rc = write_blocks(new_blocks, (const char*)block, offset + consumed, NULL);
+    }
+    if (rc == 0 && consumed < size) {
+        rc = write_blocks(&new_blocks[offset != 0], data + consumed, size - consumed, NULL);
+    }
+    if (rc != 0) {
+        for (int i = 0; i < count; i++) block_unref(new_blocks[i]);
+        return -3;
+    }
+
+    // Switch to the new blocks; the old tail's cached copy goes with it (views keep theirs)
+    if (offset != 0) block_unref(target_inode->blocks[tail]);
+    for (int i = 0; i < count; i++) {
+        target_inode->blocks[tail + i] = new_blocks[i];
+        if (dedup_writes) dedup_insert(new_blocks[i]);
+    }
+    target_inode->size = old_size + size;
+    target_inode->stored_size = old_size + size;
+    target_inode->mod_count++;
+    return 0;
+}
+
+// Rewrite a compressed file as its first keep bytes followed by size bytes
+// of data (zeros if data is NULL). The stored form can't be edited in place,
+// so this goes through write_file. Returns write_file's result.
+static int rewrite_compressed(int inode_idx, int keep, const char* data, int size) {
+    char contents[MAX_DIRECT_BLOCKS * BLOCK_SIZE];
+    if (read_compressed(inode_idx, contents, keep, 0) != keep) return -3;
+    if (data) memcpy(contents + keep, data, size);
+    else memset(contents + keep, 0, size);
+    return write_file(inode_idx, contents, keep + size);
+}
+
+static int do_fs_append(const char* filename, const void* data, int size) {
+    // check if the parameters are valid
+    if (!filename || !data || size <= 0) return -3;
+
+    // check if the filename is valid
+    if (strlen(filename) >= MAX_FILENAME) return -3;
+
+    int inode_idx = lock_file(filename, 1);
+    if (inode_idx < 0) return inode_idx;
+
+    // check if the file would become too large
+    inode* target_inode = &inode_table[inode_idx];
+    int result;
+    if (size > MAX_DIRECT_BLOCKS * BLOCK_SIZE - target_inode->size) {
+        result = -3;
+    } else if (target_inode->flags & INODE_FLAG_COMPRESSED) {
+        result = rewrite_compressed(inode_idx, target_inode->size, (const char*)data, size);
+    } else {
+        result = append_blocks(inode_idx, (const char*)data, size);
+    }
+    unlock_file(inode_idx, 1);
+    return result;
+}
+
+int fs_append(const char* filename, const void* data, int size) {
+    uint64_t start = trace_begin();
+    int result = do_fs_append(filename, data, size);
+    trace_end(start, FS_OP_APPEND, filename, NULL, size, 0, result);
+    return result;
+}
+
+// Resize a file. Called with the file locked for writing.
+static int truncate_file(int inode_idx, int new_size) {
+    inode* target_inode = &inode_table[inode_idx];
+    int compressed = (target_inode->flags & INODE_FLAG_COMPRESSED) != 0;
+    if (new_size == target_inode->size) return 0;
+
+    // Growing appends zeros
+    if (new_size > target_inode->size) {
+        int extra = new_size - target_inode->size;
+        if (compressed) return rewrite_compressed(inode_idx, target_inode->size, NULL, extra);
+        return append_blocks(inode_idx, NULL, extra);
+    }
+    if (compressed && new_size > 0) return rewrite_compressed(inode_idx, new_size, NULL, 0);
+
+    // Shrinking releases the blocks past the new end. The bytes left past it
+    // in the last block are never read: an append rewrites that block.
+    int keep_blocks = (new_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    for (int i = keep_blocks; i < MAX_DIRECT_BLOCKS; i++) {
+        if (target_inode->blocks[i] != 0) {
+            block_unref(target_inode->blocks[i]);
+            target_inode->blocks[i] = 0;
+        }
+    }
+    target_inode->size = new_size;
+    target_inode->stored_size = new_size;
+    target_inode->flags &= ~INODE_FLAG_COMPRESSED;
+    target_inode->mod_count++;
+    ra_state[inode_idx].next_offset = 0;
+    ra_state[inode_idx].window = 0;
+    return 0;
+}
+
+static int do_fs_truncate(const char* filename, int new_size) {
+    // check if the parameters are valid
+    if (!filename) return -3;
+
+    // check if the filename and size are valid
+    if (strlen(filename) >= MAX_FILENAME) return -3;
+    if (new_size < 0 || new_size > MAX_DIRECT_BLOCKS * BLOCK_SIZE) return -3;
+
+    int inode_idx = lock_file(filename, 1);
+    if (inode_idx < 0) return inode_idx;
+    int result = truncate_file(inode_idx, new_size);
+    unlock_file(inode_idx, 1);
+    return result;
+}
+
+int fs_truncate(const char* filename, int new_size) {
+    uint64_t start = trace_begin();
+    int result = do_fs_truncate(filename, new_size);
+    trace_end(start, FS_OP_TRUNCATE, filename, NULL, new_size, 0, result);
+    return result;
+}
+
+// Store one block of a writer's new contents (size bytes of data, zero-padded),
+// sharing an identical block in dedup mode. Returns 0, -2 (out of space) or -3.
+static int writer_put_block(stream_writer* writer, const char* data, int size) {
+    int shared = -1, same_as;
+    if (dedup_writes) dedup_match(data, size, &shared, &same_as);
+    if (shared != -1) {
+        STAT_ADD(dedup_blocks_shared, 1);
+        writer->blocks[writer->count++] = shared;
+        return 0;
+    }
+    if (reserve_blocks(1) != 0) return -2; // "Out of space"
+    int block_num = alloc_block((writer->inode == -1) ? 0 : writer->inode % BLOCK_GROUPS);
+    writer->blocks[writer->count++] = block_num;
+    if (write_blocks(&block_num, data, size, NULL) != 0) return -3;
+    if (dedup_writes) dedup_insert(block_num);
+    return 0;
+}
+
+// Discard a writer's blocks and close it. Called with fs_lock held exclusively.
+static void writer_abort(stream_writer* writer) {
+    for (int i = 0; i < writer->count; i++) block_unref(writer->blocks[i]);
+    writer->in_use = 0;
+}
+
+static int do_fs_writer_open(const char* filename) {
+    // check if the parameters are valid
+    if (!filename) return -3;
+
+    // check if the filename is valid
+    if (strlen(filename) >= MAX_FILENAME) return -3;
+
+    pthread_rwlock_wrlock(&fs_lock);
+    int inode_idx = (disk_fd == -1) ? -3 : find_inode(filename);
+    int result = (inode_idx < 0) ? inode_idx : -2; // -2: too many writers open
+    for (int w = 0; w < MAX_WRITERS && inode_idx >= 0; w++) {
+        if (writers[w].in_use) continue;
+        writers[w].in_use = 1;
+        writers[w].inode = inode_idx;
+        writers[w].size = 0;
+        writers[w].count = 0;
+        result = w;
+        break;
+    }
+    pthread_rwlock_unlock(&fs_lock);
+    return result;
+}
+
+int fs_writer_open(const char* filename) {
+    uint64_t start = trace_begin();
+    int result = do_fs_writer_open(filename);
+    trace_end(start, FS_OP_WRITER_OPEN, filename, NULL, 0, 0, result);
+    return result;
+}
+
+// Add data to a writer's contents. Called with fs_lock held shared, the
+// writer's lock (and dedup_lock on a dedup mount).
+static int writer_write(stream_writer* writer, const char* src, int size) {
+    // check if the file would become too large
+    if (size > MAX_DIRECT_BLOCKS * BLOCK_SIZE - writer->size) return -3;
+
+    // Whole blocks go straight from the caller's buffer when nothing is
+    // buffered; anything else is gathered into the block being filled
+    while (size > 0) {
+        int fill = writer->size % BLOCK_SIZE;
+        int chunk;
+        if (fill == 0 && size >= BLOCK_SIZE) {
             chunk = BLOCK_SIZE;
+            int result = writer_put_block(writer, src, BLOCK_SIZE);
+            if (result != 0) return result;
+        } else {
+            chunk = (size < BLOCK_SIZE - fill) ? size : BLOCK_SIZE - fill;
+            memcpy(writer->buffer + fill, src, chunk);
+            if (fill + chunk == BLOCK_SIZE) {
+                int result = writer_put_block(writer, (const char*)writer->buffer, BLOCK_SIZE);
+                if (result != 0) return result;
+            }
+        }
+        writer->size += chunk;
+        src += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+static int do_fs_writer_write(int writer_id, const void* data, int size) {
+    if (!data || size < 0) return -3;
+
+    pthread_rwlock_rdlock(&fs_lock);
+    int result;
+    if (disk_fd == -1) {
+        result = -3;
+    } else if (writer_id < 0 || writer_id >= MAX_WRITERS || !writers[writer_id].in_use) {
+        result = -1;
+    } else {
+        pthread_mutex_lock(&writer_locks[writer_id]);
+        if (dedup_writes) pthread_mutex_lock(&dedup_lock);
+        result = writer_write(&writers[writer_id], (const char*)data, size);
+        if (dedup_writes) pthread_mutex_unlock(&dedup_lock);
+        pthread_mutex_unlock(&writer_locks[writer_id]);
+    }
+    pthread_rwlock_unlock(&fs_lock);
+    return result;
+}
+
+int fs_writer_write(int writer_id, const void* data, int size) {
+    uint64_t start = trace_begin();
+    int result = do_fs_writer_write(writer_id, data, size);
+    trace_end(start, FS_OP_WRITER_WRITE, "", NULL, size, writer_id, result);
+    return result;
+}
+
+// Publish a writer's contents. Called with fs_lock held exclusively.
+static int writer_commit(stream_writer* writer) {
+    // Store the last partial block
+    int fill = writer->size % BLOCK_SIZE;
+    if (fill != 0 && writer->count * BLOCK_SIZE < writer->size) {
+        int result = writer_put_block(writer, (const char*)writer->buffer, fill);
+        if (result != 0) return result;
+    }
+    if (writer->inode == -1) { // The file was deleted while the writer was open
+        writer_abort(writer);
+        return -1;
+    }
+
+    // Publish the new contents: the old blocks go, the writer's take their place
+    inode* target_inode = &inode_table[writer->inode];
+    for (int i = 0; i < MAX_DIRECT_BLOCKS; i++) {
+        if (target_inode->blocks[i] != 0) block_unref(target_inode->blocks[i]);
+        target_inode->blocks[i] = (i < writer->count) ? writer->blocks[i] : 0;
+    }
+    target_inode->size = writer->size;
+    target_inode->stored_size = writer->size;
+    target_inode->flags &= ~INODE_FLAG_COMPRESSED;
+    target_inode->mod_count++;
+    ra_state[writer->inode].next_offset = 0;
+    ra_state[writer->inode].window = 0;
+    writer->in_use = 0;
+    return 0;
+}
+
+static int do_fs_writer_commit(int writer_id) {
+    pthread_rwlock_wrlock(&fs_lock);
+    int result;
+    if (disk_fd == -1) result = -3;
+    else if (writer_id < 0 || writer_id >= MAX_WRITERS || !writers[writer_id].in_use) result = -1;
+    else result = writer_commit(&writers[writer_id]);
+    pthread_rwlock_unlock(&fs_lock);
+    return result;
+}
+
+int fs_writer_commit(int writer_id) {
+    uint64_t start = trace_begin();
+    int result = do_fs_writer_commit(writer_id);
+    trace_end(start, FS_OP_WRITER_COMMIT, "", NULL, 0, writer_id, result);
+    return result;
+}
+
+static int do_fs_writer_abort(int writer_id) {
+    pthread_rwlock_wrlock(&fs_lock);
+    int result = 0;
+    if (disk_fd == -1) result = -3;
+    else if (writer_id < 0 || writer_id >= MAX_WRITERS || !writers[writer_id].in_use) result = -1;
+    else writer_abort(&writers[writer_id]);
+    pthread_rwlock_unlock(&fs_lock);
+    return result;
+}
+
+int fs_writer_abort(int writer_id) {
+    uint64_t start = trace_begin();
+    int result = do_fs_writer_abort(writer_id);
+    trace_end(start, FS_OP_WRITER_ABORT, "", NULL, 0, writer_id, result);
+    return result;
+}
+
+int fs_read(const char* filename, void* data, int size) {
+    return fs_read_at(filename, data, size, 0);
+}
+
+// Read bytes_to_read bytes (all within the file) at offset from an
+// uncompressed file. Called with the file locked and cache_lock held.
+static int read_blocks(int inode_idx, void* data, int bytes_to_read, int offset) {
+    inode* target_inode = &inode_table[inode_idx];
+    int file_blocks = (target_inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int first = offset / BLOCK_SIZE;
+    int last = (offset + bytes_to_read - 1) / BLOCK_SIZE;
+
+    // A read that starts where the previous one stopped is sequential: grow the
+    // readahead window. Anything else is random access and turns readahead off.
+    readahead_state* ra = &ra_state[inode_idx];
+    if (offset == ra->next_offset) {
+        ra->window = ra->window ? ra->window * 2 : READAHEAD_MIN;
+        if (ra->window > READAHEAD_MAX) ra->window = READAHEAD_MAX;
+    } else {
+        ra->window = 0;
+    }
+    int prefetch_last = last + ra->window;
+    if (prefetch_last >= file_blocks) prefetch_last = file_blocks - 1;
+
+    // Fetch every missing block of the request and the readahead window in one
+    // pass. With O_DIRECT, whole blocks landing on an aligned spot of the
+    // caller's buffer skip the cache and are read straight into it.
+    char* data_ptr = (char*)data;
+    int missing[MAX_DIRECT_BLOCKS] = {0};
+    int missing_count = 0;
+    int first_readahead = -1;
+    int direct[MAX_DIRECT_BLOCKS] = {0};
+    int direct_count = 0;
+    int wanted[MAX_DIRECT_BLOCKS];
+    int wanted_count = 0;
+    for (int i = first; i <= prefetch_last; i++) {
+        int block_idx = target_inode->blocks[i];
+        if (block_idx == 0) break; // No more blocks
+        // Looking cached blocks up marks them recently used, so the fill
+        // below can't pick them as victims before they are copied out
+        if (cache_lookup(block_idx) != -1) {
+            if (i <= last) wanted[wanted_count++] = block_idx;
+            continue;
+        }
+        if (i <= last && direct_io) {
+            long dest = (long)i * BLOCK_SIZE - offset;
+            if (dest >= 0 && dest + BLOCK_SIZE <= bytes_to_read && is_block_aligned(data_ptr + dest)) {
+                direct[i - first] = 1;
+                direct_count++;
+                continue;
+            }
+        }
+        if (i <= last) wanted[wanted_count++] = block_idx;
+        if (i > last && first_readahead == -1) first_readahead = missing_count;
+        missing[missing_count++] = block_idx;
+    }
+    if (first_readahead == -1) first_readahead = missing_count;
+    if (cache_fill(missing, missing_count, first_readahead) != 0) return -3; // Read error
+    STAT_ADD(cache_misses, first_readahead + direct_count);
+
+    // Read the direct blocks, merging runs that are consecutive on disk. They
+    // don't touch the cache, so cache_lock is dropped meanwhile.
+    int direct_ok = 1;
+    if (direct_count > 0) pthread_mutex_unlock(&cache_lock);
+    for (int i = first; i <= last && direct_count > 0 && direct_ok; ) {
+        if (!direct[i - first]) { i++; continue; }
+        int run = 1;
+        while (i + run <= last && direct[i + run - first] &&
+               target_inode->blocks[i + run] == target_inode->blocks[i] + run) run++;
+        STAT_ADD(disk_reads, 1);
+        ssize_t n = pread(disk_fd, data_ptr + (long)i * BLOCK_SIZE - offset, (size_t)run * BLOCK_SIZE,
+                          (off_t)target_inode->blocks[i] * BLOCK_SIZE);
+        if (n != (ssize_t)run * BLOCK_SIZE) direct_ok = 0; // Read error
+        for (int j = 0; j < run && direct_ok; j++) {
+            if (verify_block(target_inode->blocks[i + j], data_ptr + (long)(i + j) * BLOCK_SIZE - offset) != 0) {
+                direct_ok = 0; // Checksum mismatch
+            }
+        }
+        i += run;
+    }
+    if (direct_count > 0) pthread_mutex_lock(&cache_lock);
+    if (!direct_ok || cache_fetch(wanted, wanted_count) != 0) return -3;
+
+    // Copy the remaining requested range out of the cache
+    int bytes_read = 0;
+    for (int i = first; i <= last; i++) {
+        int block_idx = target_inode->blocks[i];
+        if (block_idx == 0) break;
+        int block_offset = (i == first) ? offset % BLOCK_SIZE : 0;
+        int chunk = BLOCK_SIZE - block_offset;
+        if (bytes_to_read - bytes_read < chunk) chunk = bytes_to_read - bytes_read;
+        if (direct[i - first]) {
+            bytes_read += chunk;
+            continue;
+        }
+
+        int slot = cache_lookup(block_idx);
+        if (slot == -1) return -3;
+        if (cache_slots[slot].readahead) {
+            cache_slots[slot].readahead = 0;
+            STAT_ADD(readahead_hits, 1);
         }
-        int n = read(disk_fd, data_ptr + bytes_read, chunk);
-        if (n < 0) return -3; // Read error
-        bytes_read += n;
+        memcpy(data_ptr + bytes_read, cache_data[slot] + block_offset, chunk);
+        bytes_read += chunk;
     }
+    STAT_ADD(cache_hits, (last - first + 1) - first_readahead - direct_count);
+    ra->next_offset = offset + bytes_read;
     return bytes_read; // Success
-}
\ No newline at end of file
+}
+
+// Read up to size bytes at offset from a file. Called with the file locked.
+static int read_file(int inode_idx, void* data, int size, int offset) {
+    inode* target_inode = &inode_table[inode_idx];
+    if (offset >= target_inode->size) return 0;
+
+    // Determine the number of bytes to read (min of size and what's left after offset)
+    int bytes_to_read = target_inode->size - offset;
+    if (size < bytes_to_read) bytes_to_read = size;
+
+    if (target_inode->flags & INODE_FLAG_COMPRESSED) {
+        return read_compressed(inode_idx, (char*)data, bytes_to_read, offset);
+    }
+    pthread_mutex_lock(&cache_lock);
+    int result = read_blocks(inode_idx, data, bytes_to_read, offset);
+    pthread_mutex_unlock(&cache_lock);
+    return result;
+}
+
+static int do_fs_read_at(const char* filename, void* data, int size, int offset) {
+    // check if the parameters are valid
+    if (!filename || !data || size <= 0 || offset < 0) return -3;
+
+    // check if the filename is valid
+    if (strlen(filename) >= MAX_FILENAME) return -3;
+
+    int inode_idx = lock_file(filename, 0);
+    if (inode_idx < 0) return inode_idx;
+    int result = read_file(inode_idx, data, size, offset);
+    unlock_file(inode_idx, 0);
+    return result;
+}
+
+int fs_read_at(const char* filename, void* data, int size, int offset) {
+    uint64_t start = trace_begin();
+    int result = do_fs_read_at(filename, data, size, offset);
+    trace_end(start, FS_OP_READ_AT, filename, NULL, size, offset, result);
+    return result;
+}
+
+// Ask the host to start reading the given blocks into its page cache, one
+// hint per run of consecutive blocks. Useless with O_DIRECT, so skipped.
+static void hint_willneed(const int* block_nums, int count) {
+    if (direct_io) return;
+    int i = 0;
+    while (i < count) {
+        int run = 1;
+        while (i + run < count && block_nums[i + run] == block_nums[i] + run) run++;
+        posix_fadvise(disk_fd, (off_t)block_nums[i] * BLOCK_SIZE, (off_t)run * BLOCK_SIZE, POSIX_FADV_WILLNEED);
+        i += run;
+    }
+}
+
+// Hand a file to a callback block by block. Called with the file locked.
+static int stream_file(int inode_idx, fs_read_callback callback, void* ctx) {
+    inode* target_inode = &inode_table[inode_idx];
+    int size = target_inode->size;
+    if (size == 0) return 0;
+
+    // A compressed file only exists whole once decompressed; it is then
+    // handed out a block at a time like any other
+    if (target_inode->flags & INODE_FLAG_COMPRESSED) {
+        char contents[MAX_DIRECT_BLOCKS * BLOCK_SIZE];
+        if (read_compressed(inode_idx, contents, size, 0) != size) return -3;
+        int delivered = 0;
+        while (delivered < size) {
+            int chunk = (size - delivered < BLOCK_SIZE) ? size - delivered : BLOCK_SIZE;
+            int stop = callback(ctx, contents + delivered, chunk);
+            delivered += chunk;
+            if (stop) break;
+        }
+        return delivered;
+    }
+
+    int blocks[MAX_DIRECT_BLOCKS];
+    int file_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    memcpy(blocks, target_inode->blocks, file_blocks * sizeof(int));
+    int delivered = 0;
+    for (int first = 0; first < file_blocks; first += STREAM_RUN) {
+        int end = (first + STREAM_RUN < file_blocks) ? first + STREAM_RUN : file_blocks;
+
+        // Fetch what this run is missing in one pass, then get the host
+        // reading the next run before handing anything out
+        int missing[STREAM_RUN];
+        int missing_count = 0;
+        pthread_mutex_lock(&cache_lock);
+        for (int i = first; i < end; i++) {
+            if (cache_lookup(blocks[i]) == -1) missing[missing_count++] = blocks[i];
+        }
+        int rc = cache_fill(missing, missing_count, missing_count);
+        pthread_mutex_unlock(&cache_lock);
+        if (rc != 0) return -3; // Read error
+        STAT_ADD(cache_misses, missing_count);
+        STAT_ADD(cache_hits, (end - first) - missing_count);
+        int next_end = (end + STREAM_RUN < file_blocks) ? end + STREAM_RUN : file_blocks;
+        hint_willneed(&blocks[end], next_end - end);
+
+        // Each block is handed out straight from its cache slot, pinned
+        // so that it can't be evicted while the callback runs
+        for (int i = first; i < end; i++) {
+            pthread_mutex_lock(&cache_lock);
+            int slot = cache_lookup(blocks[i]);
+            if (slot == -1 && cache_fill(&blocks[i], 1, 1) == 0) { // Evicted meanwhile
+                STAT_ADD(cache_misses, 1);
+                slot = cache_lookup(blocks[i]);
+            }
+            if (slot != -1 && cache_slots[slot].pins++ == 0) pinned_slots++;
+            pthread_mutex_unlock(&cache_lock);
+            if (slot == -1) return -3;
+
+            int chunk = (size - i * BLOCK_SIZE < BLOCK_SIZE) ? size - i * BLOCK_SIZE : BLOCK_SIZE;
+            int stop = callback(ctx, cache_data[slot], chunk);
+            pthread_mutex_lock(&cache_lock);
+            if (--cache_slots[slot].pins == 0) pinned_slots--;
+            pthread_mutex_unlock(&cache_lock);
+            delivered += chunk;
+            if (stop) return delivered;
+        }
+    }
+    return delivered;
+}
+
+static int do_fs_read_stream(const char* filename, fs_read_callback callback, void* ctx) {
+    // check if the parameters are valid
+    if (!filename || !callback) return -3;
+
+    // check if the filename is valid
+    if (strlen(filename) >= MAX_FILENAME) return -3;
+
+    int inode_idx = lock_file(filename, 0);
+    if (inode_idx < 0) return inode_idx;
+    int result = stream_file(inode_idx, callback, ctx);
+    unlock_file(inode_idx, 0);
+    return result;
+}
+
+int fs_read_stream(const char* filename, fs_read_callback callback, void* ctx) {
+    uint64_t start = trace_begin();
+    int result = do_fs_read_stream(filename, callback, ctx);
+    trace_end(start, FS_OP_READ_STREAM, filename, NULL, 0, callback == NULL, result);
+    return result;
+}
+
+void fs_get_stats(fs_stats* out) {
+    if (!out) return;
+    pthread_rwlock_rdlock(&fs_lock);
+    *out = stats;
+    out->free_blocks = (disk_fd == -1) ? 0 : __atomic_load_n(&sb.free_blocks, __ATOMIC_RELAXED) +
+                                             __atomic_load_n(&cached_blocks, __ATOMIC_RELAXED);
+    out->direct_io = direct_io;
+    pthread_rwlock_unlock(&fs_lock);
+}
+
+void fs_reset_stats() {
+    memset(&stats, 0, sizeof(stats));
+}
+
+// Copy a byte range of a file to out_fd through the block cache, used when
+// sendfile can't read from disk_fd or the file is compressed. Returns bytes
+// written or -3.
+static int send_through_cache(int inode_idx, int out_fd, int offset, int len) {
+    char buffer[BLOCK_SIZE];
+    int sent = 0;
+    while (sent < len) {
+        int chunk = (len - sent < BLOCK_SIZE) ? len - sent : BLOCK_SIZE;
+        int n = read_file(inode_idx, buffer, chunk, offset + sent);
+        if (n <= 0) break;
+        int done = 0;
+        while (done < n) {
+            ssize_t w = write(out_fd, buffer + done, n - done);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return (sent + done > 0) ? sent + done : -3;
+            done += w;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+// Pin a file's blocks into a new view. Called with the file locked and
+// cache_lock held.
+static int view_file(int inode_idx, struct iovec** iov, int* count) {
+    inode* target_inode = &inode_table[inode_idx];
+    if (target_inode->flags & INODE_FLAG_COMPRESSED) return -3;
+    int file_blocks = inode_blocks(target_inode);
+
+    // Find a free view and make sure pinning won't starve ordinary reads
+    int view_idx = -1;
+    for (int i = 0; i < MAX_VIEWS; i++) {
+        if (!views[i].in_use) { view_idx = i; break; }
+    }
+    if (view_idx == -1) return -2;
+    if (pinned_slots + file_blocks > CACHE_BLOCKS - CACHE_RESERVED_SLOTS) return -2;
+
+    // Bring every block of the file into the cache
+    int missing[MAX_DIRECT_BLOCKS] = {0};
+    int missing_count = 0;
+    for (int i = 0; i < file_blocks; i++) {
+        int block_idx = target_inode->blocks[i];
+        if (block_idx == 0) return -3;
+        // Looking cached blocks up marks them recently used, so the fill can't evict them
+        if (cache_lookup(block_idx) == -1) missing[missing_count++] = block_idx;
+    }
+    if (cache_fill(missing, missing_count, missing_count) != 0 ||
+        cache_fetch(target_inode->blocks, file_blocks) != 0) return -3; // Read error
+    STAT_ADD(cache_misses, missing_count);
+    STAT_ADD(cache_hits, file_blocks - missing_count);
+
+    // Other views may have been opened while the fill had cache_lock dropped
+    view_idx = -1;
+    for (int i = 0; i < MAX_VIEWS; i++) {
+        if (!views[i].in_use) { view_idx = i; break; }
+    }
+    if (view_idx == -1) return -2;
+    if (pinned_slots + file_blocks > CACHE_BLOCKS - CACHE_RESERVED_SLOTS) return -2;
+
+    // Pin the slots and point the iovecs straight at them
+    read_view* view = &views[view_idx];
+    int remaining = target_inode->size;
+    for (int i = 0; i < file_blocks; i++) {
+        int slot = cache_lookup(target_inode->blocks[i]);
+        cache_slots[slot].pins++;
+        if (cache_slots[slot].pins == 1) pinned_slots++;
+        view->slots[i] = slot;
+        view->iov[i].iov_base = cache_data[slot];
+        view->iov[i].iov_len = (remaining < BLOCK_SIZE) ? remaining : BLOCK_SIZE;
+        remaining -= view->iov[i].iov_len;
+    }
+    view->count = file_blocks;
+    view->in_use = 1;
+
+    *iov = view->iov;
+    *count = file_blocks;
+    return target_inode->size; // Success
+}
+
+static int do_fs_read_view(const char* filename, struct iovec** iov, int* count) {
+    // check if the parameters are valid
+    if (!filename || !iov || !count) return -3;
+
+    // check if the filename is valid
+    if (strlen(filename) >= MAX_FILENAME) return -3;
+
+    int inode_idx = lock_file(filename, 0);
+    if (inode_idx < 0) return inode_idx;
+    pthread_mutex_lock(&cache_lock);
+    int result = view_file(inode_idx, iov, count);
+    pthread_mutex_unlock(&cache_lock);
+    unlock_file(inode_idx, 0);
+    return result;
+}
+
+int fs_read_view(const char* filename, struct iovec** iov, int* count) {
+    uint64_t start = trace_begin();
+    int result = do_fs_read_view(filename, iov, count);
+    if (start) trace_end(start, FS_OP_READ_VIEW, filename, NULL, 0, trace_view(result >= 0 ? *iov : NULL, 1), result);
+    return result;
+}
+
+static int do_fs_release_view(struct iovec* iov) {
+    if (!iov) return -3;
+
+    pthread_rwlock_rdlock(&fs_lock);
+    pthread_mutex_lock(&cache_lock);
+    int result = (disk_fd == -1) ? -3 : -1; // -1: not an outstanding view
+    for (int v = 0; v < MAX_VIEWS && disk_fd != -1; v++) {
+        read_view* view = &views[v];
+        if (!view->in_use || view->iov != iov) continue;
+
+        // Unpin; a slot whose block was freed meanwhile becomes reusable now
+        for (int i = 0; i < view->count; i++) {
+            cache_slot* slot = &cache_slots[view->slots[i]];
+            slot->pins--;
+            if (slot->pins == 0) pinned_slots--;
+        }
+        view->in_use = 0;
+        result = 0;
+        break;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    pthread_rwlock_unlock(&fs_lock);
+    return result;
+}
+
+int fs_release_view(struct iovec* iov) {
+    uint64_t start = trace_begin();
+    int result = do_fs_release_view(iov);
+    if (start) trace_end(start, FS_OP_RELEASE_VIEW, "", NULL, 0, trace_view(iov, 0), result);
+    return result;
+}
+
+// Send a byte range of a file to out_fd. Called with the file locked.
+static int send_file(int inode_idx, int out_fd, int offset, int len) {
+    inode* target_inode = &inode_table[inode_idx];
+    if (offset >= target_inode->size) return 0;
+    int bytes_to_send = target_inode->size - offset;
+    if (len < bytes_to_send) bytes_to_send = len;
+
+    // Compressed contents have to be expanded in user space
+    if (target_inode->flags & INODE_FLAG_COMPRESSED) {
+        return send_through_cache(inode_idx, out_fd, offset, bytes_to_send);
+    }
+
+    // Walk the file's blocks, merging runs that are consecutive on disk into
+    // a single in-kernel transfer from disk_fd to out_fd
+    int sent = 0;
+    int i = offset / BLOCK_SIZE;
+    while (sent < bytes_to_send) {
+        int block_idx = target_inode->blocks[i];
+        if (block_idx == 0) break;
+        int run = 1;
+        while (i + run < MAX_DIRECT_BLOCKS && target_inode->blocks[i + run] == block_idx + run) run++;
+
+        int block_offset = (sent == 0) ? offset % BLOCK_SIZE : 0;
+        int chunk = run * BLOCK_SIZE - block_offset;
+        if (bytes_to_send - sent < chunk) chunk = bytes_to_send - sent;
+
+        off_t pos = (off_t)block_idx * BLOCK_SIZE + block_offset;
+        int done = 0;
+        while (done < chunk) {
+            ssize_t n = sendfile(out_fd, disk_fd, &pos, chunk - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                // The kernel can't transfer from this image (e.g. an O_DIRECT
+                // mount); copy the rest through the block cache instead
+                int rest = send_through_cache(inode_idx, out_fd, offset + sent + done,
+                                              bytes_to_send - sent - done);
+                if (rest < 0) return (sent + done > 0) ? sent + done : -3;
+                return sent + done + rest;
+            }
+            if (n <= 0) return (sent + done > 0) ? sent + done : -3;
+            done += n;
+        }
+        sent += chunk;
+        i += run;
+    }
+    return sent; // Success
+}
+
+static int do_fs_sendfile(const char* filename, int out_fd, int offset, int len) {
+    // check if the parameters are valid
+    if (!filename || out_fd < 0 || offset < 0 || len < 0) return -3;
+
+    // check if the filename is valid
+    if (strlen(filename) >= MAX_FILENAME) return -3;
+
+    int inode_idx = lock_file(filename, 0);
+    if (inode_idx < 0) return inode_idx;
+    int result = send_file(inode_idx, out_fd, offset, len);
+    unlock_file(inode_idx, 0);
+    return result;
+}
+
+int fs_sendfile(const char* filename, int out_fd, int offset, int len) {
+    uint64_t start = trace_begin();
+    int result = do_fs_sendfile(filename, out_fd, offset, len);
+    trace_end(start, FS_OP_SENDFILE, filename, NULL, len, offset, result);
+    return result;
+}
+
+static int clone_file(const char* src, const char* dst) {
+    // check if the filesystem is mounted and the parameters are valid
+    if (disk_fd == -1 || !src || !dst) return -3;
+
+    // check if the filenames are valid
+    if (strlen(src) >= MAX_FILENAME || strlen(dst) >= MAX_FILENAME) return -3;
+
+    // The source must exist and the destination must not
+    int src_idx = find_inode(src);
+    if (src_idx == -1 || find_inode(dst) != -1) return -1;
+
+    // Every block takes one more reference per pointer to it (a deduplicated
+    // file may point at a block twice); refuse before touching anything if
+    // one of them cannot
+    inode* source = &inode_table[src_idx];
+    for (int i = 0; i < MAX_DIRECT_BLOCKS; i++) {
+        if (source->blocks[i] == 0) continue;
+        int pointers = 0;
+        for (int j = 0; j < MAX_DIRECT_BLOCKS; j++) pointers += (source->blocks[j] == source->blocks[i]);
+        if (block_refs[source->blocks[i]] + pointers > BLOCK_REF_MAX) return -2;
+    }
+
+    int inode_idx = alloc_inode();
+    if (inode_idx == -1) return -2; // No free inodes available
+    sb.free_inodes--;
+
+    // The clone is the source's inode under a new name. Blocks are never
+    // written in place, so sharing them is copy-on-write.
+    inode* clone = &inode_table[inode_idx];
+    *clone = *source;
+    strncpy(clone->name, dst, MAX_FILENAME);
+    clone->name[MAX_FILENAME - 1] = '\0';
+    name_index_insert(inode_idx);
+    for (int i = 0; i < MAX_DIRECT_BLOCKS; i++) {
+        if (clone->blocks[i] != 0) block_refs[clone->blocks[i]]++;
+    }
+    ra_state[inode_idx].next_offset = 0;
+    ra_state[inode_idx].window = 0;
+    return 0;
+}
+
+static int do_fs_clone(const char* src, const char* dst) {
+    pthread_rwlock_wrlock(&fs_lock);
+    int result = clone_file(src, dst);
+    pthread_rwlock_unlock(&fs_lock);
+    return result;
+}
+
+int fs_clone(const char* src, const char* dst) {
+    uint64_t start = trace_begin();
+    int result = do_fs_clone(src, dst);
+    trace_end(start, FS_OP_CLONE, src, dst, 0, 0, result);
+    return result;
+}
+
+static int rename_file(const char* old_name, const char* new_name, int flags) {
+    // check if the filesystem is mounted and the parameters are valid
+    if (disk_fd == -1 || !old_name || !new_name) return -3;
+    if (flags & ~FS_RENAME_REPLACE) return -3;
+
+    // check if the filenames are valid
+    if (strlen(old_name) >= MAX_FILENAME || strlen(new_name) >= MAX_FILENAME) return -3;
+
+    int inode_idx = find_inode(old_name);
+    if (inode_idx == -1) return -1; // File doesn't exist
+
+    int target_idx = find_inode(new_name);
+    if (target_idx == inode_idx) return 0; // Same name, nothing to do
+    if (target_idx != -1) {
+        if (!(flags & FS_RENAME_REPLACE)) return -2;
+        free_file(target_idx);
+    }
+
+    // Only the name changes, so the index entry moves and nothing else does
+    name_index_remove(inode_idx);
+    strncpy(inode_table[inode_idx].name, new_name, MAX_FILENAME);
+    inode_table[inode_idx].name[MAX_FILENAME - 1] = '\0';
+    name_index_insert(inode_idx);
+    return 0;
+}
+
+static int do_fs_rename(const char* old_name, const char* new_name, int flags) {
+    pthread_rwlock_wrlock(&fs_lock);
+    int result = rename_file(old_name, new_name, flags);
+    pthread_rwlock_unlock(&fs_lock);
+    return result;
+}
+
+int fs_rename(const char* old_name, const char* new_name, int flags) {
+    uint64_t start = trace_begin();
+    int result = do_fs_rename(old_name, new_name, flags);
+    trace_end(start, FS_OP_RENAME, old_name, new_name, 0, flags, result);
+    return result;
+}
+
+static int set_compression(const char* filename, int enable) {
+    // check if the filesystem is mounted and the parameters are valid
+    if (disk_fd == -1 || !filename) return -3;
+
+    // check if the filename is valid
+    if (strlen(filename) >= MAX_FILENAME) return -3;
+
+    // Find the inode for the file
+    int inode_idx = find_inode(filename);
+    if (inode_idx == -1) return -1; // File doesn't exist
+
+    if (enable) inode_table[inode_idx].flags |= INODE_FLAG_COMPRESS;
+    else inode_table[inode_idx].flags &= ~INODE_FLAG_COMPRESS;
+    return 0;
+}
+
+static int do_fs_set_compression(const char* filename, int enable) {
+    pthread_rwlock_wrlock(&fs_lock);
+    int result = set_compression(filename, enable);
+    pthread_rwlock_unlock(&fs_lock);
+    return result;
+}
+
+int fs_set_compression(const char* filename, int enable) {
+    uint64_t start = trace_begin();
+    int result = do_fs_set_compression(filename, enable);
+    trace_end(start, FS_OP_SET_COMPRESSION, filename, NULL, 0, enable, result);
+    return result;
+}
+
+// ---- Defragmentation ----
+// The target layout is every file's blocks in inode order, packed from
+// FIRST_DATA_BLOCK with the free space as one extent at the end. A block
+// shared by several files (or twice in one) is placed with its first
+// reference. Each step puts the right block at the first position that
+// doesn't hold it, moving or swapping whatever is there, so positions
+// before it are final and a later call simply resumes.
+
+// Copy a block's current contents into buf through the block cache,
+// verifying its checksum. Returns 0 or -1.
+static int load_block(int block_num, void* buf) {
+    pthread_mutex_lock(&cache_lock);
+    int slot = cache_lookup(block_num);
+    if (slot == -1 && cache_fill(&block_num, 1, 1) == 0) slot = cache_lookup(block_num);
+    if (slot != -1) memcpy(buf, cache_data[slot], BLOCK_SIZE);
+    pthread_mutex_unlock(&cache_lock);
+    return (slot != -1) ? 0 : -1;
+}
+
+// Exchange the disk locations of blocks a and b (either may be free):
+// contents, checksums, reference counts, dedup entries and every inode and
+// open writer pointer to them. Returns the number of blocks written, or -1.
+static int swap_blocks(int a, int b) {
+    unsigned char data_a[BLOCK_SIZE], data_b[BLOCK_SIZE];
+    if (block_refs[a] > 0 && load_block(a, data_a) != 0) return -1;
+    if (block_refs[b] > 0 && load_block(b, data_b) != 0) return -1;
+    if (block_refs[a] > 0) dedup_remove(a);
+    if (block_refs[b] > 0) dedup_remove(b);
+
+    int written = 0;
+    if (block_refs[b] > 0) {
+        if (write_blocks(&a, (const char*)data_b, BLOCK_SIZE, NULL) != 0) return -1;
+        written++;
+    }
+    if (block_refs[a] > 0) {
+        if (write_blocks(&b, (const char*)data_a, BLOCK_SIZE, NULL) != 0) return -1;
+        written++;
+    }
+
+    unsigned char refs = block_refs[a];
+    block_refs[a] = block_refs[b];
+    block_refs[b] = refs;
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (!inode_table[i].used) continue;
+        for (int j = 0; j < MAX_DIRECT_BLOCKS; j++) {
+            if (inode_table[i].blocks[j] == a) inode_table[i].blocks[j] = b;
+            else if (inode_table[i].blocks[j] == b) inode_table[i].blocks[j] = a;
+        }
+    }
+    for (int w = 0; w < MAX_WRITERS; w++) {
+        if (!writers[w].in_use) continue;
+        for (int j = 0; j < writers[w].count; j++) {
+            if (writers[w].blocks[j] == a) writers[w].blocks[j] = b;
+            else if (writers[w].blocks[j] == b) writers[w].blocks[j] = a;
+        }
+    }
+    cache_invalidate(a);
+    cache_invalidate(b);
+    if (block_refs[a] > 0) discard_cancel(a);
+    if (block_refs[b] > 0) discard_cancel(b);
+    if (block_refs[a] == 0) discard_queue(a);
+    if (block_refs[b] == 0) discard_queue(b);
+    if (dedup_writes && block_refs[a] > 0) dedup_insert(a);
+    if (dedup_writes && block_refs[b] > 0) dedup_insert(b);
+
+    // Moving a free block into another group moves a free block's worth of count
+    if ((block_refs[a] == 0) != (block_refs[b] == 0)) {
+        int now_free = (block_refs[a] == 0) ? a : b;
+        int now_used = (now_free == a) ? b : a;
+        block_group* freed = &groups[now_free / BLOCKS_PER_GROUP];
+        block_group* filled = &groups[now_used / BLOCKS_PER_GROUP];
+        if (freed != filled) {
+            freed->free_blocks++;
+            filled->free_blocks--;
+        }
+        if (now_free < freed->first_free) freed->first_free = now_free;
+    }
+    return written;
+}
+
+// Fill target with the blocks in their defragmented order: the files' blocks,
+// then those open writers hold for their new contents. Returns the count.
+static int defrag_target(int* target) {
+    static unsigned char seen[MAX_BLOCKS];
+    memset(seen, 0, sizeof(seen));
+    int count = 0;
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (!inode_table[i].used) continue;
+        for (int j = 0; j < MAX_DIRECT_BLOCKS; j++) {
+            int b = inode_table[i].blocks[j];
+            if (b == 0 || seen[b]) continue;
+            seen[b] = 1;
+            target[count++] = b;
+        }
+    }
+    for (int w = 0; w < MAX_WRITERS; w++) {
+        if (!writers[w].in_use) continue;
+        for (int j = 0; j < writers[w].count; j++) {
+            int b = writers[w].blocks[j];
+            if (seen[b]) continue;
+            seen[b] = 1;
+            target[count++] = b;
+        }
+    }
+    return count;
+}
+
+static int defrag(int budget) {
+    if (disk_fd == -1 || budget <= 0) return -3;
+    if (load_all_inodes() != 0) return -3;
+    drain_all_caches();
+
+    int target[MAX_BLOCKS];
+    int count = defrag_target(target);
+    int moved = 0;
+    for (int i = 0; i < count && moved < budget; i++) {
+        int pos = FIRST_DATA_BLOCK + i;
+        if (target[i] == pos) continue;
+        // A swap costs two writes; stop rather than exceed the budget,
+        // unless that would leave this call without any progress
+        if (block_refs[pos] > 0 && moved > 0 && moved + 2 > budget) break;
+        int written = swap_blocks(pos, target[i]);
+        if (written < 0) return -3;
+        moved += written;
+        // The block that was at pos now lives where target[i] was
+        for (int k = i + 1; k < count; k++) {
+            if (target[k] == pos) {
+                target[k] = target[i];
+                break;
+            }
+        }
+        target[i] = pos;
+    }
+    return moved;
+}
+
+static int do_fs_defrag(int budget) {
+    pthread_rwlock_wrlock(&fs_lock);
+    int result = defrag(budget);
+    pthread_rwlock_unlock(&fs_lock);
+    return result;
+}
+
+int fs_defrag(int budget) {
+    uint64_t start = trace_begin();
+    int result = do_fs_defrag(budget);
+    trace_end(start, FS_OP_DEFRAG, "", NULL, 0, budget, result);
+    return result;
+}
+
+static int fragmentation(fs_frag_report* report) {
+    if (disk_fd == -1 || !report) return -3;
+    if (load_all_inodes() != 0) return -3;
+    drain_all_caches();
+    memset(report, 0, sizeof(*report));
+
+    int file_blocks = 0;
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (!inode_table[i].used || inode_table[i].blocks[0] == 0) continue;
+        const int* blocks = inode_table[i].blocks;
+        int extents = 1;
+        int n = 1;
+        while (n < MAX_DIRECT_BLOCKS && blocks[n] != 0) {
+            if (blocks[n] != blocks[n - 1] + 1) extents++;
+            n++;
+        }
+        report->files++;
+        report->file_extents += extents;
+        if (extents > 1) report->fragmented_files++;
+        file_blocks += n;
+    }
+
+    int run = 0;
+    for (int b = FIRST_DATA_BLOCK; b <= MAX_BLOCKS; b++) {
+        if (b < MAX_BLOCKS && block_refs[b] == 0) {
+            if (run++ == 0) report->free_extents++;
+            continue;
+        }
+        if (run > report->largest_free_extent) report->largest_free_extent = run;
+        run = 0;
+    }
+
+    // Average of the share of file block boundaries that are breaks and the
+    // share of free space outside the largest free extent
+    int file_score = 0, free_score = 0;
+    if (file_blocks > report->files) {
+        file_score = 100 * (report->file_extents - report->files) / (file_blocks - report->files);
+    }
+    if (sb.free_blocks > 0) {
+        free_score = 100 * (sb.free_blocks - report->largest_free_extent) / sb.free_blocks;
+    }
+    report->score = (file_score + free_score) / 2;
+    return report->score;
+}
+
+static int do_fs_fragmentation(fs_frag_report* report) {
+    pthread_rwlock_wrlock(&fs_lock);
+    int result = fragmentation(report);
+    pthread_rwlock_unlock(&fs_lock);
+    return result;
+}
+
+int fs_fragmentation(fs_frag_report* report) {
+    uint64_t start = trace_begin();
+    int result = do_fs_fragmentation(report);
+    trace_end(start, FS_OP_FRAGMENTATION, "", NULL, 0, report == NULL, result);
+    return result;
+}
+
+static int group_stats(fs_group_info* out, int max_groups) {
+    if (disk_fd == -1 || !out || max_groups < 0) return -3;
+    if (load_all_inodes() != 0) return -3;
+    drain_all_caches();
+
+    int count = (max_groups < BLOCK_GROUPS) ? max_groups : BLOCK_GROUPS;
+    for (int g = 0; g < count; g++) {
+        out[g].first_block = (g == 0) ? FIRST_DATA_BLOCK : g * BLOCKS_PER_GROUP;
+        out[g].blocks = (g + 1) * BLOCKS_PER_GROUP - out[g].first_block;
+        out[g].free_blocks = groups[g].free_blocks;
+        out[g].inodes = 0;
+        out[g].free_inodes = 0;
+    }
+    for (int i = 0; i < MAX_FILES; i++) {
+        int g = i % BLOCK_GROUPS;
+        if (g >= count) continue;
+        out[g].inodes++;
+        out[g].free_inodes += !inode_table[i].used;
+    }
+    return count;
+}
+
+static int do_fs_group_stats(fs_group_info* out, int max_groups) {
+    pthread_rwlock_wrlock(&fs_lock);
+    int result = group_stats(out, max_groups);
+    pthread_rwlock_unlock(&fs_lock);
+    return result;
+}
+
+int fs_group_stats(fs_group_info* out, int max_groups) {
+    uint64_t start = trace_begin();
+    int result = do_fs_group_stats(out, max_groups);
+    trace_end(start, FS_OP_GROUP_STATS, "", NULL, max_groups, out == NULL, result);
+    return result;
+}
+
+// Tracing. Every traced entry point brackets its call with trace_begin() and
+// trace_end(). Records are staged in trace_buf and written out with plain
+// write() calls, so a forked child can simply drop the parent's buffer.
+#define TRACE_BUFFER (64 * 1024)
+#define TRACE_NAMES 4096 // longest names blob recorded for one call
+
+static int trace_on = 0; // read without the lock to keep untraced calls cheap
+static int trace_fd = -1;
+static uint64_t trace_epoch;
+static char trace_buf[TRACE_BUFFER];
+static int trace_len = 0;
+static int trace_threads = 0;
+static const struct iovec* trace_views[MAX_VIEWS]; // outstanding views and their numbers
+static int trace_view_ids[MAX_VIEWS];
+static int trace_next_view = 0;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t trace_env_once = PTHREAD_ONCE_INIT;
+static pthread_once_t trace_exit_once = PTHREAD_ONCE_INIT;
+static __thread int trace_thread = -1;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Write out the staged records. Called with trace_lock held.
+static int trace_flush() {
+    int done = 0;
+    while (done < trace_len) {
+        ssize_t n = write(trace_fd, trace_buf + done, trace_len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    int ok = (done == trace_len);
+    trace_len = 0;
+    return ok ? 0 : -1;
+}
+
+static void trace_at_exit() {
+    if (__atomic_load_n(&trace_on, __ATOMIC_ACQUIRE)) fs_trace_stop();
+}
+
+// A forked child doesn't inherit the trace; the parent still owns the file
+static void trace_forget() {
+    __atomic_store_n(&trace_on, 0, __ATOMIC_RELEASE);
+    if (trace_fd != -1) close(trace_fd);
+    trace_fd = -1;
+    trace_len = 0;
+}
+
+static void trace_register() {
+    atexit(trace_at_exit);
+    pthread_atfork(NULL, NULL, trace_forget);
+}
+
+static void trace_env_start() {
+    const char* path = getenv("FS_TRACE");
+    if (path && *path) fs_trace_start(path);
+}
+
+// Start the trace named by FS_TRACE, once per process
+static void trace_from_env() {
+    pthread_once(&trace_env_once, trace_env_start);
+}
+
+// Start time of a traced call, or 0 when not tracing
+static uint64_t trace_begin() {
+    if (!__atomic_load_n(&trace_on, __ATOMIC_ACQUIRE)) return 0;
+    return now_ns();
+}
+
+// Append a record with its names blob. Called with trace_lock held.
+static void trace_append(uint64_t start, int op, const char* names, int name_len, int size, int arg, int result) {
+    if (trace_fd == -1 || start < trace_epoch) return;
+    if (trace_thread == -1) trace_thread = trace_threads < 255 ? trace_threads++ : 255;
+    uint64_t latency = now_ns() - start;
+    fs_trace_record rec = {
+        .op = op, .thread = trace_thread, .name_len = name_len,
+        .size = size, .arg = arg, .result = result,
+        .start_ns = start - trace_epoch,
+        .latency_ns = latency > UINT32_MAX ? UINT32_MAX : latency,
+    };
+    int bytes = (name_len == FS_TRACE_NULL_NAME) ? 0 : name_len;
+    if (trace_len + sizeof(rec) + bytes > TRACE_BUFFER) trace_flush();
+    memcpy(trace_buf + trace_len, &rec, sizeof(rec));
+    memcpy(trace_buf + trace_len + sizeof(rec), names, bytes);
+    trace_len += sizeof(rec) + bytes;
+}
+
+// Record a call that returned; name2 (if any) follows name after a zero byte.
+// Calls that take no name pass "", so a NULL name is one the caller passed.
+static void trace_end(uint64_t start, int op, const char* name, const char* name2, int size, int arg, int result) {
+    if (!start) return;
+    char names[TRACE_NAMES];
+    int len = 0;
+    if (name) {
+        len = strnlen(name, TRACE_NAMES / 2 - 1);
+        memcpy(names, name, len);
+    } else if (!name2) {
+        len = FS_TRACE_NULL_NAME;
+    }
+    if (name2) {
+        names[len++] = '\0';
+        int len2 = strnlen(name2, TRACE_NAMES / 2 - 1);
+        memcpy(names + len, name2, len2);
+        len += len2;
+    }
+    pthread_mutex_lock(&trace_lock);
+    trace_append(start, op, names, len, size, arg, result);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+// Record a call that took a list of names (NULL entries are recorded empty)
+static void trace_end_many(uint64_t start, int op, const char* const* names, int count, int result) {
+    char blob[TRACE_NAMES];
+    int len = 0;
+    for (int i = 0; names && i < count && len + MAX_FILENAME + 1 <= TRACE_NAMES; i++) {
+        if (i > 0) blob[len++] = '\0';
+        if (names[i]) {
+            int n = strnlen(names[i], MAX_FILENAME);
+            memcpy(blob + len, names[i], n);
+            len += n;
+        }
+    }
+    pthread_mutex_lock(&trace_lock);
+    trace_append(start, op, blob, len, count, 0, result);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+// Number a view as it is handed out (opening), or look up and forget the
+// number of one being released. -1 for no view.
+static int trace_view(const struct iovec* iov, int opening) {
+    if (!iov) return -1;
+    int id = -1;
+    pthread_mutex_lock(&trace_lock);
+    for (int v = 0; v < MAX_VIEWS && !opening; v++) {
+        if (trace_views[v] != iov) continue;
+        trace_views[v] = NULL;
+        id = trace_view_ids[v];
+        break;
+    }
+    if (opening) {
+        // A view dropped by unmount without a release may have left this pointer behind
+        for (int v = 0; v < MAX_VIEWS; v++) {
+            if (trace_views[v] == iov) trace_views[v] = NULL;
+        }
+        id = trace_next_view++;
+        int v = 0;
+        while (v < MAX_VIEWS && trace_views[v]) v++;
+        if (v == MAX_VIEWS) v = id % MAX_VIEWS;
+        trace_views[v] = iov;
+        trace_view_ids[v] = id;
+    }
+    pthread_mutex_unlock(&trace_lock);
+    return id;
+}
+
+int fs_trace_start(const char* path) {
+    if (!path) return -3;
+    pthread_once(&trace_exit_once, trace_register);
+    pthread_mutex_lock(&trace_lock);
+    int result = 0;
+    if (trace_fd != -1) {
+        result = -2;
+    } else if ((trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        trace_fd = -1;
+        result = -3;
+    } else {
+        fs_trace_header header = {
+            .magic = FS_TRACE_MAGIC, .version = FS_TRACE_VERSION,
+            .max_blocks = MAX_BLOCKS, .block_size = BLOCK_SIZE, .max_files = MAX_FILES,
+        };
+        memcpy(trace_buf, &header, sizeof(header));
+        trace_len = sizeof(header);
+        memset(trace_views, 0, sizeof(trace_views));
+        trace_next_view = 0;
+        trace_epoch = now_ns();
+        __atomic_store_n(&trace_on, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&trace_lock);
+    return result;
+}
+
+int fs_trace_stop() {
+    pthread_mutex_lock(&trace_lock);
+    int result = -1;
+    if (trace_fd != -1) {
+        __atomic_store_n(&trace_on, 0, __ATOMIC_RELEASE);
+        result = trace_flush();
+        if (close(trace_fd) != 0) result = -1;
+        trace_fd = -1;
+        if (result != 0) result = -3;
+    }
+    pthread_mutex_unlock(&trace_lock);
+    return result;
+}
@@ -10,6 +10,11 @@
  * The filesystem is designed to be contained within a single disk image file,
  * with a fixed layout of metadata and data blocks.
  *
+ * All functions may be called from several threads at once. Operations on
+ * different files run in parallel; creating, deleting, renaming, cloning or
+ * listing files, defragmenting and mounting take the whole filesystem for
+ * their duration.
+ *
  * DO NOT MODIFY THIS HEADER FILE FOR YOUR IMPLEMENTATION.
  */
 
@@ -17,10 +22,16 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <sys/uio.h>
 
 #ifndef FS_H
 #define FS_H
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * @brief Maximum length of a filename (excluding null terminator)
  * 
@@ -29,13 +40,27 @@
  */
 #define MAX_FILENAME 28
 
+/**
+ * @brief Disk geometry
+ *
+ * MAX_FILES, MAX_BLOCKS, BLOCK_SIZE, MAX_DIRECT_BLOCKS and BLOCKS_PER_GROUP
+ * may be defined on the compiler command line (e.g. -DMAX_BLOCKS=1280) to
+ * build the filesystem for another geometry. Every table and loop bound is
+ * sized from them at compile time, and fs.c checks the combination with
+ * static assertions. fs.c and everything that includes this header must be
+ * built with the same definitions; fs_mount refuses images formatted for a
+ * different geometry. The values below are the default geometry.
+ */
+
 /**
  * @brief Maximum number of files supported by the filesystem
  * 
  * The filesystem can hold up to 256 files simultaneously. This value
  * determines the size of the inode table.
  */
+#ifndef MAX_FILES
 #define MAX_FILES 256
+#endif
 
 /**
  * @brief Total number of blocks in the filesystem
@@ -43,7 +68,9 @@
  * The filesystem contains 2560 blocks in total. With a block size of 4KB,
  * this gives a total virtual disk size of 10MB (2560 * 4096 = 10,485,760 bytes).
  */
+#ifndef MAX_BLOCKS
 #define MAX_BLOCKS 2560
+#endif
 
 /**
  * @brief Size of each block in bytes
@@ -51,7 +78,9 @@
  * Each block is 4KB (4096 bytes) in size. This value affects file I/O operations
  * and determines the granularity of storage allocation.
  */
+#ifndef BLOCK_SIZE
 #define BLOCK_SIZE 4096
+#endif
 
 /**
  * @brief Maximum number of direct block pointers per file
@@ -59,7 +88,46 @@
  * Each file can reference up to 12 direct blocks, which means the maximum
  * file size is 12 * 4KB = 48KB. This filesystem does not support indirect blocks.
  */
+#ifndef MAX_DIRECT_BLOCKS
 #define MAX_DIRECT_BLOCKS 12
+#endif
+
+/**
+ * @brief On-disk layout (block numbers for the default geometry)
+ *
+ * - Block 0: Superblock
+ * - Block 1: Block reference counts (one byte per block, 0 = free)
+ * - Blocks 2-9: Inode table
+ * - Blocks 10-12: Checksum table (one CRC32C per block, indexed by block number)
+ * - Blocks 13-2559: Data blocks
+ *
+ * The inode table reserves 128 bytes per inode and the checksum table 4
+ * bytes per block, each rounded up to whole blocks; the regions follow one
+ * another, so their positions follow from the geometry.
+ *
+ * FS_LAYOUT_VERSION is stored in the superblock and bumped whenever this
+ * layout or the on-disk structures change; fs_mount refuses other versions.
+ *
+ * For allocation the disk is divided into BLOCK_GROUPS groups of
+ * BLOCKS_PER_GROUP blocks (the first group also holds the metadata). Each
+ * group has its own slice of the reference counts, free count and lock.
+ * Inode i belongs to group i % BLOCK_GROUPS, so consecutive new files land
+ * in different groups; a file's blocks come from its inode's group while it
+ * has free blocks, and writers in different groups don't contend. Each
+ * thread also keeps a few free blocks per group that it took in one batch,
+ * so most allocations take no shared lock; they go back to their group
+ * when the thread exits, at unmount, or when another thread runs out.
+ */
+#define FS_LAYOUT_VERSION 5
+#define INODE_TABLE_START 2
+#define INODE_TABLE_BLOCKS ((MAX_FILES * 128 + BLOCK_SIZE - 1) / BLOCK_SIZE)
+#define CRC_TABLE_START (INODE_TABLE_START + INODE_TABLE_BLOCKS)
+#define CRC_TABLE_BLOCKS ((MAX_BLOCKS * 4 + BLOCK_SIZE - 1) / BLOCK_SIZE)
+#define FIRST_DATA_BLOCK (CRC_TABLE_START + CRC_TABLE_BLOCKS)
+#ifndef BLOCKS_PER_GROUP
+#define BLOCKS_PER_GROUP 640
+#endif
+#define BLOCK_GROUPS (MAX_BLOCKS / BLOCKS_PER_GROUP)
 
 /**
  * @brief Superblock structure containing filesystem metadata
@@ -74,6 +142,8 @@ typedef struct {
     int free_blocks;   /**< Number of blocks currently available for allocation */
     int total_inodes;  /**< Total number of inodes/files the filesystem can hold (256) */
     int free_inodes;   /**< Number of inodes currently available for allocation */
+    int version;       /**< On-disk layout version (FS_LAYOUT_VERSION) */
+    int direct_blocks; /**< Block pointers per inode (MAX_DIRECT_BLOCKS) */
 } superblock;
 
 /**
@@ -86,21 +156,172 @@ typedef struct {
 typedef struct {
     int used;                          /**< Flag indicating if this inode is in use (1) or free (0) */
     char name[MAX_FILENAME];           /**< Name of the file (up to 28 characters + null terminator) */
-    int size;                          /**< Size of the file in bytes */
+    int size;                          /**< Size of the file in bytes (uncompressed) */
     int blocks[MAX_DIRECT_BLOCKS];     /**< Array of block indices containing file data */
+    int flags;                         /**< INODE_FLAG_* bits */
+    int stored_size;                   /**< Bytes stored in the data blocks (differs from size when compressed) */
+    unsigned int mod_count;            /**< Number of times the file's contents have been changed */
 } inode;
 
+/**
+ * @brief Inode flag: compress the file's contents on write
+ */
+#define INODE_FLAG_COMPRESS 0x1
+
+/**
+ * @brief Inode flag: the data blocks currently hold compressed contents
+ *
+ * Set by fs_write when compression saved at least one block; the blocks then
+ * hold stored_size bytes of compressed data that expand to size bytes.
+ */
+#define INODE_FLAG_COMPRESSED 0x2
+
+/**
+ * @brief Runtime statistics collected by the filesystem
+ *
+ * Counters accumulate from the moment the filesystem is mounted (or since the
+ * last call to fs_reset_stats()). Readahead hit rate is
+ * readahead_hits / readahead_blocks.
+ */
+typedef struct {
+    unsigned long cache_hits;        /**< Block reads served from the block cache */
+    unsigned long cache_misses;      /**< Block reads that had to go to the disk image */
+    unsigned long disk_reads;        /**< Read system calls issued against the disk image */
+    unsigned long readahead_blocks;  /**< Blocks prefetched ahead of the reader */
+    unsigned long readahead_hits;    /**< Prefetched blocks that a later read consumed */
+    unsigned long checksum_errors;   /**< Blocks whose CRC32C did not match on read */
+    unsigned long compress_blocks_saved; /**< Blocks saved by compressing written files */
+    unsigned long dedup_blocks_shared;   /**< Written blocks stored by referencing an identical existing block */
+    unsigned long discard_calls;     /**< fallocate calls issued to punch holes for freed blocks */
+    unsigned long discarded_blocks;  /**< Freed blocks whose space was returned to the host */
+    unsigned long inode_chunks_loaded; /**< Inode table chunks read by a lazy mount */
+    unsigned long alloc_cache_refills; /**< Batches of free blocks a thread's allocation cache took from a group */
+    int free_blocks;                 /**< Data blocks currently free */
+    int direct_io;                   /**< 1 if the disk image is open with O_DIRECT */
+} fs_stats;
+
+/**
+ * @brief Fragmentation report produced by fs_fragmentation()
+ *
+ * The score averages two percentages: the share of boundaries between a
+ * file's consecutive blocks that are not contiguous on disk, and the share of
+ * free blocks outside the largest free extent. 0 means every file is
+ * contiguous and the free space is a single extent; 100 means nothing is.
+ */
+typedef struct {
+    int files;               /**< Files holding at least one data block */
+    int fragmented_files;    /**< Files whose blocks are not one contiguous run */
+    int file_extents;        /**< Contiguous runs of blocks over all files */
+    int free_extents;        /**< Contiguous runs of free data blocks */
+    int largest_free_extent; /**< Longest run of free data blocks */
+    int score;               /**< Fragmentation score from 0 to 100 */
+} fs_frag_report;
+
+/**
+ * @brief File metadata returned by fs_stat() and fs_stat_many()
+ */
+typedef struct {
+    int inode;               /**< Inode number, or -1 for a name fs_stat_many() didn't find */
+    int size;                /**< File size in bytes */
+    int blocks;              /**< Data blocks holding the file (fewer than size needs when compressed) */
+    int flags;               /**< INODE_FLAG_* bits */
+    unsigned int mod_count;  /**< Incremented by every change to the file's contents */
+} fs_file_stat;
+
+/**
+ * @brief Per-group usage returned by fs_group_stats()
+ */
+typedef struct {
+    int first_block;         /**< First block of the group */
+    int blocks;              /**< Data blocks in the group */
+    int free_blocks;         /**< Data blocks in the group that are free */
+    int inodes;              /**< Inodes belonging to the group */
+    int free_inodes;         /**< Inodes belonging to the group that are free */
+} fs_group_info;
+
+/**
+ * @brief A directory entry returned by fs_list_next()
+ */
+typedef struct {
+    char name[MAX_FILENAME];  /**< File name (null-terminated) */
+    int size;                 /**< File size in bytes */
+} fs_dirent;
+
+/**
+ * @brief Mount option: open the disk image with O_DIRECT
+ *
+ * Bypasses the host page cache so file data is only cached once, in the
+ * filesystem's own block cache. All transfers are staged through block-aligned
+ * buffers, or go straight to the caller's buffer when it is already aligned.
+ * On host filesystems without O_DIRECT support the mount falls back to
+ * buffered I/O; fs_stats.direct_io reports which mode is active.
+ */
+#define FS_MOUNT_DIRECT 0x1
+
+/**
+ * @brief Mount option: skip checksum verification on read
+ *
+ * Checksums are still maintained on write, so the image stays verifiable.
+ */
+#define FS_MOUNT_NO_VERIFY 0x2
+
+/**
+ * @brief Mount option: deduplicate written blocks
+ *
+ * Each block fs_write stores is fingerprinted and looked up among the blocks
+ * already on disk; an identical block is shared (its reference count goes up)
+ * instead of taking a new one. Shared blocks are never modified in place, and
+ * are freed when their last reference is dropped by fs_delete or an overwrite.
+ * Sharing persists on disk, so images written in dedup mode can be mounted
+ * without it.
+ */
+#define FS_MOUNT_DEDUP 0x4
+
+/**
+ * @brief Mount option: return freed blocks' space to the host filesystem
+ *
+ * Blocks freed by fs_delete, fs_write or fs_defrag are queued and their
+ * ranges punched out of the image with fallocate(FALLOC_FL_PUNCH_HOLE),
+ * merging adjacent blocks into one call; the queue is flushed once it holds
+ * a batch of blocks and at fs_unmount. Since fs_format creates the image
+ * sparse, the image's host disk usage then tracks the live data. Ignored on
+ * host filesystems that can't punch holes.
+ */
+#define FS_MOUNT_DISCARD 0x8
+
+/**
+ * @brief Mount option: load the inode table lazily
+ *
+ * The mount reads only the superblock, reference counts and checksum table.
+ * The inode table is read in chunks of 32 inodes as lookups reach them, so
+ * opening a file needs only the chunks up to its inode. Listing, creating
+ * files and defragmenting load the rest.
+ */
+#define FS_MOUNT_LAZY 0x10
+
+/**
+ * @brief Mount option: with FS_MOUNT_LAZY, load the rest of the inode table
+ * in a background thread
+ *
+ * Operations never wait for the thread; chunks they need are loaded on the
+ * spot if the thread hasn't reached them yet.
+ */
+#define FS_MOUNT_PREFETCH 0x20
+
 /**
  * @brief Creates and formats a new filesystem
  * 
- * This function creates a new disk image file and initializes the filesystem
- * structures within it (superblock, block bitmap, and inode table).
+ * This function creates a new sparse disk image file (data blocks take no
+ * host disk space until written) and initializes the filesystem
+ * structures within it (superblock, block reference counts, inode table
+ * and checksum table).
  * 
  * Disk layout:
  * - Block 0: Superblock (4KB)
- * - Block 1: Block bitmap (4KB)
- * - Blocks 2-9: Inode table (32KB = 256 inodes × 128B)
- * - Blocks 10-2559: Data blocks (~9.96MB)
+ * - Block 1: Block reference counts (4KB)
+ * - Blocks 2-9: Inode table (32KB, 256 inodes × 96B used)
+ * - Blocks 10-12: Checksum table (12KB)
+ * - Blocks 13-2559: Data blocks (~9.95MB)
  * 
  * @param disk_path Path where the disk image file will be created
  * @return 0 on success, -1 on error (e.g., cannot create file)
@@ -119,6 +340,17 @@ int fs_format(const char* disk_path);
  */
 int fs_mount(const char* disk_path);
 
+/**
+ * @brief Mounts an existing filesystem with mount options
+ * 
+ * Same as fs_mount(), with a bitwise OR of FS_MOUNT_* options.
+ * 
+ * @param disk_path Path to the disk image file to mount
+ * @param options Bitwise OR of FS_MOUNT_* flags (0 for defaults)
+ * @return 0 on success, -1 on error (e.g., file not found or invalid filesystem)
+ */
+int fs_mount_opts(const char* disk_path, int options);
+
 /**
  * @brief Unmounts the filesystem
  * 
@@ -162,6 +394,38 @@ int fs_delete(const char* filename);
  */
 int fs_list(char filenames[][MAX_FILENAME], int max_files);
 
+/**
+ * @brief Starts a listing of the files whose names begin with a prefix
+ * 
+ * Files are listed in name order from a sorted name index, so listing the k
+ * files that match a prefix costs O(log n + k). Files created or deleted
+ * while a listing is in progress never cause a name to be skipped or
+ * repeated; names created behind the cursor are not returned. Cursors are
+ * closed by fs_unmount().
+ * 
+ * @param prefix Name prefix to match (NULL or "" for all files)
+ * @return Cursor handle (>= 0) on success, -2 if too many cursors are open, -3 for other errors
+ */
+int fs_list_begin(const char* prefix);
+
+/**
+ * @brief Returns the next batch of entries from a listing
+ * 
+ * @param cursor Cursor returned by fs_list_begin()
+ * @param entries Pre-allocated array to receive the entries
+ * @param max_entries Maximum number of entries to return
+ * @return Number of entries returned (0 when the listing is complete), -1 if cursor is not open, -3 for other errors
+ */
+int fs_list_next(int cursor, fs_dirent* entries, int max_entries);
+
+/**
+ * @brief Closes a listing cursor
+ * 
+ * @param cursor Cursor returned by fs_list_begin()
+ * @return 0 on success, -1 if cursor is not open
+ */
+int fs_list_end(int cursor);
+
 /**
  * @brief Writes data to a file
  * 
@@ -176,17 +440,415 @@ int fs_list(char filenames[][MAX_FILENAME], int max_files);
  */
 int fs_write(const char* filename, const void* data, int size);
 
+/**
+ * @brief Appends data to the end of a file
+ * 
+ * Copies the file's last partial block into a new block together with the
+ * start of the data and allocates blocks only for the rest. The existing
+ * blocks are never modified, so blocks shared with another file (through
+ * fs_clone() or dedup) stay intact and a failed append leaves the file as
+ * it was. A file stored compressed is rewritten whole.
+ * 
+ * @param filename Name of the file to append to
+ * @param data Pointer to the data to append
+ * @param size Number of bytes to append
+ * @return 0 on success, -1 if file not found, -2 if out of space, -3 if the file would exceed the maximum size or for other errors
+ */
+int fs_append(const char* filename, const void* data, int size);
+
+/**
+ * @brief Changes the size of a file
+ * 
+ * Shrinking releases only the blocks past the new end; growing appends
+ * zero bytes as fs_append() would. A file stored compressed is rewritten
+ * whole, except when truncated to 0.
+ * 
+ * @param filename Name of the file to resize
+ * @param new_size New size in bytes, from 0 to the maximum file size
+ * @return 0 on success, -1 if file not found, -2 if out of space, -3 for other errors
+ */
+int fs_truncate(const char* filename, int new_size);
+
+/**
+ * @brief Opens a streaming writer that replaces a file's contents
+ * 
+ * The new contents are passed in pieces with fs_writer_write() and replace
+ * the file's current contents when fs_writer_commit() is called. Blocks are
+ * allocated and written as they fill, so only the block being filled is
+ * buffered. Until the commit, readers see the old contents. Streamed files
+ * are stored uncompressed. Writers still open at fs_unmount() are aborted.
+ * 
+ * @param filename Name of the file to write (must exist)
+ * @return Writer handle (>= 0) on success, -1 if file not found, -2 if too many writers are open, -3 for other errors
+ */
+int fs_writer_open(const char* filename);
+
+/**
+ * @brief Adds data to the end of a writer's new contents
+ * 
+ * Calls on one writer from several threads take turns, each adding its
+ * data whole. After an error other than -1 the writer should be aborted.
+ * 
+ * @param writer Handle returned by fs_writer_open()
+ * @param data Pointer to the data
+ * @param size Number of bytes to add
+ * @return 0 on success, -1 if writer is not open, -2 if out of space, -3 if the file would exceed the maximum size or for other errors
+ */
+int fs_writer_write(int writer, const void* data, int size);
+
+/**
+ * @brief Publishes a writer's contents as the file's contents and closes it
+ * 
+ * The file's old blocks are released and the size and contents change in
+ * one step. If the file was deleted while the writer was open, the new
+ * contents are discarded and the writer is closed. On -2 the writer stays
+ * open and can be committed again or aborted.
+ * 
+ * @param writer Handle returned by fs_writer_open()
+ * @return 0 on success, -1 if writer is not open or the file was deleted, -2 if out of space, -3 for other errors
+ */
+int fs_writer_commit(int writer);
+
+/**
+ * @brief Discards a writer's contents and closes it
+ * 
+ * The file keeps its old contents and the writer's blocks are freed.
+ * 
+ * @param writer Handle returned by fs_writer_open()
+ * @return 0 on success, -1 if writer is not open, -3 for other errors
+ */
+int fs_writer_abort(int writer);
+
 /**
  * @brief Reads data from a file
  * 
  * Reads up to 'size' bytes from the specified file into the provided buffer.
  * If the file is smaller than the requested size, only the available data is read.
+ * Every block read from disk is verified against its CRC32C checksum.
  * 
  * @param filename Name of the file to read from
  * @param buffer Pre-allocated buffer to receive the data
  * @param size Size of the buffer in bytes
- * @return Number of bytes read on success, -1 if file not found, -3 for other errors
+ * @return Number of bytes read on success, -1 if file not found, -3 for other errors (including a checksum mismatch)
  */
 int fs_read(const char* filename, void* buffer, int size);
 
+/**
+ * @brief Reads data from a file starting at a byte offset
+ * 
+ * Reads up to 'size' bytes starting at 'offset' into the provided buffer.
+ * Reads that continue where the previous read of the same file stopped are
+ * treated as sequential, and the following blocks are prefetched into the
+ * block cache with a window that grows while the access stays sequential.
+ * 
+ * @param filename Name of the file to read from
+ * @param buffer Pre-allocated buffer to receive the data
+ * @param size Size of the buffer in bytes
+ * @param offset Byte offset in the file to start reading from
+ * @return Number of bytes read on success (0 at or past end of file), -1 if file not found, -3 for other errors
+ */
+int fs_read_at(const char* filename, void* buffer, int size, int offset);
+
+/**
+ * @brief Retrieves a file's metadata
+ * 
+ * Served entirely from the in-memory inode table; no data blocks are read.
+ * 
+ * @param filename Name of the file
+ * @param st Structure to receive the metadata
+ * @return 0 on success, -1 if file not found, -3 for other errors
+ */
+int fs_stat(const char* filename, fs_file_stat* st);
+
+/**
+ * @brief Retrieves the metadata of many files in one call
+ * 
+ * Fills st[i] for each filenames[i]; names that don't exist (or are
+ * invalid) get an entry with inode set to -1.
+ * 
+ * @param filenames Array of count file names
+ * @param count Number of names
+ * @param st Array of count structures to receive the metadata
+ * @return Number of files found, or -3 for errors
+ */
+int fs_stat_many(const char* const* filenames, int count, fs_file_stat* st);
+
+/**
+ * @brief Callback receiving file data from fs_read_stream()
+ * 
+ * @param ctx The ctx pointer passed to fs_read_stream()
+ * @param data The next piece of the file; valid only until the callback returns
+ * @param len Number of bytes in data
+ * @return 0 to continue, anything else to stop reading
+ */
+typedef int (*fs_read_callback)(void* ctx, const void* data, int len);
+
+/**
+ * @brief Reads a file through a callback, one block at a time
+ * 
+ * Hands the file's contents to callback in order, a block at a time,
+ * straight from the block cache, so the caller needs no buffer for the
+ * whole file. While the callback works on one run of blocks the host is
+ * already reading the next. A compressed file is decompressed first and
+ * then handed over a block at a time in the same way. The callback must not
+ * modify the file.
+ * 
+ * @param filename Name of the file to read
+ * @param callback Function called for each piece of the file
+ * @param ctx Passed through to callback
+ * @return Number of bytes handed to callback (fewer than the file size if it stopped early), -1 if file not found, -3 for other errors
+ */
+int fs_read_stream(const char* filename, fs_read_callback callback, void* ctx);
+
+/**
+ * @brief Returns a zero-copy view of a file's contents
+ * 
+ * Fills *iov with an array of *count iovecs that point directly into the
+ * block cache; no data is copied. The underlying blocks stay pinned in memory
+ * until fs_release_view() is called. A view is a snapshot: later writes,
+ * deletes or renames of the file do not change the bytes it exposes. Views
+ * are invalidated by fs_unmount(). The iovec array is owned by the
+ * filesystem and must not be modified. Compressed files cannot be viewed
+ * without copying and are rejected.
+ * 
+ * @param filename Name of the file to view
+ * @param iov Receives a pointer to the view's iovec array
+ * @param count Receives the number of iovecs (0 for an empty file)
+ * @return File size in bytes on success, -1 if file not found, -2 if too many views or pinned blocks are outstanding, -3 for other errors
+ */
+int fs_read_view(const char* filename, struct iovec** iov, int* count);
+
+/**
+ * @brief Releases a view obtained from fs_read_view()
+ * 
+ * @param iov The iovec array returned by fs_read_view()
+ * @return 0 on success, -1 if iov is not an outstanding view, -3 for other errors
+ */
+int fs_release_view(struct iovec* iov);
+
+/**
+ * @brief Sends file contents to another file descriptor without a user-space copy
+ * 
+ * Transfers up to 'len' bytes starting at 'offset' from the file to out_fd
+ * (typically a socket or pipe) using sendfile(2) straight from the disk
+ * image. Blocks that are consecutive on disk are sent in a single call.
+ * If the kernel cannot transfer from the image (e.g. an O_DIRECT mount),
+ * the data is copied through the block cache instead. Data that never
+ * passes through user space is not checksum-verified.
+ * 
+ * @param filename Name of the file to send
+ * @param out_fd Destination file descriptor
+ * @param offset Byte offset in the file to start from
+ * @param len Maximum number of bytes to send
+ * @return Number of bytes sent (0 at or past end of file), -1 if file not found, -3 for other errors
+ */
+int fs_sendfile(const char* filename, int out_fd, int offset, int len);
+
+/**
+ * @brief Creates a copy-on-write clone of a file
+ * 
+ * Creates dst as a copy of src that shares all of src's data blocks; only
+ * metadata is updated and no file data is read or written. A later write to
+ * either file stores its new contents in fresh blocks, leaving the other copy
+ * unchanged. The clone inherits src's compression setting.
+ * 
+ * @param src Name of the file to clone
+ * @param dst Name of the new file (must not exist)
+ * @return 0 on success, -1 if src not found or dst already exists, -2 if no free inodes or a block is shared too many times, -3 for other errors
+ */
+int fs_clone(const char* src, const char* dst);
+
+/** fs_rename() flag: replace new_name if it already exists */
+#define FS_RENAME_REPLACE 0x1
+
+/**
+ * @brief Renames a file
+ * 
+ * Only the name in the file's inode changes; no file data is read or
+ * written and the file's modification counter is left alone. With
+ * FS_RENAME_REPLACE an existing new_name is deleted in the same call, so no
+ * caller ever sees both names or neither. Renaming a file to its own name
+ * does nothing and succeeds.
+ * 
+ * @param old_name Current name of the file
+ * @param new_name New name for the file
+ * @param flags 0 or FS_RENAME_REPLACE
+ * @return 0 on success, -1 if old_name not found, -2 if new_name exists and FS_RENAME_REPLACE is not set, -3 for other errors
+ */
+int fs_rename(const char* old_name, const char* new_name, int flags);
+
+/**
+ * @brief Enables or disables compression for a file
+ * 
+ * When enabled, each fs_write compresses the data with a fast LZ4-style
+ * codec and stores the compressed form if it takes fewer blocks; reads
+ * decompress transparently. The setting takes effect on the next write.
+ * 
+ * @param filename Name of the file
+ * @param enable Non-zero to compress future writes, 0 to store them raw
+ * @return 0 on success, -1 if file not found, -3 for other errors
+ */
+int fs_set_compression(const char* filename, int enable);
+
+/**
+ * @brief Defragments the filesystem in a bounded step
+ * 
+ * Relocates up to 'budget' blocks towards a layout where every file is
+ * contiguous, files follow each other in inode order from the start of the
+ * data area, and the free space is a single extent at the end. Progress is
+ * kept between calls, so calling this repeatedly with a small budget
+ * interleaves defragmentation with other operations. Blocks shared by
+ * several files are placed with the first one. Outstanding read views keep
+ * the contents they were created with.
+ * 
+ * @param budget Maximum number of blocks to write in this step (a budget of 1 may write 2 when two blocks must swap places)
+ * @return Number of blocks relocated (0 once the layout is fully defragmented), -3 for errors
+ */
+int fs_defrag(int budget);
+
+/**
+ * @brief Measures file and free-space fragmentation
+ * 
+ * @param report Structure to receive the report
+ * @return The fragmentation score (0-100), or -3 if not mounted
+ */
+int fs_fragmentation(fs_frag_report* report);
+
+/**
+ * @brief Reports the usage of each block group
+ * 
+ * @param groups Array receiving one entry per group
+ * @param max_groups Capacity of the groups array
+ * @return Number of entries filled (at most BLOCK_GROUPS), -3 if not mounted or for other errors
+ */
+int fs_group_stats(fs_group_info* groups, int max_groups);
+
+/**
+ * @brief Computes a CRC32C (Castagnoli) checksum
+ * 
+ * Uses the SSE4.2 or ARMv8 CRC32 instructions when available and a
+ * table-driven implementation otherwise. Pass 0 as the initial crc; pass a
+ * previous result to continue a checksum over more data.
+ * 
+ * @param crc Running checksum (0 to start)
+ * @param data Data to checksum
+ * @param len Number of bytes
+ * @return Updated checksum
+ */
+unsigned int fs_crc32c(unsigned int crc, const void* data, size_t len);
+
+/**
+ * @brief Retrieves the filesystem's runtime statistics
+ * 
+ * @param stats Structure to receive a snapshot of the counters
+ */
+void fs_get_stats(fs_stats* stats);
+
+/**
+ * @brief Resets all runtime statistics counters to zero
+ */
+void fs_reset_stats();
+
+/**
+ * @brief Operations recorded in a trace, one per traced function
+ *
+ * fs_mount and fs_read are recorded as the fs_mount_opts and fs_read_at
+ * calls they make. fs_crc32c and the statistics functions are not traced.
+ */
+enum {
+    FS_OP_FORMAT = 1,
+    FS_OP_MOUNT,         /**< arg: options */
+    FS_OP_UNMOUNT,
+    FS_OP_CREATE,
+    FS_OP_DELETE,
+    FS_OP_LIST,          /**< size: max_files */
+    FS_OP_LIST_BEGIN,
+    FS_OP_LIST_NEXT,     /**< arg: cursor, size: max_entries */
+    FS_OP_LIST_END,      /**< arg: cursor */
+    FS_OP_WRITE,         /**< size: bytes */
+    FS_OP_APPEND,        /**< size: bytes */
+    FS_OP_TRUNCATE,      /**< size: new size */
+    FS_OP_WRITER_OPEN,
+    FS_OP_WRITER_WRITE,  /**< arg: writer, size: bytes */
+    FS_OP_WRITER_COMMIT, /**< arg: writer */
+    FS_OP_WRITER_ABORT,  /**< arg: writer */
+    FS_OP_READ_AT,       /**< size: bytes, arg: offset */
+    FS_OP_STAT,
+    FS_OP_STAT_MANY,     /**< size: count; the names follow one another */
+    FS_OP_READ_STREAM,   /**< arg: 1 for a NULL callback */
+    FS_OP_READ_VIEW,     /**< arg: view number within the trace */
+    FS_OP_RELEASE_VIEW,  /**< arg: view number, or -1 for a pointer that was never a view */
+    FS_OP_SENDFILE,      /**< size: len, arg: offset */
+    FS_OP_CLONE,         /**< names: src, dst */
+    FS_OP_RENAME,        /**< names: old, new; arg: flags */
+    FS_OP_SET_COMPRESSION, /**< arg: enable */
+    FS_OP_DEFRAG,        /**< arg: budget */
+    FS_OP_FRAGMENTATION, /**< arg: 1 for a NULL report */
+    FS_OP_GROUP_STATS,   /**< size: max_groups, arg: 1 for a NULL array */
+    FS_OP_COUNT
+};
+
+/**
+ * @brief Trace file header
+ *
+ * A trace is this header followed by records. The geometry is the one the
+ * recording build was compiled with.
+ */
+typedef struct {
+    char magic[4];           /**< "FSTR" */
+    uint32_t version;        /**< FS_TRACE_VERSION */
+    int32_t max_blocks;      /**< MAX_BLOCKS */
+    int32_t block_size;      /**< BLOCK_SIZE */
+    int32_t max_files;       /**< MAX_FILES */
+} fs_trace_header;
+
+/**
+ * @brief One traced call, followed in the file by name_len bytes of names
+ *
+ * Names (the disk path for format and mount) are stored without
+ * terminators, separated by a single zero byte where an operation has
+ * several. A NULL
+ * name is recorded as name_len FS_TRACE_NULL_NAME with no bytes following.
+ * Records appear in the order the calls returned.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t op;              /**< FS_OP_* */
+    uint8_t thread;          /**< Small per-process number of the calling thread */
+    uint16_t name_len;       /**< Bytes of names following the record */
+    int32_t size;            /**< Operation-specific size (see FS_OP_*) */
+    int32_t arg;             /**< Operation-specific argument (see FS_OP_*) */
+    int32_t result;          /**< Return value (0 for void functions) */
+    uint64_t start_ns;       /**< Call start, in ns since the trace began */
+    uint32_t latency_ns;     /**< Time spent in the call, saturated */
+} fs_trace_record;
+
+#define FS_TRACE_MAGIC "FSTR"
+#define FS_TRACE_VERSION 1
+#define FS_TRACE_NULL_NAME 0xffff
+
+/**
+ * @brief Starts recording every call made to this API into a trace file
+ *
+ * Records are buffered and written under a lock of their own, so tracing
+ * does not serialize operations on different files. Setting the FS_TRACE
+ * environment variable to a path starts a trace at the first fs_format or
+ * fs_mount call of the process. Traces in progress are completed at exit.
+ * Replay one with the fs_replay tool.
+ *
+ * @param path File to write the trace to (created or truncated)
+ * @return 0 on success, -2 if a trace is already being recorded, -3 if the file could not be created
+ */
+int fs_trace_start(const char* path);
+
+/**
+ * @brief Stops recording and completes the trace file
+ *
+ * @return 0 on success, -1 if no trace is being recorded, -3 if the file could not be written
+ */
+int fs_trace_stop();
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* FS_H */
@@ -0,0 +1,434 @@
+/**
+ * @file fs.hpp
+ * @brief C++ interface to the OnlyFiles filesystem
+ *
+ * A header-only layer over fs.h for C++23 callers. Filesystem mounts the
+ * disk image when it is created and unmounts it when destroyed; File names
+ * one file of the mounted filesystem; Writer is an open streaming writer
+ * that is aborted unless committed. All three are move-only.
+ *
+ * Reads and writes take std::span and hand the caller's memory straight to
+ * the C functions, and every call returns std::expected instead of a
+ * negative code. Everything is inline, so a call compiles down to the C
+ * call it wraps plus the error check.
+ *
+ * Link with fs.c compiled as C (the declarations in fs.h have C linkage).
+ */
+
+#ifndef FS_HPP
+#define FS_HPP
+
+#include "fs.h"
+
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <expected>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace onlyfiles {
+
+/**
+ * @brief Errors reported by the C API
+ *
+ * The first three carry the C API's negative codes. Where a C function uses
+ * one of those codes to say the target name is taken, the wrapper reports
+ * exists instead.
+ */
+enum class errc {
+    not_found = -1,   /**< File not found, or the image could not be opened or mounted */
+    no_space = -2,    /**< Out of space, inodes, or another resource */
+    other = -3,       /**< Invalid argument, not mounted, or an I/O error */
+    exists = -4       /**< A file with the new name already exists */
+};
+
+/**
+ * @brief Result of a call: the value, or the error it failed with
+ */
+template <class T>
+using result = std::expected<T, errc>;
+
+/**
+ * @brief Short description of an error, for messages
+ */
+inline const char* describe(errc error) {
+    switch (error) {
+        case errc::not_found: return "not found";
+        case errc::no_space: return "out of space";
+        case errc::exists: return "already exists";
+        default: return "failed";
+    }
+}
+
+namespace detail {
+
+// Turn a C return code into a result: negative codes are errors
+inline result<void> check(int code) {
+    if (code < 0) return std::unexpected(static_cast<errc>(code));
+    return {};
+}
+
+inline result<std::size_t> check_size(int code) {
+    if (code < 0) return std::unexpected(static_cast<errc>(code));
+    return static_cast<std::size_t>(code);
+}
+
+// A file name with the null terminator the C API needs, kept on the stack.
+// Names that can't be valid are left empty, which the C calls reject.
+class name_buf {
+public:
+    explicit name_buf(std::string_view name) {
+        if (name.size() < MAX_FILENAME && name.find('\0') == std::string_view::npos) {
+            name.copy(buf_, name.size());
+            buf_[name.size()] = '\0';
+            ok_ = !name.empty();
+        }
+    }
+    bool ok() const { return ok_; }
+    const char* c_str() const { return buf_; }
+
+private:
+    char buf_[MAX_FILENAME] = {};
+    bool ok_ = false;
+};
+
+// Bumped by every unmount through a Filesystem. Writer handles are slot
+// numbers that the next mount hands out again, so a Writer keeps the
+// generation it was opened in and treats itself as closed once it changes.
+inline std::atomic<unsigned> mount_generation{0};
+
+// The C API measures buffers in ints
+inline bool fits(std::size_t bytes) {
+    return bytes <= static_cast<std::size_t>(INT_MAX);
+}
+
+// Ends a listing when it goes out of scope, also when a callback throws
+class list_guard {
+public:
+    explicit list_guard(int cursor) : cursor_(cursor) {}
+    list_guard(const list_guard&) = delete;
+    list_guard& operator=(const list_guard&) = delete;
+    ~list_guard() { fs_list_end(cursor_); }
+
+private:
+    int cursor_;
+};
+
+template <class F>
+int stream_trampoline(void* ctx, const void* data, int len) {
+    auto& fn = *static_cast<F*>(ctx);
+    return fn(std::span<const std::byte>(static_cast<const std::byte*>(data), len)) ? 1 : 0;
+}
+
+}  // namespace detail
+
+class Filesystem;
+
+/**
+ * @brief A file of the mounted filesystem
+ *
+ * Holds the file's name; the C API addresses files by name, so a File stays
+ * valid across remounts and is invalidated only by deleting or renaming the
+ * file through another handle. Moved-from handles name no file.
+ */
+class File {
+public:
+    File(File&& other) noexcept : name_(std::exchange(other.name_, detail::name_buf(""))) {}
+    File& operator=(File&& other) noexcept {
+        name_ = std::exchange(other.name_, detail::name_buf(""));
+        return *this;
+    }
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+
+    /** @brief The file's name */
+    const char* name() const { return name_.c_str(); }
+
+    /**
+     * @brief Reads the start of the file into a caller's buffer
+     * @return Bytes read (at most buffer.size())
+     */
+    result<std::size_t> read(std::span<std::byte> buffer) const {
+        if (!detail::fits(buffer.size())) return std::unexpected(errc::other);
+        return detail::check_size(fs_read(name(), buffer.data(), static_cast<int>(buffer.size())));
+    }
+
+    /**
+     * @brief Reads from an offset into a caller's buffer
+     * @return Bytes read (0 at or past the end of the file)
+     */
+    result<std::size_t> read_at(std::span<std::byte> buffer, std::size_t offset) const {
+        if (!detail::fits(buffer.size()) || !detail::fits(offset)) return std::unexpected(errc::other);
+        return detail::check_size(fs_read_at(name(), buffer.data(), static_cast<int>(buffer.size()),
+                                             static_cast<int>(offset)));
+    }
+
+    /** @brief Replaces the file's contents */
+    result<void> write(std::span<const std::byte> data) {
+        if (!detail::fits(data.size())) return std::unexpected(errc::other);
+        return detail::check(fs_write(name(), data.data(), static_cast<int>(data.size())));
+    }
+
+    /** @brief Adds data to the end of the file */
+    result<void> append(std::span<const std::byte> data) {
+        if (!detail::fits(data.size())) return std::unexpected(errc::other);
+        return detail::check(fs_append(name(), data.data(), static_cast<int>(data.size())));
+    }
+
+    /** @brief Shrinks or grows (with zeros) the file */
+    result<void> truncate(std::size_t size) {
+        if (!detail::fits(size)) return std::unexpected(errc::other);
+        return detail::check(fs_truncate(name(), static_cast<int>(size)));
+    }
+
+    /** @brief The file's metadata */
+    result<fs_file_stat> stat() const {
+        fs_file_stat st;
+        if (int code = fs_stat(name(), &st); code < 0) return std::unexpected(static_cast<errc>(code));
+        return st;
+    }
+
+    /**
+     * @brief Passes the file to a callable block by block
+     *
+     * fn is called with a std::span<const std::byte> per piece, in order, and
+     * returns true to stop early. The span is only valid during the call.
+     *
+     * @return Bytes passed to fn
+     */
+    template <class F>
+    result<std::size_t> read_stream(F&& fn) const {
+        using Fn = std::remove_reference_t<F>;
+        return detail::check_size(fs_read_stream(name(), detail::stream_trampoline<Fn>,
+                                                 const_cast<void*>(static_cast<const void*>(&fn))));
+    }
+
+    /** @brief Renames the file, keeping this handle pointed at it */
+    result<void> rename(std::string_view new_name, int flags = 0) {
+        detail::name_buf target(new_name);
+        if (!target.ok()) return std::unexpected(errc::other);
+        int code = fs_rename(name(), target.c_str(), flags);
+        if (code == -2) return std::unexpected(errc::exists);
+        if (auto r = detail::check(code); !r) return r;
+        name_ = target;
+        return {};
+    }
+
+    /** @brief Enables or disables compression of the file's contents */
+    result<void> set_compression(bool enable) {
+        return detail::check(fs_set_compression(name(), enable ? 1 : 0));
+    }
+
+private:
+    friend class Filesystem;
+    explicit File(const detail::name_buf& name) : name_(name) {}
+
+    detail::name_buf name_;
+};
+
+/**
+ * @brief A streaming writer; the file is replaced only on commit()
+ *
+ * Destroying an uncommitted Writer aborts it, leaving the file unchanged.
+ * Unmounting the Filesystem closes its writers: a Writer opened before the
+ * unmount reports errc::not_found afterwards and its destruction does nothing.
+ */
+class Writer {
+public:
+    Writer(Writer&& other) noexcept
+        : handle_(std::exchange(other.handle_, -1)), generation_(other.generation_) {}
+    Writer& operator=(Writer&& other) noexcept {
+        if (this != &other) {
+            abort();
+            handle_ = std::exchange(other.handle_, -1);
+            generation_ = other.generation_;
+        }
+        return *this;
+    }
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+    ~Writer() { abort(); }
+
+    /** @brief Adds data to what commit() will store */
+    result<void> write(std::span<const std::byte> data) {
+        if (!detail::fits(data.size())) return std::unexpected(errc::other);
+        return detail::check(fs_writer_write(live(), data.data(), static_cast<int>(data.size())));
+    }
+
+    /**
+     * @brief Replaces the file with everything written and closes the writer
+     *
+     * If storing the last block fails (errc::no_space, errc::other) the
+     * writer stays open: commit() can be retried, and destroying the Writer
+     * aborts it.
+     */
+    result<void> commit() {
+        int r = fs_writer_commit(live());
+        if (r == 0 || r == -1) handle_ = -1;
+        return detail::check(r);
+    }
+
+    /** @brief Discards everything written (no-op on a closed writer) */
+    void abort() {
+        if (int handle = live(); handle >= 0) fs_writer_abort(handle);
+        handle_ = -1;
+    }
+
+private:
+    friend class Filesystem;
+    explicit Writer(int handle) : handle_(handle), generation_(detail::mount_generation) {}
+
+    // The C handle, or -1 if closed or left over from an earlier mount
+    int live() const { return generation_ == detail::mount_generation ? handle_ : -1; }
+
+    int handle_;
+    unsigned generation_;
+};
+
+/**
+ * @brief The mounted filesystem
+ *
+ * There is one filesystem per process, so at most one Filesystem exists at
+ * a time; mount() fails while another is alive. Destroying it unmounts.
+ */
+class Filesystem {
+public:
+    /** @brief Formats a disk image (the filesystem must not be mounted) */
+    static result<void> format(const std::string& disk_path) {
+        return detail::check(fs_format(disk_path.c_str()));
+    }
+
+    /** @brief Mounts a disk image with FS_MOUNT_* options */
+    static result<Filesystem> mount(const std::string& disk_path, int options = 0) {
+        if (auto r = detail::check(fs_mount_opts(disk_path.c_str(), options)); !r) {
+            return std::unexpected(r.error());
+        }
+        return Filesystem();
+    }
+
+    Filesystem(Filesystem&& other) noexcept : mounted_(std::exchange(other.mounted_, false)) {}
+    Filesystem& operator=(Filesystem&& other) noexcept {
+        if (this != &other) {
+            unmount();
+            mounted_ = std::exchange(other.mounted_, false);
+        }
+        return *this;
+    }
+    Filesystem(const Filesystem&) = delete;
+    Filesystem& operator=(const Filesystem&) = delete;
+    ~Filesystem() { unmount(); }
+
+    /** @brief Unmounts now rather than at destruction, closing open Writers */
+    void unmount() {
+        if (std::exchange(mounted_, false)) {
+            fs_unmount();
+            detail::mount_generation++;
+        }
+    }
+
+    /** @brief Creates an empty file */
+    result<File> create(std::string_view name) {
+        detail::name_buf buf(name);
+        if (!buf.ok()) return std::unexpected(errc::other);
+        int code = fs_create(buf.c_str());
+        if (code == -1) return std::unexpected(errc::exists);
+        if (code < 0) return std::unexpected(static_cast<errc>(code));
+        return File(buf);
+    }
+
+    /** @brief A handle to an existing file */
+    result<File> open(std::string_view name) {
+        detail::name_buf buf(name);
+        if (!buf.ok()) return std::unexpected(errc::other);
+        fs_file_stat st;
+        if (auto r = detail::check(fs_stat(buf.c_str(), &st)); !r) return std::unexpected(r.error());
+        return File(buf);
+    }
+
+    /** @brief Deletes a file; the handle names no file afterwards */
+    result<void> remove(File&& file) {
+        File gone = std::move(file);
+        int code = fs_delete(gone.name());
+        if (code == -2) return std::unexpected(errc::other); // fs_delete's "other errors"
+        return detail::check(code);
+    }
+
+    /**
+     * @brief Makes dst a copy of src that shares its blocks
+     *
+     * Fails with not_found both when src is missing and when dst exists, as
+     * fs_clone() doesn't tell the two apart.
+     */
+    result<File> clone(const File& src, std::string_view dst) {
+        detail::name_buf buf(dst);
+        if (!buf.ok()) return std::unexpected(errc::other);
+        if (auto r = detail::check(fs_clone(src.name(), buf.c_str())); !r) return std::unexpected(r.error());
+        return File(buf);
+    }
+
+    /** @brief Opens a streaming writer that will replace the file's contents */
+    result<Writer> writer(const File& file) {
+        int handle = fs_writer_open(file.name());
+        if (handle < 0) return std::unexpected(static_cast<errc>(handle));
+        return Writer(handle);
+    }
+
+    /**
+     * @brief Calls fn with each fs_dirent whose name starts with prefix, in name order
+     *
+     * An exception thrown by fn ends the listing and propagates.
+     */
+    template <class F>
+    result<void> for_each(std::string_view prefix, F&& fn) {
+        detail::name_buf buf(prefix);
+        if (!buf.ok() && !prefix.empty()) return std::unexpected(errc::other);
+        int cursor = fs_list_begin(buf.c_str());
+        if (cursor < 0) return std::unexpected(static_cast<errc>(cursor));
+        detail::list_guard guard(cursor);
+        fs_dirent entries[32];
+        int count;
+        while ((count = fs_list_next(cursor, entries, 32)) > 0) {
+            for (int i = 0; i < count; i++) fn(entries[i]);
+        }
+        return detail::check(count);
+    }
+
+    /** @brief Runtime statistics */
+    fs_stats stats() const {
+        fs_stats st;
+        fs_get_stats(&st);
+        return st;
+    }
+
+private:
+    Filesystem() : mounted_(true) {}
+
+    bool mounted_;
+};
+
+/**
+ * @brief Views a contiguous range of trivially copyable objects as bytes
+ */
+template <std::ranges::contiguous_range R>
+    requires std::is_trivially_copyable_v<std::ranges::range_value_t<R>>
+std::span<const std::byte> bytes(const R& range) {
+    return std::as_bytes(std::span(std::ranges::data(range), std::ranges::size(range)));
+}
+
+/**
+ * @brief Views a contiguous range of trivially copyable objects as writable bytes
+ */
+template <std::ranges::contiguous_range R>
+    requires std::is_trivially_copyable_v<std::ranges::range_value_t<R>>
+std::span<std::byte> writable_bytes(R& range) {
+    return std::as_writable_bytes(std::span(std::ranges::data(range), std::ranges::size(range)));
+}
+
+}  // namespace onlyfiles
+
+#endif /* FS_HPP */
@@ -0,0 +1,450 @@
+/**
+ * @file fs_load.c
+ * @brief Synthetic load generator for OnlyFiles
+ *
+ * Formats a disk image, fills it with a set of keys (files) and then runs
+ * a timed mix of reads, writes, creates and deletes against it from one or
+ * more threads, printing the throughput of every second and a latency
+ * summary at the end. What the load looks like is configurable:
+ * - key popularity: uniform, Zipfian with exponent s, or a hotspot where a
+ *   fraction of the keys receives a fraction of the operations
+ * - file sizes: fixed, lognormal around a median, or bimodal between a
+ *   small and a large size
+ * - the operation mix, as relative weights
+ *
+ * Reads read the whole file; writes replace it with a new size drawn from
+ * the size distribution; creates write the new file too. Operations on a
+ * key that is missing (or, for creates, present) count as misses, and
+ * writes that find the disk full count as such; neither is an error.
+ * Creates and deletes settle the share of keys present at
+ * creates / (creates + deletes) of the weights.
+ *
+ * Usage: fs_load [-d seconds] [-t threads] [-n keys] [-k keys] [-s sizes]
+ *                [-m mix] [-r seed] [-i image]
+ *
+ * Exit status: 0 when the run completed, 1 when some calls failed with -3,
+ * 8 for an operational error.
+ */
+
+#include "fs.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_THREADS 64
+
+enum { OP_READ, OP_WRITE, OP_CREATE, OP_DELETE, OP_KINDS };
+enum { KEYS_UNIFORM, KEYS_ZIPF, KEYS_HOTSPOT };
+enum { SIZES_FIXED, SIZES_LOGNORMAL, SIZES_BIMODAL };
+
+static const char* op_names[OP_KINDS] = {"read", "write", "create", "delete"};
+
+// Work done by one thread. The counters are read by the reporting thread
+// while the worker runs, so they are updated with relaxed atomics.
+typedef struct {
+    pthread_t id;
+    uint64_t rng;
+    long done[OP_KINDS];
+    long missed[OP_KINDS];
+    long full[OP_KINDS];
+    long failed[OP_KINDS];
+    long bytes_read;
+    long bytes_written;
+    long count[OP_KINDS];
+    long capacity[OP_KINDS];
+    uint32_t* latencies[OP_KINDS];
+} worker;
+
+// Run configuration
+static int duration = 10;
+static int thread_count = 1;
+static int key_count = 200;
+static int key_model = KEYS_UNIFORM;
+static double zipf_s = 0.99;
+static double hot_keys = 0.2;
+static double hot_ops = 0.8;
+static int size_model = SIZES_FIXED;
+static int size_small = 4096;
+static int size_large = 40960;
+static double size_sigma = 1.0;
+static double large_share = 0.1;
+static int mix[OP_KINDS] = {70, 20, 8, 2};
+static const char* image = "load_disk.img";
+
+static worker workers[MAX_THREADS];
+static char names[MAX_FILES][MAX_FILENAME];
+static double* zipf_cdf;
+static char* write_data;
+static const int max_size = MAX_DIRECT_BLOCKS * BLOCK_SIZE;
+static int stopping = 0;
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-d seconds] [-t threads] [-n keys] [-k keys] [-s sizes] [-m mix] [-r seed] [-i image]\n", prog);
+    fprintf(stderr, "  -d  run time in seconds (default 10)\n");
+    fprintf(stderr, "  -t  worker threads, 1 to %d (default 1)\n", MAX_THREADS);
+    fprintf(stderr, "  -n  number of keys, 1 to %d (default 200)\n", MAX_FILES);
+    fprintf(stderr, "  -k  key popularity: uniform, zipf[:s] or hotspot[:key%%:op%%] (default uniform;\n");
+    fprintf(stderr, "      zipf 0.99, hotspot 20:80)\n");
+    fprintf(stderr, "  -s  file sizes: fixed[:bytes], lognormal[:median:sigma] or bimodal[:small:large:large%%]\n");
+    fprintf(stderr, "      (default fixed 4096; lognormal 4096:1; bimodal 512:40960:10)\n");
+    fprintf(stderr, "  -m  weights of reads, writes, creates and deletes (default 70:20:8:2)\n");
+    fprintf(stderr, "  -r  random seed (default 1)\n");
+    fprintf(stderr, "  -i  disk image to format and load (default %s)\n", image);
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// xorshift64*: one generator per thread, no shared state
+static uint64_t next_random(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ull;
+}
+
+// Uniform in [0, 1)
+static double next_unit(uint64_t* state) {
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Parse "name" or "name:a:b:c" into up to three numbers; returns how many
+// were given, or -1 if the name doesn't match
+static int parse_model(const char* arg, const char* name, double* a, double* b, double* c) {
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len) != 0) return -1;
+    if (arg[len] == '\0') return 0;
+    if (arg[len] != ':') return -1;
+    int given = sscanf(arg + len + 1, "%lf:%lf:%lf", a, b, c);
+    return given > 0 ? given : -1;
+}
+
+static int parse_keys(const char* arg) {
+    double a = 0, b = 0, c = 0;
+    int given;
+    if (strcmp(arg, "uniform") == 0) {
+        key_model = KEYS_UNIFORM;
+    } else if ((given = parse_model(arg, "zipf", &a, &b, &c)) >= 0) {
+        key_model = KEYS_ZIPF;
+        if (given >= 1) zipf_s = a;
+        if (given > 1 || zipf_s <= 0) return -1;
+    } else if ((given = parse_model(arg, "hotspot", &a, &b, &c)) >= 0) {
+        key_model = KEYS_HOTSPOT;
+        if (given >= 1) hot_keys = a / 100;
+        if (given >= 2) hot_ops = b / 100;
+        if (given > 2 || hot_keys <= 0 || hot_keys >= 1 || hot_ops < 0 || hot_ops > 1) return -1;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_sizes(const char* arg) {
+    double a = 0, b = 0, c = 0;
+    int given;
+    if ((given = parse_model(arg, "fixed", &a, &b, &c)) >= 0) {
+        size_model = SIZES_FIXED;
+        if (given >= 1) size_small = (int)a;
+        if (given > 1) return -1;
+    } else if ((given = parse_model(arg, "lognormal", &a, &b, &c)) >= 0) {
+        size_model = SIZES_LOGNORMAL;
+        if (given >= 1) size_small = (int)a;
+        if (given >= 2) size_sigma = b;
+        if (given > 2 || size_sigma < 0) return -1;
+    } else if ((given = parse_model(arg, "bimodal", &a, &b, &c)) >= 0) {
+        size_model = SIZES_BIMODAL;
+        size_small = 512;
+        if (given >= 1) size_small = (int)a;
+        if (given >= 2) size_large = (int)b;
+        if (given >= 3) large_share = c / 100;
+        if (size_large < 1 || size_large > max_size || large_share < 0 || large_share > 1) return -1;
+    } else {
+        return -1;
+    }
+    return (size_small < 1 || size_small > max_size) ? -1 : 0;
+}
+
+// Cumulative Zipf probabilities of the key ranks
+static void build_zipf() {
+    zipf_cdf = malloc(key_count * sizeof(double));
+    double sum = 0;
+    for (int i = 0; i < key_count; i++) {
+        sum += 1.0 / pow(i + 1, zipf_s);
+        zipf_cdf[i] = sum;
+    }
+    for (int i = 0; i < key_count; i++) zipf_cdf[i] /= sum;
+}
+
+// Pick a key according to the popularity model
+static int next_key(uint64_t* rng) {
+    double u = next_unit(rng);
+    if (key_model == KEYS_ZIPF) {
+        int lo = 0;
+        int hi = key_count - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (zipf_cdf[mid] < u) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+    if (key_model == KEYS_HOTSPOT) {
+        int hot = (int)(key_count * hot_keys);
+        if (hot < 1) hot = 1;
+        if (hot == key_count || next_unit(rng) < hot_ops) return (int)(u * hot);
+        return hot + (int)(u * (key_count - hot));
+    }
+    return (int)(u * key_count);
+}
+
+// Draw a file size from the size model, clamped to what a file can hold
+static int next_size(uint64_t* rng) {
+    double size = size_small;
+    if (size_model == SIZES_LOGNORMAL) {
+        // Box-Muller; 1 - u keeps the logarithm finite
+        double normal = sqrt(-2.0 * log(1.0 - next_unit(rng))) * cos(2 * M_PI * next_unit(rng));
+        size = size_small * exp(size_sigma * normal);
+    } else if (size_model == SIZES_BIMODAL && next_unit(rng) < large_share) {
+        size = size_large;
+    }
+    if (size < 1) return 1;
+    if (size > max_size) return max_size;
+    return (int)size;
+}
+
+// Pick an operation according to the mix weights
+static int next_op(uint64_t* rng) {
+    int total = mix[OP_READ] + mix[OP_WRITE] + mix[OP_CREATE] + mix[OP_DELETE];
+    int pick = (int)(next_unit(rng) * total);
+    int op = 0;
+    while (pick >= mix[op]) pick -= mix[op++];
+    return op;
+}
+
+// Write a key with a new size; the data starts at a random point of the
+// pool so that successive versions differ
+static int write_key(worker* w, int key) {
+    int size = next_size(&w->rng);
+    int result = fs_write(names[key], write_data + next_random(&w->rng) % max_size, size);
+    if (result == 0) __atomic_fetch_add(&w->bytes_written, size, __ATOMIC_RELAXED);
+    return result;
+}
+
+static void record_latency(worker* w, int op, uint64_t latency) {
+    if (w->count[op] == w->capacity[op]) {
+        w->capacity[op] = w->capacity[op] ? 2 * w->capacity[op] : 4096;
+        w->latencies[op] = realloc(w->latencies[op], w->capacity[op] * sizeof(uint32_t));
+    }
+    w->latencies[op][w->count[op]++] = latency > UINT32_MAX ? UINT32_MAX : latency;
+}
+
+static void* run_worker(void* arg) {
+    worker* w = arg;
+    char* buffer = malloc(max_size);
+    while (!__atomic_load_n(&stopping, __ATOMIC_RELAXED)) {
+        int op = next_op(&w->rng);
+        int key = next_key(&w->rng);
+        uint64_t start = now_ns();
+        int result = 0;
+        switch (op) {
+            case OP_READ:
+                result = fs_read_at(names[key], buffer, max_size, 0);
+                if (result > 0) __atomic_fetch_add(&w->bytes_read, result, __ATOMIC_RELAXED);
+                break;
+            case OP_WRITE:
+                result = write_key(w, key);
+                break;
+            case OP_CREATE:
+                result = fs_create(names[key]);
+                if (result == 0) result = write_key(w, key);
+                break;
+            case OP_DELETE:
+                result = fs_delete(names[key]);
+                break;
+        }
+        record_latency(w, op, now_ns() - start);
+        if (result == -1) __atomic_fetch_add(&w->missed[op], 1, __ATOMIC_RELAXED);
+        else if (result == -2) __atomic_fetch_add(&w->full[op], 1, __ATOMIC_RELAXED);
+        else if (result < 0) __atomic_fetch_add(&w->failed[op], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&w->done[op], 1, __ATOMIC_RELAXED);
+    }
+    free(buffer);
+    return NULL;
+}
+
+// Totals of the counters over all workers, taken while they run
+static void sum_counters(long done[OP_KINDS], long* bytes_read, long* bytes_written) {
+    for (int op = 0; op < OP_KINDS; op++) done[op] = 0;
+    *bytes_read = 0;
+    *bytes_written = 0;
+    for (int t = 0; t < thread_count; t++) {
+        for (int op = 0; op < OP_KINDS; op++) done[op] += __atomic_load_n(&workers[t].done[op], __ATOMIC_RELAXED);
+        *bytes_read += __atomic_load_n(&workers[t].bytes_read, __ATOMIC_RELAXED);
+        *bytes_written += __atomic_load_n(&workers[t].bytes_written, __ATOMIC_RELAXED);
+    }
+}
+
+static int compare_latency(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t seed = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:t:n:k:s:m:r:i:")) != -1) {
+        switch (opt) {
+            case 'd': duration = atoi(optarg); break;
+            case 't': thread_count = atoi(optarg); break;
+            case 'n': key_count = atoi(optarg); break;
+            case 'k':
+                if (parse_keys(optarg) != 0) {
+                    fprintf(stderr, "%s: bad key model '%s'\n", argv[0], optarg);
+                    return 8;
+                }
+                break;
+            case 's':
+                if (parse_sizes(optarg) != 0) {
+                    fprintf(stderr, "%s: bad size model '%s' (sizes are 1 to %d bytes)\n", argv[0], optarg, max_size);
+                    return 8;
+                }
+                break;
+            case 'm':
+                if (sscanf(optarg, "%d:%d:%d:%d", &mix[OP_READ], &mix[OP_WRITE], &mix[OP_CREATE], &mix[OP_DELETE]) != 4 ||
+                    mix[OP_READ] < 0 || mix[OP_WRITE] < 0 || mix[OP_CREATE] < 0 || mix[OP_DELETE] < 0 ||
+                    mix[OP_READ] + mix[OP_WRITE] + mix[OP_CREATE] + mix[OP_DELETE] == 0) {
+                    fprintf(stderr, "%s: bad mix '%s'\n", argv[0], optarg);
+                    return 8;
+                }
+                break;
+            case 'r': seed = strtoull(optarg, NULL, 10); break;
+            case 'i': image = optarg; break;
+            default: usage(argv[0]); return 8;
+        }
+    }
+    if (optind != argc || duration < 1 || thread_count < 1 || thread_count > MAX_THREADS ||
+        key_count < 1 || key_count > MAX_FILES) {
+        usage(argv[0]);
+        return 8;
+    }
+    if (key_model == KEYS_ZIPF) build_zipf();
+
+    write_data = malloc(2 * max_size);
+    uint64_t rng = seed * 0x9e3779b97f4a7c15ull + 1;
+    for (int i = 0; i < 2 * max_size; i++) write_data[i] = (char)next_random(&rng);
+    for (int i = 0; i < key_count; i++) snprintf(names[i], MAX_FILENAME, "key_%d", i);
+    for (int t = 0; t < thread_count; t++) workers[t].rng = rng + (t + 1) * 0x9e3779b97f4a7c15ull;
+
+    if (fs_format(image) != 0 || fs_mount(image) != 0) {
+        fprintf(stderr, "%s: could not format and mount the image\n", image);
+        return 8;
+    }
+
+    // Every key starts out present, with a size from the size model
+    worker loader = {.rng = rng};
+    int loaded = 0;
+    for (int i = 0; i < key_count; i++) {
+        if (fs_create(names[i]) == 0 && write_key(&loader, i) == 0) loaded++;
+    }
+    printf("%s: %d keys (%d written, %.1f MB), %d thread%s for %d s\n", image, key_count, loaded,
+           loader.bytes_written / (1024.0 * 1024), thread_count, thread_count == 1 ? "" : "s", duration);
+    printf("keys: ");
+    if (key_model == KEYS_ZIPF) printf("zipf s=%.2f", zipf_s);
+    else if (key_model == KEYS_HOTSPOT) printf("hotspot, %.0f%% of keys get %.0f%% of operations", hot_keys * 100, hot_ops * 100);
+    else printf("uniform");
+    printf("; sizes: ");
+    if (size_model == SIZES_LOGNORMAL) printf("lognormal, median %d sigma %.2f", size_small, size_sigma);
+    else if (size_model == SIZES_BIMODAL) printf("bimodal, %d or %d (%.0f%%)", size_small, size_large, large_share * 100);
+    else printf("fixed %d", size_small);
+    printf("; mix read:write:create:delete %d:%d:%d:%d\n\n", mix[OP_READ], mix[OP_WRITE], mix[OP_CREATE], mix[OP_DELETE]);
+
+    // Run, reporting every second
+    printf("%6s %10s %10s %10s %10s %10s %11s %11s\n", "second", "ops/s", "reads/s", "writes/s", "creates/s",
+           "deletes/s", "read MB/s", "write MB/s");
+    uint64_t start = now_ns();
+    for (int t = 0; t < thread_count; t++) {
+        if (pthread_create(&workers[t].id, NULL, run_worker, &workers[t]) != 0) {
+            // Stop the ones already running rather than measure a smaller load
+            fprintf(stderr, "%s: could not start worker thread %d\n", argv[0], t + 1);
+            __atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+            for (int u = 0; u < t; u++) pthread_join(workers[u].id, NULL);
+            fs_unmount();
+            return 8;
+        }
+    }
+    long last[OP_KINDS] = {0};
+    long last_read = 0;
+    long last_written = 0;
+    for (int second = 1; second <= duration; second++) {
+        uint64_t due = start + second * 1000000000ull;
+        struct timespec wake = {due / 1000000000ull, due % 1000000000ull};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) != 0) {
+        }
+        long done[OP_KINDS];
+        long bytes_read, bytes_written;
+        sum_counters(done, &bytes_read, &bytes_written);
+        long ops = 0;
+        for (int op = 0; op < OP_KINDS; op++) ops += done[op] - last[op];
+        printf("%6d %10ld %10ld %10ld %10ld %10ld %11.1f %11.1f\n", second, ops, done[OP_READ] - last[OP_READ],
+               done[OP_WRITE] - last[OP_WRITE], done[OP_CREATE] - last[OP_CREATE], done[OP_DELETE] - last[OP_DELETE],
+               (bytes_read - last_read) / (1024.0 * 1024), (bytes_written - last_written) / (1024.0 * 1024));
+        fflush(stdout);
+        memcpy(last, done, sizeof(last));
+        last_read = bytes_read;
+        last_written = bytes_written;
+    }
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+    for (int t = 0; t < thread_count; t++) {
+        pthread_join(workers[t].id, NULL);
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+    fs_unmount();
+
+    // Summary over the whole run
+    long done[OP_KINDS];
+    long bytes_read, bytes_written;
+    sum_counters(done, &bytes_read, &bytes_written);
+    long total = 0;
+    long failed = 0;
+    printf("\n%-8s %10s %10s %9s %9s %9s %9s %9s %9s %9s\n", "op", "calls", "ops/s", "mean us", "p50 us",
+           "p99 us", "max us", "missed", "full", "failed");
+    for (int op = 0; op < OP_KINDS; op++) {
+        long count = 0;
+        long missed = 0, full = 0, op_failed = 0;
+        for (int t = 0; t < thread_count; t++) {
+            count += workers[t].count[op];
+            missed += workers[t].missed[op];
+            full += workers[t].full[op];
+            op_failed += workers[t].failed[op];
+        }
+        total += done[op];
+        failed += op_failed;
+        if (count == 0) continue;
+        uint32_t* latencies = malloc(count * sizeof(uint32_t));
+        long n = 0;
+        double sum = 0;
+        for (int t = 0; t < thread_count; t++) {
+            memcpy(latencies + n, workers[t].latencies[op], workers[t].count[op] * sizeof(uint32_t));
+            n += workers[t].count[op];
+            free(workers[t].latencies[op]);
+        }
+        qsort(latencies, count, sizeof(uint32_t), compare_latency);
+        for (long i = 0; i < count; i++) sum += latencies[i];
+        printf("%-8s %10ld %10.0f %9.2f %9.2f %9.2f %9.2f %9ld %9ld %9ld\n", op_names[op], count, count / elapsed,
+               sum / count / 1e3, latencies[count / 2] / 1e3, latencies[(long)(count * 0.99)] / 1e3,
+               latencies[count - 1] / 1e3, missed, full, op_failed);
+        free(latencies);
+    }
+    printf("total: %ld calls in %.2f s, %.0f ops/s, %.1f MB/s read, %.1f MB/s written\n", total, elapsed,
+           total / elapsed, bytes_read / elapsed / (1024 * 1024), bytes_written / elapsed / (1024 * 1024));
+
+    free(write_data);
+    free(zipf_cdf);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,486 @@
+/**
+ * @file fs_replay.c
+ * @brief Replays a trace recorded with fs_trace_start() or FS_TRACE
+ *
+ * Re-executes every call of a trace against fresh disk images, either as
+ * fast as possible or at the pace of the recording, and reports throughput,
+ * per-operation latency (next to the latency that was recorded) and the
+ * calls whose result differs from the recorded one.
+ *
+ * Traces hold names and sizes but not file contents, so writes are replayed
+ * with generated data. Results that depend on the contents (compression,
+ * deduplication, checksum errors caused by editing an image behind the
+ * filesystem's back) can differ from the recording, as can fs_stat_many()
+ * calls whose name list was too long to record in full. Calls from several
+ * threads are replayed one after another, in the order they returned.
+ *
+ * Every disk image path in the trace is replayed on its own image: the
+ * first on the -i path, later ones on that path with .1, .2, ... appended.
+ * An image the trace mounts before formatting it is formatted first if the
+ * recorded mount succeeded and removed if it failed, and a trace that
+ * starts on a mounted filesystem gets the first image formatted and
+ * mounted for it.
+ *
+ * Usage: fs_replay [-o] [-v] [-i image] <trace>
+ *
+ * Exit status: 0 when every result matched, 1 when some differed, 8 for
+ * an operational error.
+ */
+
+#include "fs.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Distinct disk images a trace may use
+#define MAX_IMAGES 16
+
+// Handles (writers, cursors, views) tracked by their recorded number
+#define MAX_HANDLES 64
+
+static const char* op_names[FS_OP_COUNT] = {
+    [FS_OP_FORMAT] = "format", [FS_OP_MOUNT] = "mount", [FS_OP_UNMOUNT] = "unmount",
+    [FS_OP_CREATE] = "create", [FS_OP_DELETE] = "delete", [FS_OP_LIST] = "list",
+    [FS_OP_LIST_BEGIN] = "list_begin", [FS_OP_LIST_NEXT] = "list_next", [FS_OP_LIST_END] = "list_end",
+    [FS_OP_WRITE] = "write", [FS_OP_APPEND] = "append", [FS_OP_TRUNCATE] = "truncate",
+    [FS_OP_WRITER_OPEN] = "writer_open", [FS_OP_WRITER_WRITE] = "writer_write",
+    [FS_OP_WRITER_COMMIT] = "writer_commit", [FS_OP_WRITER_ABORT] = "writer_abort",
+    [FS_OP_READ_AT] = "read_at", [FS_OP_STAT] = "stat", [FS_OP_STAT_MANY] = "stat_many",
+    [FS_OP_READ_STREAM] = "read_stream", [FS_OP_READ_VIEW] = "read_view",
+    [FS_OP_RELEASE_VIEW] = "release_view", [FS_OP_SENDFILE] = "sendfile", [FS_OP_CLONE] = "clone",
+    [FS_OP_RENAME] = "rename", [FS_OP_SET_COMPRESSION] = "set_compression", [FS_OP_DEFRAG] = "defrag",
+    [FS_OP_FRAGMENTATION] = "fragmentation", [FS_OP_GROUP_STATS] = "group_stats",
+};
+
+// Replayed latencies of one operation
+typedef struct {
+    long count;
+    long capacity;
+    uint32_t* latencies;
+    double recorded_ns;
+    long mismatched;
+} op_stats;
+
+static op_stats ops[FS_OP_COUNT];
+
+// Recorded image paths and the images replaying them
+static char image_paths[MAX_IMAGES][256];
+static char image_files[MAX_IMAGES][300];
+static int image_ready[MAX_IMAGES];
+static int image_count = 0;
+static const char* image_base = "replay.img";
+
+// Recorded handle numbers mapped to the replay's own
+static int writer_map[MAX_HANDLES];
+static int cursor_map[MAX_HANDLES];
+static struct iovec* view_map[MAX_HANDLES];
+static int view_ids[MAX_HANDLES];
+
+// Generated write data, twice the largest file so writes can start anywhere
+static char* write_data;
+static char* read_buffer;
+static const int max_size = MAX_DIRECT_BLOCKS * BLOCK_SIZE;
+static long writes_done = 0;
+static long bytes_moved = 0;
+static int null_fd = -1;
+static int mounted = 0;
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-o] [-v] [-i image] <trace>\n", prog);
+    fprintf(stderr, "  -o  replay at the pace of the recording (default: as fast as possible)\n");
+    fprintf(stderr, "  -v  list every call whose result differs from the recording\n");
+    fprintf(stderr, "  -i  disk image to replay on (default: %s)\n", image_base);
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// The image replaying a recorded path. The first time it is used, it is
+// formatted when the trace expects it to exist and removed when the trace
+// expects it to be missing; preparing is 0 when the trace formats it itself.
+static const char* image_for(const char* path, int preparing, int exists) {
+    int i = 0;
+    while (i < image_count && strcmp(image_paths[i], path) != 0) i++;
+    if (i == image_count) {
+        if (image_count == MAX_IMAGES) i = MAX_IMAGES - 1; // share the last one
+        else {
+            snprintf(image_paths[i], sizeof(image_paths[i]), "%s", path);
+            if (i == 0) snprintf(image_files[i], sizeof(image_files[i]), "%s", image_base);
+            else snprintf(image_files[i], sizeof(image_files[i]), "%s.%d", image_base, i);
+            image_count++;
+        }
+    }
+    if (!image_ready[i] && preparing) {
+        if (exists) fs_format(image_files[i]);
+        else unlink(image_files[i]);
+    }
+    image_ready[i] = 1;
+    return image_files[i];
+}
+
+// realloc that gives up with exit status 8 when memory runs out
+static void* grow(void* p, size_t size) {
+    void* q = realloc(p, size);
+    if (!q) {
+        fprintf(stderr, "fs_replay: out of memory\n");
+        exit(8);
+    }
+    return q;
+}
+
+// Next block of write data; successive writes get different contents
+static const char* next_data() {
+    return write_data + (writes_done++ * 4099) % max_size;
+}
+
+// Counts streamed bytes, stopping where the recorded callback stopped
+static int count_bytes(void* ctx, const void* data, int len) {
+    int* left = ctx;
+    (void)data;
+    bytes_moved += len;
+    *left -= len;
+    return *left <= 0;
+}
+
+static int handle_slot(int recorded) {
+    return (recorded >= 0 && recorded < MAX_HANDLES) ? recorded : -1;
+}
+
+// Split a record's names blob at its zero bytes
+static int split_names(char* blob, int len, const char** names, int max) {
+    int count = 0;
+    int start = 0;
+    for (int i = 0; i <= len && count < max; i++) {
+        if (i == len || blob[i] == '\0') {
+            blob[i] = '\0';
+            names[count++] = blob + start;
+            start = i + 1;
+        }
+    }
+    return count;
+}
+
+// Re-execute one recorded call; returns its result
+static int replay(const fs_trace_record* rec, char* blob) {
+    const char* names[MAX_FILES];
+    int null_name = (rec->name_len == FS_TRACE_NULL_NAME);
+    int count = split_names(blob, null_name ? 0 : rec->name_len, names, MAX_FILES);
+    const char* name = null_name ? NULL : names[0];
+    const char* name2 = (count > 1) ? names[1] : "";
+    int slot = handle_slot(rec->arg);
+    int result = 0;
+    switch (rec->op) {
+        case FS_OP_FORMAT:
+            result = fs_format(image_for(name, 0, 0));
+            break;
+        case FS_OP_MOUNT:
+            result = fs_mount_opts(image_for(name, 1, rec->result == 0), rec->arg);
+            mounted |= (result == 0);
+            break;
+        case FS_OP_UNMOUNT:
+            fs_unmount();
+            mounted = 0;
+            break;
+        case FS_OP_CREATE:
+            result = fs_create(name);
+            break;
+        case FS_OP_DELETE:
+            result = fs_delete(name);
+            break;
+        case FS_OP_LIST: {
+            static char list[MAX_FILES][MAX_FILENAME];
+            result = fs_list(list, rec->size < MAX_FILES ? rec->size : MAX_FILES);
+            break;
+        }
+        case FS_OP_LIST_BEGIN:
+            result = fs_list_begin(name);
+            if (handle_slot(rec->result) != -1) cursor_map[rec->result] = result;
+            break;
+        case FS_OP_LIST_NEXT: {
+            fs_dirent entries[MAX_FILES];
+            result = fs_list_next(slot == -1 ? -1 : cursor_map[slot], entries,
+                                  rec->size < MAX_FILES ? rec->size : MAX_FILES);
+            break;
+        }
+        case FS_OP_LIST_END:
+            result = fs_list_end(slot == -1 ? -1 : cursor_map[slot]);
+            break;
+        case FS_OP_WRITE:
+            result = fs_write(name, next_data(), rec->size);
+            if (result == 0) bytes_moved += rec->size;
+            break;
+        case FS_OP_APPEND:
+            result = fs_append(name, next_data(), rec->size);
+            if (result == 0) bytes_moved += rec->size;
+            break;
+        case FS_OP_TRUNCATE:
+            result = fs_truncate(name, rec->size);
+            break;
+        case FS_OP_WRITER_OPEN:
+            result = fs_writer_open(name);
+            if (handle_slot(rec->result) != -1) writer_map[rec->result] = result;
+            break;
+        case FS_OP_WRITER_WRITE:
+            result = fs_writer_write(slot == -1 ? -1 : writer_map[slot], next_data(), rec->size);
+            if (result == 0) bytes_moved += rec->size;
+            break;
+        case FS_OP_WRITER_COMMIT:
+            result = fs_writer_commit(slot == -1 ? -1 : writer_map[slot]);
+            break;
+        case FS_OP_WRITER_ABORT:
+            result = fs_writer_abort(slot == -1 ? -1 : writer_map[slot]);
+            break;
+        case FS_OP_READ_AT:
+            result = fs_read_at(name, read_buffer, rec->size < max_size ? rec->size : max_size, rec->arg);
+            if (result > 0) bytes_moved += result;
+            break;
+        case FS_OP_STAT: {
+            fs_file_stat st;
+            result = fs_stat(name, &st);
+            break;
+        }
+        case FS_OP_STAT_MANY: {
+            // Long name lists are cut short in the trace; repeat what was kept
+            static const char** many;
+            static fs_file_stat* st;
+            static int many_capacity = 0;
+            if (rec->size > many_capacity) {
+                many_capacity = rec->size;
+                many = grow(many, many_capacity * sizeof(*many));
+                st = grow(st, many_capacity * sizeof(*st));
+            }
+            for (int i = 0; i < rec->size; i++) many[i] = names[i % count];
+            result = fs_stat_many(many, rec->size, st);
+            break;
+        }
+        case FS_OP_READ_STREAM: {
+            int left = rec->result;
+            result = fs_read_stream(name, rec->arg ? NULL : count_bytes, &left);
+            break;
+        }
+        case FS_OP_READ_VIEW: {
+            struct iovec* iov;
+            int n;
+            result = fs_read_view(name, &iov, &n);
+            if (result >= 0 && rec->arg >= 0) {
+                int v = 0;
+                while (v < MAX_HANDLES && view_map[v]) v++;
+                if (v == MAX_HANDLES) v = rec->arg % MAX_HANDLES;
+                view_map[v] = iov;
+                view_ids[v] = rec->arg;
+            }
+            break;
+        }
+        case FS_OP_RELEASE_VIEW: {
+            static struct iovec never_a_view;
+            struct iovec* iov = &never_a_view;
+            for (int v = 0; v < MAX_HANDLES && rec->arg >= 0; v++) {
+                if (view_map[v] && view_ids[v] == rec->arg) {
+                    iov = view_map[v];
+                    view_map[v] = NULL;
+                    break;
+                }
+            }
+            result = fs_release_view(iov);
+            break;
+        }
+        case FS_OP_SENDFILE:
+            result = fs_sendfile(name, null_fd, rec->arg, rec->size);
+            if (result > 0) bytes_moved += result;
+            break;
+        case FS_OP_CLONE:
+            result = fs_clone(name, name2);
+            break;
+        case FS_OP_RENAME:
+            result = fs_rename(name, name2, rec->arg);
+            break;
+        case FS_OP_SET_COMPRESSION:
+            result = fs_set_compression(name, rec->arg);
+            break;
+        case FS_OP_DEFRAG:
+            result = fs_defrag(rec->arg);
+            break;
+        case FS_OP_FRAGMENTATION: {
+            fs_frag_report report;
+            result = fs_fragmentation(rec->arg ? NULL : &report);
+            break;
+        }
+        case FS_OP_GROUP_STATS: {
+            fs_group_info info[BLOCK_GROUPS];
+            result = fs_group_stats(rec->arg ? NULL : info, rec->size < BLOCK_GROUPS ? rec->size : BLOCK_GROUPS);
+            break;
+        }
+    }
+    return result;
+}
+
+static void record_latency(int op, uint32_t latency) {
+    op_stats* s = &ops[op];
+    if (s->count == s->capacity) {
+        s->capacity = s->capacity ? 2 * s->capacity : 1024;
+        s->latencies = grow(s->latencies, s->capacity * sizeof(uint32_t));
+    }
+    s->latencies[s->count++] = latency;
+}
+
+static int compare_latency(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char* argv[]) {
+    int original_speed = 0;
+    int verbose = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "ovi:")) != -1) {
+        switch (opt) {
+            case 'o': original_speed = 1; break;
+            case 'v': verbose = 1; break;
+            case 'i': image_base = optarg; break;
+            default: usage(argv[0]); return 8;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 8;
+    }
+    const char* trace_path = argv[optind];
+
+    // Load the whole trace
+    FILE* f = fopen(trace_path, "rb");
+    if (!f) {
+        perror(trace_path);
+        return 8;
+    }
+    long trace_size = -1;
+    if (fseek(f, 0, SEEK_END) == 0) trace_size = ftell(f);
+    char* trace = (trace_size >= 0 && fseek(f, 0, SEEK_SET) == 0) ? malloc(trace_size > 0 ? trace_size : 1) : NULL;
+    if (!trace || fread(trace, 1, trace_size, f) != (size_t)trace_size) {
+        fprintf(stderr, "%s: could not read the trace\n", trace_path);
+        free(trace);
+        fclose(f);
+        return 8;
+    }
+    fclose(f);
+    fs_trace_header header;
+    if (trace_size < (long)sizeof(header)) {
+        fprintf(stderr, "%s: not a trace\n", trace_path);
+        free(trace);
+        return 8;
+    }
+    memcpy(&header, trace, sizeof(header));
+    if (memcmp(header.magic, FS_TRACE_MAGIC, 4) != 0 || header.version != FS_TRACE_VERSION) {
+        fprintf(stderr, "%s: not a version %d trace\n", trace_path, FS_TRACE_VERSION);
+        free(trace);
+        return 8;
+    }
+    if (header.max_blocks != MAX_BLOCKS || header.block_size != BLOCK_SIZE || header.max_files != MAX_FILES) {
+        fprintf(stderr, "%s: recorded with %d blocks of %d bytes and %d inodes; this build has %d, %d and %d\n",
+                trace_path, header.max_blocks, header.block_size, header.max_files,
+                MAX_BLOCKS, BLOCK_SIZE, MAX_FILES);
+        free(trace);
+        return 8;
+    }
+
+    write_data = grow(NULL, 2 * max_size);
+    read_buffer = grow(NULL, max_size);
+    uint32_t x = 2463534242u;
+    for (int i = 0; i < 2 * max_size; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        write_data[i] = (char)x;
+    }
+    null_fd = open("/dev/null", O_WRONLY);
+    for (int i = 0; i < MAX_HANDLES; i++) view_ids[i] = -1;
+
+    // Replay every record
+    long pos = sizeof(header);
+    long total = 0;
+    long mismatched = 0;
+    uint64_t first_ns = 0;
+    uint64_t last_ns = 0;
+    uint64_t replay_start = now_ns();
+    while (pos + (long)sizeof(fs_trace_record) <= trace_size) {
+        fs_trace_record rec;
+        memcpy(&rec, trace + pos, sizeof(rec));
+        pos += sizeof(rec);
+        int name_bytes = (rec.name_len == FS_TRACE_NULL_NAME) ? 0 : rec.name_len;
+        if (pos + name_bytes > trace_size || rec.op == 0 || rec.op >= FS_OP_COUNT) {
+            fprintf(stderr, "%s: corrupt record at offset %ld\n", trace_path, pos - (long)sizeof(rec));
+            if (mounted) fs_unmount();
+            free(trace);
+            free(write_data);
+            free(read_buffer);
+            return 8;
+        }
+        char blob[65536];
+        memcpy(blob, trace + pos, name_bytes);
+        pos += name_bytes;
+
+        if (total == 0) {
+            first_ns = rec.start_ns;
+            // A trace that starts mid-session needs a mounted filesystem
+            if (rec.op != FS_OP_FORMAT && rec.op != FS_OP_MOUNT) {
+                image_for("", 1, 1);
+                mounted = (fs_mount(image_files[0]) == 0);
+            }
+            replay_start = now_ns();
+        }
+        if (original_speed) {
+            uint64_t due = replay_start + (rec.start_ns - first_ns);
+            uint64_t now = now_ns();
+            if (due > now) {
+                struct timespec wait = {(due - now) / 1000000000ull, (due - now) % 1000000000ull};
+                nanosleep(&wait, NULL);
+            }
+        }
+        uint64_t start = now_ns();
+        int result = replay(&rec, blob);
+        uint64_t latency = now_ns() - start;
+        record_latency(rec.op, latency > UINT32_MAX ? UINT32_MAX : latency);
+        ops[rec.op].recorded_ns += rec.latency_ns;
+        if (result != rec.result) {
+            ops[rec.op].mismatched++;
+            mismatched++;
+            if (verbose) {
+                printf("call %ld: %s %s size %d arg %d returned %d, recorded %d\n", total, op_names[rec.op],
+                       name_bytes ? blob : "-", rec.size, rec.arg, result, rec.result);
+            }
+        }
+        last_ns = rec.start_ns + rec.latency_ns;
+        total++;
+    }
+    double elapsed = (now_ns() - replay_start) / 1e9;
+    if (mounted) fs_unmount();
+
+    // Report
+    printf("%s: %ld calls recorded over %.3f s, replayed in %.3f s (%s)\n", trace_path, total,
+           (last_ns - first_ns) / 1e9, elapsed, original_speed ? "original speed" : "maximum speed");
+    printf("throughput: %.0f calls/s, %.1f MB/s of file data\n",
+           elapsed > 0 ? total / elapsed : 0, elapsed > 0 ? bytes_moved / elapsed / (1024 * 1024) : 0);
+    printf("%-16s %9s %10s %9s %9s %9s %13s %10s\n", "operation", "calls", "mean us", "p50 us", "p99 us",
+           "max us", "recorded us", "mismatched");
+    for (int op = 1; op < FS_OP_COUNT; op++) {
+        op_stats* s = &ops[op];
+        if (s->count == 0) continue;
+        qsort(s->latencies, s->count, sizeof(uint32_t), compare_latency);
+        double sum = 0;
+        for (long i = 0; i < s->count; i++) sum += s->latencies[i];
+        printf("%-16s %9ld %10.2f %9.2f %9.2f %9.2f %13.2f %10ld\n", op_names[op], s->count,
+               sum / s->count / 1e3, s->latencies[s->count / 2] / 1e3,
+               s->latencies[(long)(s->count * 0.99)] / 1e3, s->latencies[s->count - 1] / 1e3,
+               s->recorded_ns / s->count / 1e3, s->mismatched);
+        free(s->latencies);
+    }
+    printf("%ld of %ld results differed from the recording\n", mismatched, total);
+
+    free(trace);
+    free(write_data);
+    free(read_buffer);
+    return mismatched ? 1 : 0;
+}
@@ -0,0 +1,390 @@
+/**
+ * @file fsck.c
+ * @brief Consistency checker for OnlyFiles disk images
+ *
+ * Reads an unmounted disk image and cross-checks its metadata:
+ * - the superblock's geometry, layout version and free counters
+ * - every inode (name, flags, sizes and block pointers)
+ * - the block reference counts against the references the inodes hold
+ *   (under-counted blocks that could be handed out twice, leaked blocks)
+ * - optionally, every used data block against its CRC32C checksum
+ *
+ * Inodes and blocks are split into ranges checked by parallel threads.
+ * In repair mode, damaged inodes are cut back to their valid part and the
+ * reference counts and superblock counters are rebuilt from the inodes.
+ * Checksum errors are reported but can't be repaired.
+ *
+ * Usage: fs_fsck [-c] [-r] [-j threads] <disk image>
+ *
+ * Exit status follows e2fsck: 0 clean, 1 errors corrected, 4 errors left
+ * uncorrected, 8 operational error.
+ */
+
+#include "fs.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MAX_THREADS 64
+
+// Blocks read per pread when verifying checksums
+#define VERIFY_CHUNK 64
+
+// Image metadata as read from disk
+static superblock sb;
+static unsigned char block_refs[BLOCK_SIZE];
+static inode inode_table[MAX_FILES];
+static uint32_t crc_table[CRC_TABLE_BLOCKS * BLOCK_SIZE / sizeof(uint32_t)];
+static int disk_fd = -1;
+static int verify_data = 0;
+
+// References to each block held by the inodes, counted by the inode workers
+static int expected_refs[MAX_BLOCKS];
+// Inodes with a problem that repair would change
+static unsigned char inode_damaged[MAX_FILES];
+
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static int errors = 0;           // problems repair can fix
+static int checksum_errors = 0;  // data that no longer matches its checksum
+
+// Print a problem and count it
+static void problem(int* counter, const char* fmt, ...) {
+    va_list args;
+    pthread_mutex_lock(&report_lock);
+    (*counter)++;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    printf("\n");
+    pthread_mutex_unlock(&report_lock);
+}
+
+// Number of leading block pointers an inode's stored data needs
+static int blocks_needed(const inode* node) {
+    return (node->stored_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+// Check one inode, counting the references of its valid block pointers
+static void check_inode(int i) {
+    const inode* node = &inode_table[i];
+    if (node->used == 0) {
+        for (int j = 0; j < MAX_DIRECT_BLOCKS; j++) {
+            if (node->blocks[j] != 0) {
+                problem(&errors, "inode %d: free but still points to block %d", i, node->blocks[j]);
+                inode_damaged[i] = 1;
+                return;
+            }
+        }
+        return;
+    }
+    if (node->used != 1) {
+        problem(&errors, "inode %d: bad used flag %d", i, node->used);
+        inode_damaged[i] = 1;
+    }
+    if (memchr(node->name, '\0', MAX_FILENAME) == NULL || node->name[0] == '\0') {
+        problem(&errors, "inode %d: name is empty or not terminated", i);
+        inode_damaged[i] = 1;
+    }
+    if (node->flags & ~(INODE_FLAG_COMPRESS | INODE_FLAG_COMPRESSED)) {
+        problem(&errors, "inode %d (%.*s): unknown flags 0x%x", i, MAX_FILENAME, node->name, node->flags);
+        inode_damaged[i] = 1;
+    }
+    if (node->size < 0 || node->size > MAX_DIRECT_BLOCKS * BLOCK_SIZE ||
+        node->stored_size < 0 || node->stored_size > MAX_DIRECT_BLOCKS * BLOCK_SIZE) {
+        problem(&errors, "inode %d (%.*s): bad size %d (stored %d)", i, MAX_FILENAME, node->name,
+                node->size, node->stored_size);
+        inode_damaged[i] = 1;
+    } else if (!(node->flags & INODE_FLAG_COMPRESSED) && node->stored_size != node->size) {
+        problem(&errors, "inode %d (%.*s): stored size %d differs from size %d of an uncompressed file",
+                i, MAX_FILENAME, node->name, node->stored_size, node->size);
+        inode_damaged[i] = 1;
+    } else if ((node->flags & INODE_FLAG_COMPRESSED) && node->stored_size >= node->size) {
+        problem(&errors, "inode %d (%.*s): compressed to %d bytes from only %d",
+                i, MAX_FILENAME, node->name, node->stored_size, node->size);
+        inode_damaged[i] = 1;
+    }
+
+    int needed = blocks_needed(node);
+    for (int j = 0; j < MAX_DIRECT_BLOCKS; j++) {
+        int b = node->blocks[j];
+        if (b == 0) {
+            if (j < needed) {
+                problem(&errors, "inode %d (%.*s): missing block %d of %d", i, MAX_FILENAME, node->name, j, needed);
+                inode_damaged[i] = 1;
+            }
+            continue;
+        }
+        if (b < FIRST_DATA_BLOCK || b >= MAX_BLOCKS) {
+            problem(&errors, "inode %d (%.*s): block pointer %d out of range", i, MAX_FILENAME, node->name, b);
+            inode_damaged[i] = 1;
+            continue;
+        }
+        if (j >= needed) {
+            problem(&errors, "inode %d (%.*s): block %d beyond the end of the file", i, MAX_FILENAME, node->name, b);
+            inode_damaged[i] = 1;
+        }
+        __atomic_fetch_add(&expected_refs[b], 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Verify the checksums of the used data blocks in [first, last)
+static void verify_blocks(int first, int last) {
+    static __thread unsigned char buf[VERIFY_CHUNK * BLOCK_SIZE];
+    int b = first;
+    while (b < last) {
+        if (expected_refs[b] == 0) { b++; continue; }
+        int run = 1;
+        while (b + run < last && run < VERIFY_CHUNK && expected_refs[b + run] > 0) run++;
+        ssize_t n = pread(disk_fd, buf, (size_t)run * BLOCK_SIZE, (off_t)b * BLOCK_SIZE);
+        for (int j = 0; j < run; j++) {
+            if (n < (ssize_t)(j + 1) * BLOCK_SIZE) {
+                problem(&checksum_errors, "block %d: unreadable", b + j);
+            } else if (fs_crc32c(0, buf + (size_t)j * BLOCK_SIZE, BLOCK_SIZE) != crc_table[b + j]) {
+                problem(&checksum_errors, "block %d: checksum mismatch", b + j);
+            }
+        }
+        b += run;
+    }
+}
+
+// Check the reference counts of the blocks in [first, last); returns free data blocks
+static int check_blocks(int first, int last) {
+    int free_count = 0;
+    for (int b = first; b < last; b++) {
+        int expected = (b < FIRST_DATA_BLOCK) ? 1 : expected_refs[b];
+        int refs = block_refs[b];
+        if (b >= FIRST_DATA_BLOCK && refs == 0) free_count++;
+        if (refs == expected) continue;
+        if (b < FIRST_DATA_BLOCK) {
+            problem(&errors, "block %d: metadata block has reference count %d", b, refs);
+        } else if (refs < expected) {
+            problem(&errors, "block %d: referenced %d times but counted %d (may be allocated twice)", b, expected, refs);
+        } else if (expected == 0) {
+            problem(&errors, "block %d: leaked (count %d, no references)", b, refs);
+        } else {
+            problem(&errors, "block %d: referenced %d times but counted %d", b, expected, refs);
+        }
+    }
+    if (verify_data) {
+        verify_blocks(first < FIRST_DATA_BLOCK ? FIRST_DATA_BLOCK : first, last);
+    }
+    return free_count;
+}
+
+typedef struct {
+    int first, last;   // range of inodes or blocks
+    int free_count;    // free data blocks found (block workers)
+} work_range;
+
+static void* inode_worker(void* arg) {
+    work_range* range = arg;
+    for (int i = range->first; i < range->last; i++) check_inode(i);
+    return NULL;
+}
+
+static void* block_worker(void* arg) {
+    work_range* range = arg;
+    range->free_count = check_blocks(range->first, range->last);
+    return NULL;
+}
+
+// Run worker over [0, total) split into one range per thread; returns the
+// sum of the workers' free counts
+static int run_parallel(void* (*worker)(void*), int total, int threads) {
+    pthread_t ids[MAX_THREADS];
+    int started[MAX_THREADS];
+    work_range ranges[MAX_THREADS];
+    for (int t = 0; t < threads; t++) {
+        ranges[t].first = (long)total * t / threads;
+        ranges[t].last = (long)total * (t + 1) / threads;
+        ranges[t].free_count = 0;
+        // A range whose thread can't be started is checked right here
+        started[t] = pthread_create(&ids[t], NULL, worker, &ranges[t]) == 0;
+        if (!started[t]) worker(&ranges[t]);
+    }
+    int sum = 0;
+    for (int t = 0; t < threads; t++) {
+        if (started[t]) pthread_join(ids[t], NULL);
+        sum += ranges[t].free_count;
+    }
+    return sum;
+}
+
+// Cut a damaged inode back to something consistent: free inodes are
+// cleared, bad pointers and the blocks after them dropped, and a file whose
+// data can no longer be trusted as a whole is emptied
+static void repair_inode(inode* node) {
+    if (node->used == 0 || node->name[0] == '\0') {
+        memset(node, 0, sizeof(*node));
+        return;
+    }
+    node->used = 1;
+    node->name[MAX_FILENAME - 1] = '\0';
+    node->flags &= INODE_FLAG_COMPRESS | INODE_FLAG_COMPRESSED;
+
+    int valid = 0;
+    while (valid < MAX_DIRECT_BLOCKS && node->blocks[valid] >= FIRST_DATA_BLOCK &&
+           node->blocks[valid] < MAX_BLOCKS) valid++;
+
+    int limit = valid * BLOCK_SIZE;
+    if (node->flags & INODE_FLAG_COMPRESSED) {
+        // A compressed stream is only usable complete
+        if (node->size <= 0 || node->size > MAX_DIRECT_BLOCKS * BLOCK_SIZE ||
+            node->stored_size <= 0 || node->stored_size >= node->size || node->stored_size > limit) {
+            node->size = 0;
+            node->stored_size = 0;
+            node->flags &= ~INODE_FLAG_COMPRESSED;
+        }
+    } else {
+        // Keep the smaller of size and stored size that the blocks can hold
+        int size = limit;
+        if (node->size >= 0 && node->size < size) size = node->size;
+        if (node->stored_size >= 0 && node->stored_size < size) size = node->stored_size;
+        node->size = size;
+        node->stored_size = size;
+    }
+    for (int j = blocks_needed(node); j < MAX_DIRECT_BLOCKS; j++) node->blocks[j] = 0;
+}
+
+// Write the whole metadata area (blocks 0 to CRC_TABLE_START) back to the image
+static int write_metadata() {
+    static unsigned char area[CRC_TABLE_START * BLOCK_SIZE];
+    memset(area, 0, sizeof(area));
+    memcpy(area, &sb, sizeof(sb));
+    memcpy(area + BLOCK_SIZE, block_refs, BLOCK_SIZE);
+    memcpy(area + INODE_TABLE_START * BLOCK_SIZE, inode_table, sizeof(inode_table));
+    ssize_t n = pwrite(disk_fd, area, sizeof(area), 0);
+    return (n == (ssize_t)sizeof(area)) ? 0 : -1;
+}
+
+// Repair the inodes, then rebuild the reference counts and counters from them
+static int repair() {
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (inode_damaged[i]) repair_inode(&inode_table[i]);
+    }
+    // Of several inodes with the same name only the first stays reachable
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (!inode_table[i].used) continue;
+        for (int j = 0; j < i; j++) {
+            if (inode_table[j].used && strncmp(inode_table[i].name, inode_table[j].name, MAX_FILENAME) == 0) {
+                memset(&inode_table[i], 0, sizeof(inode));
+                break;
+            }
+        }
+    }
+
+    memset(expected_refs, 0, sizeof(expected_refs));
+    sb.free_inodes = MAX_FILES;
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (!inode_table[i].used) continue;
+        sb.free_inodes--;
+        for (int j = 0; j < MAX_DIRECT_BLOCKS; j++) {
+            if (inode_table[i].blocks[j] != 0) expected_refs[inode_table[i].blocks[j]]++;
+        }
+    }
+    sb.free_blocks = 0;
+    for (int b = 0; b < MAX_BLOCKS; b++) {
+        int refs = (b < FIRST_DATA_BLOCK) ? 1 : expected_refs[b];
+        block_refs[b] = refs > 255 ? 255 : refs;
+        if (block_refs[b] == 0) sb.free_blocks++;
+    }
+    return write_metadata();
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-c] [-r] [-j threads] <disk image>\n"
+                    "  -c  verify data block checksums\n"
+                    "  -r  repair the image\n"
+                    "  -j  number of checker threads (default 4)\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+    int repair_mode = 0;
+    int threads = 4;
+    int opt;
+    while ((opt = getopt(argc, argv, "crj:")) != -1) {
+        switch (opt) {
+            case 'c': verify_data = 1; break;
+            case 'r': repair_mode = 1; break;
+            case 'j': threads = atoi(optarg); break;
+            default: usage(argv[0]); return 8;
+        }
+    }
+    if (optind != argc - 1 || threads < 1 || threads > MAX_THREADS) {
+        usage(argv[0]);
+        return 8;
+    }
+    const char* disk_path = argv[optind];
+
+    disk_fd = open(disk_path, repair_mode ? O_RDWR : O_RDONLY);
+    if (disk_fd < 0) {
+        perror(disk_path);
+        return 8;
+    }
+    if (pread(disk_fd, &sb, sizeof(sb), 0) != sizeof(sb) ||
+        pread(disk_fd, block_refs, BLOCK_SIZE, BLOCK_SIZE) != BLOCK_SIZE ||
+        pread(disk_fd, inode_table, sizeof(inode_table), (off_t)INODE_TABLE_START * BLOCK_SIZE) != sizeof(inode_table) ||
+        pread(disk_fd, crc_table, sizeof(crc_table), (off_t)CRC_TABLE_START * BLOCK_SIZE) != sizeof(crc_table)) {
+        fprintf(stderr, "%s: image too short\n", disk_path);
+        close(disk_fd);
+        return 8;
+    }
+    // Without the right geometry nothing else can be interpreted
+    if (sb.total_blocks != MAX_BLOCKS || sb.block_size != BLOCK_SIZE ||
+        sb.total_inodes != MAX_FILES || sb.version != FS_LAYOUT_VERSION ||
+        sb.direct_blocks != MAX_DIRECT_BLOCKS) {
+        fprintf(stderr, "%s: not an OnlyFiles image of layout version %d\n", disk_path, FS_LAYOUT_VERSION);
+        close(disk_fd);
+        return 8;
+    }
+
+    // Set up the checksum tables before the workers share them
+    fs_crc32c(0, NULL, 0);
+
+    // Inodes first: the block pass compares against the references they hold
+    run_parallel(inode_worker, MAX_FILES, threads > MAX_FILES ? MAX_FILES : threads);
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (!inode_table[i].used) continue;
+        for (int j = 0; j < i; j++) {
+            if (inode_table[j].used && strncmp(inode_table[i].name, inode_table[j].name, MAX_FILENAME) == 0) {
+                problem(&errors, "inode %d: duplicate name %.*s (also inode %d)", i, MAX_FILENAME, inode_table[i].name, j);
+                break;
+            }
+        }
+    }
+    int free_blocks = run_parallel(block_worker, MAX_BLOCKS, threads);
+
+    int used_inodes = 0;
+    for (int i = 0; i < MAX_FILES; i++) used_inodes += (inode_table[i].used != 0);
+    if (sb.free_blocks != free_blocks) {
+        problem(&errors, "superblock: %d free blocks recorded, %d found", sb.free_blocks, free_blocks);
+    }
+    if (sb.free_inodes != MAX_FILES - used_inodes) {
+        problem(&errors, "superblock: %d free inodes recorded, %d found", sb.free_inodes, MAX_FILES - used_inodes);
+    }
+
+    int status = 0;
+    if (errors > 0 && repair_mode) {
+        if (repair() != 0) {
+            fprintf(stderr, "%s: could not write repaired metadata\n", disk_path);
+            close(disk_fd);
+            return 8;
+        }
+        printf("%s: %d problems repaired\n", disk_path, errors);
+        status = 1;
+    } else if (errors > 0) {
+        printf("%s: %d problems found\n", disk_path, errors);
+        status = 4;
+    }
+    if (checksum_errors > 0) {
+        printf("%s: %d blocks failed checksum verification\n", disk_path, checksum_errors);
+        status |= 4;
+    }
+    if (status == 0) {
+        printf("%s: clean, %d/%d files, %d/%d blocks\n", disk_path, used_inodes, MAX_FILES,
+               MAX_BLOCKS - free_blocks, MAX_BLOCKS);
+    }
+    close(disk_fd);
+    return status;
+}
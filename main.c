@@ -14,18 +14,74 @@
  * Use this file as a starting point for testing your filesystem implementation.
  * For more thorough testing, you should extend this program or create additional
  * test programs to cover edge cases and error conditions.
+ *
+ * Run as "fs_main defrag <disk image> [budget]" to defragment an existing
+ * image instead, in steps of at most budget blocks (default 64).
  */
 
 #include "fs.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+/**
+ * @brief Print a one-line fragmentation summary
+ */
+static void print_fragmentation(const char* label) {
+    fs_frag_report report;
+    fs_fragmentation(&report);
+    printf("%s: score %d, %d of %d files fragmented, %d file extents, "
+           "%d free extents (largest %d blocks)\n",
+           label, report.score, report.fragmented_files, report.files,
+           report.file_extents, report.free_extents, report.largest_free_extent);
+}
+
+/**
+ * @brief Defragment a disk image in bounded steps, reporting progress
+ * 
+ * @return 0 on success, 1 on error
+ */
+static int defrag_main(const char* disk_path, int budget) {
+    int result = fs_mount(disk_path);
+    if (result != 0) {
+        printf("Error mounting filesystem (code: %d)\n", result);
+        return 1;
+    }
+    
+    print_fragmentation("Before");
+    int steps = 0;
+    int total = 0;
+    while ((result = fs_defrag(budget)) > 0) {
+        steps++;
+        total += result;
+    }
+    if (result < 0) {
+        printf("Error defragmenting filesystem (code: %d)\n", result);
+        fs_unmount();
+        return 1;
+    }
+    printf("Relocated %d blocks in %d steps\n", total, steps);
+    print_fragmentation("After");
+    
+    fs_unmount();
+    return 0;
+}
+
 /**
  * @brief Main function demonstrating basic filesystem operations
  * 
  * @return 0 on successful execution
  */
-int main() {
+int main(int argc, char* argv[]) {
+    if (argc >= 3 && strcmp(argv[1], "defrag") == 0) {
+        int budget = (argc >= 4) ? atoi(argv[3]) : 64;
+        if (budget <= 0) {
+            printf("Usage: %s defrag <disk image> [budget]\n", argv[0]);
+            return 1;
+        }
+        return defrag_main(argv[2], budget);
+    }
+    
     int result;
     
     // Step 1: Format a new filesystem
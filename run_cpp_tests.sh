@@ -0,0 +1,11 @@
+#!/bin/bash
+set -e
+
+echo "Compiling C++ API tests..."
+gcc -c fs.c -o fs.o
+g++ -std=c++23 test_cpp_api.cpp fs.o -o test_cpp_api -lpthread
+
+echo "Running C++ API tests..."
+./test_cpp_api
+
+echo "C++ API tests completed!"
@@ -0,0 +1,39 @@
+#!/bin/bash
+set -e
+
+echo "Compiling fsck..."
+gcc fs.c fsck.c -o fs_fsck -lpthread
+gcc fs.c main.c -o fs_main
+
+echo "Checking a fresh image..."
+./fs_main > /dev/null
+./fs_fsck -c disk.img
+
+echo "Checking a damaged image..."
+cp disk.img fsck_disk.img
+# Leak a free data block and give the first inode an impossible size
+printf '\x01' | dd of=fsck_disk.img bs=1 seek=$((4096 + 100)) conv=notrunc status=none
+printf '\xff\xff\xff\x7f' | dd of=fsck_disk.img bs=1 seek=$((2 * 4096 + 32)) conv=notrunc status=none
+status=0; ./fs_fsck fsck_disk.img || status=$?
+[ $status -eq 4 ] || { echo "FAILED: expected exit status 4, got $status"; exit 1; }
+
+echo "Repairing the damaged image..."
+status=0; ./fs_fsck -r fsck_disk.img || status=$?
+[ $status -eq 1 ] || { echo "FAILED: expected exit status 1, got $status"; exit 1; }
+./fs_fsck -c fsck_disk.img
+
+echo "Checking a corrupted data block..."
+cp disk.img fsck_disk.img
+printf 'X' | dd of=fsck_disk.img bs=1 seek=$((13 * 4096 + 3)) conv=notrunc status=none
+status=0; ./fs_fsck -c fsck_disk.img || status=$?
+[ $status -eq 4 ] || { echo "FAILED: expected exit status 4, got $status"; exit 1; }
+
+echo "Checking when worker threads can't be started..."
+cp disk.img fsck_disk.img
+printf '\x01' | dd of=fsck_disk.img bs=1 seek=$((4096 + 100)) conv=notrunc status=none
+# Too little address space for eight thread stacks
+status=0; (ulimit -v 60000; ./fs_fsck -j 8 fsck_disk.img) || status=$?
+[ $status -eq 4 ] || { echo "FAILED: expected exit status 4, got $status"; exit 1; }
+rm -f fsck_disk.img
+
+echo "fsck tests completed!"
@@ -0,0 +1,22 @@
+#!/bin/bash
+set -e
+
+echo "Compiling load generator..."
+gcc fs.c fs_load.c -o fs_load -lpthread -lm
+
+echo "Running each key and size model..."
+./fs_load -d 1 -i load_disk.img -k uniform -s fixed:1000
+./fs_load -d 1 -i load_disk.img -k zipf:1.2 -s lognormal:4096:1.5
+./fs_load -d 1 -i load_disk.img -k hotspot:10:90 -s bimodal:256:49152:5 -m 50:40:5:5
+
+echo "Running with several threads..."
+./fs_load -d 2 -i load_disk.img -t 4 -k zipf -s lognormal -m 60:30:8:2
+
+echo "Checking bad arguments are refused..."
+for args in "-k zipf:0" "-s fixed:0" "-s bimodal:1:99999999" "-m 1:2:3" "-t 0" "-n 100000"; do
+    status=0; ./fs_load $args -i load_disk.img > /dev/null 2>&1 || status=$?
+    [ $status -eq 8 ] || { echo "FAILED: '$args' exited with $status, expected 8"; exit 1; }
+done
+rm -f load_disk.img
+
+echo "Load generator tests completed!"
@@ -0,0 +1,36 @@
+#!/bin/bash
+set -e
+
+echo "Compiling replay tool and tests..."
+gcc fs.c fs_replay.c -o fs_replay -lpthread
+gcc fs.c comprehensive_test.c -o comprehensive_test -lpthread
+gcc fs.c test_stress.c -o test_stress -lpthread
+
+echo "Recording traces of the test scenarios..."
+mkdir -p traces
+FS_TRACE=traces/comprehensive.trace ./comprehensive_test > /dev/null
+FS_TRACE=traces/stress.trace ./test_stress > /dev/null
+
+# Status 1 only means some results differed (the tests edit images behind
+# the filesystem's back); 8 means the trace could not be replayed
+for trace in traces/comprehensive.trace traces/stress.trace; do
+    echo "Replaying $trace..."
+    status=0; ./fs_replay -i replay_disk.img $trace || status=$?
+    [ $status -le 1 ] || { echo "FAILED: replay of $trace exited with $status"; exit 1; }
+done
+
+echo "Replaying traces/comprehensive.trace at its original speed..."
+status=0; ./fs_replay -o -i replay_disk.img traces/comprehensive.trace > /dev/null || status=$?
+[ $status -le 1 ] || { echo "FAILED: paced replay exited with $status"; exit 1; }
+
+echo "Checking a truncated trace is refused..."
+head -c 10 traces/comprehensive.trace > traces/short.trace
+status=0; ./fs_replay -i replay_disk.img traces/short.trace 2> /dev/null || status=$?
+[ $status -eq 8 ] || { echo "FAILED: expected exit status 8, got $status"; exit 1; }
+
+echo "Checking a trace that can't be sized is refused..."
+status=0; cat traces/comprehensive.trace | ./fs_replay -i replay_disk.img /dev/stdin 2> /dev/null || status=$?
+[ $status -eq 8 ] || { echo "FAILED: expected exit status 8 for a piped trace, got $status"; exit 1; }
+rm -f traces/short.trace replay_disk.img replay_disk.img.*
+
+echo "Replay tests completed!"
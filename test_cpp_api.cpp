@@ -0,0 +1,243 @@
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <array>
+#include <string>
+#include <vector>
+#include "fs.hpp"
+
+#define CPP_DISK "cpp_disk.img"
+
+using namespace onlyfiles;
+
+Filesystem setup_cpp_disk() {
+    if (access(CPP_DISK, F_OK) == 0) {
+        remove(CPP_DISK);
+    }
+    if (auto formatted = Filesystem::format(CPP_DISK); !formatted) {
+        fprintf(stderr, "Failed to format C++ disk: %s\n", describe(formatted.error()));
+        exit(1);
+    }
+    auto fs = Filesystem::mount(CPP_DISK);
+    if (!fs) {
+        fprintf(stderr, "Failed to mount C++ disk: %s\n", describe(fs.error()));
+        exit(1);
+    }
+    return std::move(*fs);
+}
+
+double seconds_since(const timespec& start) {
+    timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// Test 1: Mounting, file handles and error results
+void test_handles() {
+    printf("=== Test 1: Handles and Errors ===\n");
+
+    {
+        Filesystem fs = setup_cpp_disk();
+        if (Filesystem::mount(CPP_DISK).has_value()) {
+            printf("FAILED: A second Filesystem mounted the same disk\n");
+            return;
+        }
+
+        auto file = fs.create("hello.txt");
+        std::string text = "hello from C++";
+        if (!file || !file->write(bytes(text))) {
+            printf("FAILED: Could not create and write a file\n");
+            return;
+        }
+        std::array<char, 64> buffer{};
+        auto got = file->read(writable_bytes(buffer));
+        if (!got || *got != text.size() || memcmp(buffer.data(), text.data(), text.size()) != 0) {
+            printf("FAILED: Read back the wrong contents\n");
+            return;
+        }
+
+        // Errors come back as values with the C API's meaning
+        if (fs.open("missing.txt").error() != errc::not_found ||
+            fs.create("hello.txt").error() != errc::exists ||
+            fs.create(std::string(MAX_FILENAME, 'x')).error() != errc::other) {
+            printf("FAILED: Wrong errors for bad opens and creates\n");
+            return;
+        }
+
+        // Handles move, and follow a rename
+        File moved = std::move(*file);
+        fs.create("taken.txt");
+        if (moved.rename("taken.txt").error() != errc::exists || !moved.rename("renamed.txt") || strcmp(moved.name(), "renamed.txt") != 0 ||
+            !moved.stat() || moved.stat()->size != (int)text.size()) {
+            printf("FAILED: Rename through a handle\n");
+            return;
+        }
+        Filesystem other = std::move(fs);
+        if (!other.remove(std::move(moved)) || other.open("renamed.txt").has_value()) {
+            printf("FAILED: Delete through a handle\n");
+            return;
+        }
+    }
+
+    // The Filesystem unmounted itself when it went out of scope
+    auto again = Filesystem::mount(CPP_DISK);
+    if (!again) {
+        printf("FAILED: Disk was left mounted\n");
+        return;
+    }
+
+    // A Writer from before an unmount leaves the next mount's writers alone
+    auto stale_file = again->create("stale.txt");
+    auto stale = again->writer(*stale_file);
+    again->unmount();
+    auto remounted = Filesystem::mount(CPP_DISK);
+    auto fresh = remounted->writer(*remounted->open("stale.txt"));
+    stale->abort();
+    if (stale->write(bytes(std::string("late"))).error() != errc::not_found ||
+        !fresh->write(bytes(std::string("fresh"))) || !fresh->commit()) {
+        printf("FAILED: A stale Writer reached a writer of the next mount\n");
+        return;
+    }
+    remounted->unmount();
+    if (remounted->remove(std::move(*stale_file)).error() != errc::other) {
+        printf("FAILED: Deleting while unmounted should fail with errc::other\n");
+        return;
+    }
+    printf("PASSED: Handles and errors\n");
+}
+
+// Test 2: Streaming writers and readers through callables
+void test_streams() {
+    printf("=== Test 2: Streams ===\n");
+
+    Filesystem fs = setup_cpp_disk();
+    std::vector<int> values(3000);
+    for (size_t i = 0; i < values.size(); i++) values[i] = (int)(i * i);
+    auto file = fs.create("values.bin");
+    {
+        auto writer = fs.writer(*file);
+        for (size_t i = 0; i < values.size(); i += 700) {
+            size_t n = std::min<size_t>(700, values.size() - i);
+            writer->write(bytes(std::span(values).subspan(i, n)));
+        }
+        if (!writer->commit()) {
+            printf("FAILED: Commit\n");
+            return;
+        }
+    }
+    {
+        // An abandoned writer leaves the file alone
+        auto writer = fs.writer(*file);
+        writer->write(bytes(std::string("discarded")));
+    }
+
+    std::vector<std::byte> streamed;
+    int pieces = 0;
+    auto total = file->read_stream([&](std::span<const std::byte> piece) {
+        streamed.insert(streamed.end(), piece.begin(), piece.end());
+        pieces++;
+        return false;
+    });
+    if (!total || *total != values.size() * sizeof(int) || streamed.size() != *total ||
+        memcmp(streamed.data(), values.data(), *total) != 0 || pieces < 2) {
+        printf("FAILED: Streamed contents are wrong\n");
+        return;
+    }
+
+    int listed = 0;
+    fs.create("values.old");
+    fs.create("other");
+    fs.for_each("values", [&](const fs_dirent& entry) { listed += strncmp(entry.name, "values", 6) == 0; });
+    if (listed != 2) {
+        printf("FAILED: Listed %d files with the prefix\n", listed);
+        return;
+    }
+    // A callback that throws doesn't leave its listing open
+    for (int i = 0; i < 64; i++) {
+        try {
+            fs.for_each("", [](const fs_dirent&) { throw 1; });
+        } catch (int) {
+        }
+    }
+    listed = 0;
+    if (!fs.for_each("values", [&](const fs_dirent&) { listed++; }) || listed != 2) {
+        printf("FAILED: Listing after callbacks threw\n");
+        return;
+    }
+    // A commit that runs out of space leaves the writer open to retry
+    auto last = fs.create("last.bin");
+    auto late = fs.writer(*last);
+    late->write(bytes(std::string("tail")));
+    std::vector<char> block(BLOCK_SIZE * MAX_DIRECT_BLOCKS, 'f');
+    for (int i = 0; fs.stats().free_blocks > 0; i++) {
+        auto filler = fs.create("filler_" + std::to_string(i));
+        int blocks = std::min<int>(fs.stats().free_blocks, MAX_DIRECT_BLOCKS);
+        if (!filler || !filler->write(bytes(std::span(block).first(blocks * BLOCK_SIZE)))) break;
+    }
+    if (late->commit().error() != errc::no_space || !fs.remove(*fs.open("filler_0")) || !late->commit()) {
+        printf("FAILED: Retrying a commit after running out of space\n");
+        return;
+    }
+    printf("PASSED: Streams\n");
+}
+
+// Test 3: Wrapper overhead against the C calls
+void test_wrapper_overhead() {
+    printf("=== Test 3: Wrapper Overhead Benchmark ===\n");
+
+    Filesystem fs = setup_cpp_disk();
+    const int files = 64;
+    const int rounds = 200;
+    std::vector<char> data(BLOCK_SIZE);
+    std::vector<char> buffer(BLOCK_SIZE);
+    for (int i = 0; i < BLOCK_SIZE; i++) data[i] = (char)(i * 31);
+    std::vector<File> handles;
+    char names[files][MAX_FILENAME];
+    for (int f = 0; f < files; f++) {
+        snprintf(names[f], MAX_FILENAME, "bench_%d", f);
+        handles.push_back(std::move(*fs.create(names[f])));
+    }
+
+    // Alternate the two so neither gets a warmer cache
+    double c_s = 0, cpp_s = 0;
+    long c_bytes = 0, cpp_bytes = 0;
+    for (int r = 0; r < rounds; r++) {
+        timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int f = 0; f < files; f++) {
+            if (fs_write(names[f], data.data(), BLOCK_SIZE) == 0) {
+                c_bytes += fs_read_at(names[f], buffer.data(), BLOCK_SIZE / 2, BLOCK_SIZE / 4);
+            }
+        }
+        c_s += seconds_since(start);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (auto& file : handles) {
+            if (file.write(bytes(data))) {
+                cpp_bytes += file.read_at(writable_bytes(buffer).first(BLOCK_SIZE / 2), BLOCK_SIZE / 4).value_or(0);
+            }
+        }
+        cpp_s += seconds_since(start);
+    }
+
+    double calls = 2.0 * rounds * files;
+    printf("Write + read_at of %d files: C %.3f us/call, C++ %.3f us/call (%+.1f%%)\n",
+           files, c_s / calls * 1e6, cpp_s / calls * 1e6, (cpp_s / c_s - 1) * 100);
+    if (c_bytes != cpp_bytes || c_bytes != (long)rounds * files * BLOCK_SIZE / 2) {
+        printf("FAILED: The two loops read different amounts\n");
+        return;
+    }
+    printf("PASSED: Wrapper overhead benchmark\n");
+}
+
+int main() {
+    printf("Starting C++ API Tests...\n\n");
+
+    test_handles();
+    test_streams();
+    test_wrapper_overhead();
+
+    printf("\n=== All C++ API Tests Completed ===\n");
+    return 0;
+}
@@ -216,6 +216,7 @@ void test_many_small_files() {
         snprintf(data, sizeof(data), "Data for file %d", i);
         
         char buffer[100];
+        memset(buffer, 0, sizeof(buffer));
         int bytes_read = fs_read(filename, buffer, sizeof(buffer));
         if (bytes_read != strlen(data) || strcmp(buffer, data) != 0) {
             printf("FAILED: Data mismatch for file %s\n", filename);
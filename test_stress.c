@@ -3,6 +3,12 @@
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <pthread.h>
 #include "fs.h"
 
 #define STRESS_DISK "stress_disk.img"
@@ -318,6 +324,8 @@ void test_resource_exhaustion() {
             int result = fs_write("huge.txt", huge_data, 1000000);
             if (result == -2) {
                 printf("Correctly rejected write due to insufficient blocks\n");
+            } else if (result == -3) {
+                printf("Correctly rejected write larger than the maximum file size\n");
             } else if (result == 0) {
                 printf("WARNING: Large file write succeeded (may have truncated)\n");
             } else {
@@ -331,6 +339,1141 @@ void test_resource_exhaustion() {
     printf("PASSED: Resource exhaustion test\n");
 }
 
+// Test 6: Inode allocation throughput at different occupancy levels
+void test_inode_allocation() {
+    printf("=== Test 6: Inode Allocation Benchmark ===\n");
+    
+    int occupancy[] = {10, 50, 99};
+    const int rounds = 20000;
+    char filename[30];
+    
+    for (int o = 0; o < 3; o++) {
+        setup_stress_disk();
+        
+        // Fill the inode table to the requested occupancy
+        int prefill = MAX_FILES * occupancy[o] / 100;
+        for (int i = 0; i < prefill; i++) {
+            snprintf(filename, sizeof(filename), "fill_%d.txt", i);
+            if (fs_create(filename) != 0) {
+                printf("FAILED: Could not prefill file %s\n", filename);
+                fs_unmount();
+                return;
+            }
+        }
+        
+        // Time create/delete cycles of a spare file on top of the prefill
+        clock_t start = clock();
+        for (int i = 0; i < rounds; i++) {
+            if (fs_create("spare.txt") != 0 || fs_delete("spare.txt") != 0) {
+                printf("FAILED: Create/delete cycle failed at %d%% occupancy\n", occupancy[o]);
+                fs_unmount();
+                return;
+            }
+        }
+        clock_t end = clock();
+        double seconds = ((double) (end - start)) / CLOCKS_PER_SEC;
+        printf("%2d%% occupancy: %d create/delete cycles in %.3f seconds (%.0f creates/sec)\n",
+               occupancy[o], rounds, seconds, seconds > 0 ? rounds / seconds : 0.0);
+        
+        fs_unmount();
+    }
+    
+    printf("PASSED: Inode allocation benchmark\n");
+}
+
+// Test 7: Sequential streaming reads with readahead
+void test_streaming_reads() {
+    printf("=== Test 7: Streaming Read Benchmark ===\n");
+    
+    setup_stress_disk();
+    
+    const int num_files = 100;
+    const int file_size = MAX_DIRECT_BLOCKS * BLOCK_SIZE;
+    char filename[30];
+    char* data = malloc(file_size);
+    for (int i = 0; i < file_size; i++) {
+        data[i] = 'S' + (i % 7);
+    }
+    for (int i = 0; i < num_files; i++) {
+        snprintf(filename, sizeof(filename), "stream_%d.bin", i);
+        fs_create(filename);
+        fs_write(filename, data, file_size);
+    }
+    
+    // Stream every file through a small buffer, one block at a time
+    fs_reset_stats();
+    char buffer[BLOCK_SIZE];
+    clock_t start = clock();
+    for (int i = 0; i < num_files; i++) {
+        snprintf(filename, sizeof(filename), "stream_%d.bin", i);
+        for (int offset = 0; offset < file_size; offset += BLOCK_SIZE) {
+            if (fs_read_at(filename, buffer, BLOCK_SIZE, offset) != BLOCK_SIZE) {
+                printf("FAILED: Streaming read of %s at %d\n", filename, offset);
+                free(data);
+                fs_unmount();
+                return;
+            }
+        }
+    }
+    clock_t end = clock();
+    
+    fs_stats st;
+    fs_get_stats(&st);
+    double seconds = ((double) (end - start)) / CLOCKS_PER_SEC;
+    printf("Streamed %d files (%d KB each) in %.3f seconds\n", num_files, file_size / 1024, seconds);
+    printf("Disk reads: %lu for %d blocks, readahead hit rate %.1f%%\n",
+           st.disk_reads, num_files * MAX_DIRECT_BLOCKS,
+           st.readahead_blocks ? 100.0 * st.readahead_hits / st.readahead_blocks : 0.0);
+    
+    free(data);
+    fs_unmount();
+    printf("PASSED: Streaming read benchmark\n");
+}
+
+// Drop the host page cache for the stress disk image
+void drop_host_cache() {
+    int fd = open(STRESS_DISK, O_RDONLY);
+    if (fd < 0) return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+// Time one pass of full-file reads over the benchmark files
+double timed_read_pass(int num_files, char* buffer, int file_size) {
+    char filename[30];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < num_files; i++) {
+        snprintf(filename, sizeof(filename), "direct_%d.bin", i);
+        if (fs_read(filename, buffer, file_size) != file_size) return -1.0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// Test 8: Buffered vs O_DIRECT reads, cold and warm
+void test_direct_io() {
+    printf("=== Test 8: Buffered vs Direct I/O Benchmark ===\n");
+    
+    const int num_files = 150;
+    const int file_size = MAX_DIRECT_BLOCKS * BLOCK_SIZE;
+    char filename[30];
+    char* data = malloc(file_size);
+    char* buffer = aligned_alloc(BLOCK_SIZE, file_size);
+    for (int i = 0; i < file_size; i++) {
+        data[i] = 'D' + (i % 13);
+    }
+    
+    setup_stress_disk();
+    for (int i = 0; i < num_files; i++) {
+        snprintf(filename, sizeof(filename), "direct_%d.bin", i);
+        fs_create(filename);
+        fs_write(filename, data, file_size);
+    }
+    fs_unmount();
+    
+    const char* modes[] = {"buffered", "direct"};
+    int options[] = {0, FS_MOUNT_DIRECT};
+    for (int m = 0; m < 2; m++) {
+        drop_host_cache();
+        if (fs_mount_opts(STRESS_DISK, options[m]) != 0) {
+            printf("FAILED: Could not mount in %s mode\n", modes[m]);
+            free(data);
+            free(buffer);
+            return;
+        }
+        fs_stats st;
+        fs_get_stats(&st);
+        if (options[m] == FS_MOUNT_DIRECT && !st.direct_io) {
+            printf("(O_DIRECT not supported by the host filesystem, using buffered I/O)\n");
+        }
+        
+        double cold = timed_read_pass(num_files, buffer, file_size);
+        double warm = timed_read_pass(num_files, buffer, file_size);
+        if (cold < 0 || warm < 0 || memcmp(buffer, data, file_size) != 0) {
+            printf("FAILED: Read mismatch in %s mode\n", modes[m]);
+            fs_unmount();
+            free(data);
+            free(buffer);
+            return;
+        }
+        double mb = (double) num_files * file_size / (1024 * 1024);
+        printf("%-8s: cold %.1f MB/s, warm %.1f MB/s\n", modes[m], mb / cold, mb / warm);
+        fs_unmount();
+    }
+    
+    free(data);
+    free(buffer);
+    printf("PASSED: Buffered vs direct I/O benchmark\n");
+}
+
+// Fork a child that drains and discards everything sent on a socketpair.
+// Returns the write end, and the child's pid through *child.
+int start_drain(pid_t* child) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return -1;
+    *child = fork();
+    if (*child == 0) {
+        close(fds[0]);
+        char sink[65536];
+        while (read(fds[1], sink, sizeof(sink)) > 0) {
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    return fds[0];
+}
+
+// Test 9: fs_sendfile vs fs_read + write to a socket
+void test_sendfile_throughput() {
+    printf("=== Test 9: Sendfile Benchmark ===\n");
+    
+    setup_stress_disk();
+    
+    const int num_files = 100;
+    const int rounds = 20;
+    const int file_size = MAX_DIRECT_BLOCKS * BLOCK_SIZE;
+    char filename[30];
+    char* data = malloc(file_size);
+    char* buffer = malloc(file_size);
+    for (int i = 0; i < file_size; i++) {
+        data[i] = 'N' + (i % 11);
+    }
+    for (int i = 0; i < num_files; i++) {
+        snprintf(filename, sizeof(filename), "send_%d.bin", i);
+        fs_create(filename);
+        fs_write(filename, data, file_size);
+    }
+    
+    double mb = (double) num_files * rounds * file_size / (1024 * 1024);
+    for (int mode = 0; mode < 2; mode++) {
+        pid_t child;
+        int sock = start_drain(&child);
+        if (sock < 0) {
+            printf("FAILED: Could not create socketpair\n");
+            break;
+        }
+        
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int r = 0; r < rounds; r++) {
+            for (int i = 0; i < num_files; i++) {
+                snprintf(filename, sizeof(filename), "send_%d.bin", i);
+                if (mode == 0) {
+                    int n = fs_read(filename, buffer, file_size);
+                    for (int done = 0; done < n; ) {
+                        done += write(sock, buffer + done, n - done);
+                    }
+                } else {
+                    fs_sendfile(filename, sock, 0, file_size);
+                }
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        close(sock);
+        waitpid(child, NULL, 0);
+        
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("%-12s: %.1f MB/s\n", mode == 0 ? "read+write" : "fs_sendfile", mb / seconds);
+    }
+    
+    free(data);
+    free(buffer);
+    fs_unmount();
+    printf("PASSED: Sendfile benchmark\n");
+}
+
+// Test 10: Checksum verification overhead on the read path
+void test_checksum_overhead() {
+    printf("=== Test 10: Checksum Verification Benchmark ===\n");
+    
+    // Raw checksum throughput over 4KB blocks
+    char* block = malloc(BLOCK_SIZE);
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        block[i] = rand();
+    }
+    const int crc_rounds = 200000;
+    unsigned int crc = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < crc_rounds; i++) {
+        crc += fs_crc32c(0, block, BLOCK_SIZE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("fs_crc32c: %.2f GB/s (checksum %08x)\n", (double) crc_rounds * BLOCK_SIZE / seconds / 1e9, crc);
+    free(block);
+    
+    // Cold full-file reads with and without verification
+    const int num_files = 150;
+    const int file_size = MAX_DIRECT_BLOCKS * BLOCK_SIZE;
+    char filename[30];
+    char* data = malloc(file_size);
+    char* buffer = malloc(file_size);
+    for (int i = 0; i < file_size; i++) {
+        data[i] = 'V' + (i % 3);
+    }
+    setup_stress_disk();
+    for (int i = 0; i < num_files; i++) {
+        snprintf(filename, sizeof(filename), "verify_%d.bin", i);
+        fs_create(filename);
+        fs_write(filename, data, file_size);
+    }
+    fs_unmount();
+    
+    const char* modes[] = {"verify", "no verify"};
+    int options[] = {0, FS_MOUNT_NO_VERIFY};
+    double mb = (double) num_files * file_size / (1024 * 1024);
+    for (int m = 0; m < 2; m++) {
+        double best = 0;
+        for (int pass = 0; pass < 5; pass++) {
+            fs_mount_opts(STRESS_DISK, options[m]);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int i = 0; i < num_files; i++) {
+                snprintf(filename, sizeof(filename), "verify_%d.bin", i);
+                if (fs_read(filename, buffer, file_size) != file_size) {
+                    printf("FAILED: Read of %s in %s mode\n", filename, modes[m]);
+                    fs_unmount();
+                    free(data);
+                    free(buffer);
+                    return;
+                }
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            fs_unmount();
+            seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            if (mb / seconds > best) best = mb / seconds;
+        }
+        printf("%-9s: %.1f MB/s (best of 5 cold passes)\n", modes[m], best);
+    }
+    
+    free(data);
+    free(buffer);
+    printf("PASSED: Checksum verification benchmark\n");
+}
+
+// Test 11: Compressed vs uncompressed files on text/JSON payloads
+void test_compression_throughput() {
+    printf("=== Test 11: Compression Benchmark ===\n");
+    
+    const int num_files = 150;
+    const int rounds = 5;
+    const int file_size = MAX_DIRECT_BLOCKS * BLOCK_SIZE;
+    char filename[30];
+    char* data = malloc(file_size);
+    char* buffer = malloc(file_size);
+    int pos = 0;
+    for (int id = 0; pos < file_size; id++) {
+        char record[128];
+        int n = snprintf(record, sizeof(record),
+                         "{\"id\": %d, \"event\": \"click\", \"page\": \"/item/%d\", \"ms\": %d}\n",
+                         id, id % 211, (id * 53) % 900);
+        for (int i = 0; i < n && pos < file_size; i++) data[pos++] = record[i];
+    }
+    
+    const char* modes[] = {"raw", "compressed"};
+    for (int m = 0; m < 2; m++) {
+        setup_stress_disk();
+        for (int i = 0; i < num_files; i++) {
+            snprintf(filename, sizeof(filename), "json_%d.txt", i);
+            fs_create(filename);
+            fs_set_compression(filename, m);
+        }
+        
+        fs_reset_stats();
+        struct timespec start, mid, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int r = 0; r < rounds; r++) {
+            for (int i = 0; i < num_files; i++) {
+                snprintf(filename, sizeof(filename), "json_%d.txt", i);
+                fs_write(filename, data, file_size);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &mid);
+        for (int r = 0; r < rounds; r++) {
+            for (int i = 0; i < num_files; i++) {
+                snprintf(filename, sizeof(filename), "json_%d.txt", i);
+                if (fs_read(filename, buffer, file_size) != file_size) {
+                    printf("FAILED: Read of %s in %s mode\n", filename, modes[m]);
+                    fs_unmount();
+                    free(data);
+                    free(buffer);
+                    return;
+                }
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        
+        fs_stats st;
+        fs_get_stats(&st);
+        double mb = (double) num_files * rounds * file_size / (1024 * 1024);
+        double write_s = (mid.tv_sec - start.tv_sec) + (mid.tv_nsec - start.tv_nsec) / 1e9;
+        double read_s = (end.tv_sec - mid.tv_sec) + (end.tv_nsec - mid.tv_nsec) / 1e9;
+        int raw_blocks = num_files * MAX_DIRECT_BLOCKS;
+        int saved = (int)(st.compress_blocks_saved / rounds);
+        printf("%-10s: write %.1f MB/s, read %.1f MB/s, %d of %d blocks used (%.0f%% saved)\n",
+               modes[m], mb / write_s, mb / read_s, raw_blocks - saved, raw_blocks,
+               100.0 * saved / raw_blocks);
+        if (memcmp(buffer, data, file_size) != 0) {
+            printf("FAILED: Data mismatch in %s mode\n", modes[m]);
+        }
+        fs_unmount();
+    }
+    
+    free(data);
+    free(buffer);
+    printf("PASSED: Compression benchmark\n");
+}
+
+// Test 12: Plain vs deduplicated writes on files built from shared templates
+void test_dedup_capacity() {
+    printf("=== Test 12: Deduplication Benchmark ===\n");
+    
+    const int num_files = 200;
+    const int rounds = 5;
+    const int file_blocks = 8;
+    const int templates = 16;
+    const int file_size = file_blocks * BLOCK_SIZE;
+    char filename[30];
+    char* pool = malloc((size_t)templates * BLOCK_SIZE);
+    char* data = malloc(file_size);
+    char* buffer = malloc(file_size);
+    for (int i = 0; i < templates * BLOCK_SIZE; i++) {
+        pool[i] = rand();
+    }
+    
+    const char* modes[] = {"plain", "dedup"};
+    const int options[] = {0, FS_MOUNT_DEDUP};
+    for (int m = 0; m < 2; m++) {
+        setup_stress_disk();
+        fs_unmount();
+        fs_mount_opts(STRESS_DISK, options[m]);
+        for (int i = 0; i < num_files; i++) {
+            snprintf(filename, sizeof(filename), "doc_%d.txt", i);
+            fs_create(filename);
+        }
+        fs_stats before;
+        fs_get_stats(&before);
+        
+        // Each file: a unique header block followed by template blocks
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int r = 0; r < rounds; r++) {
+            for (int i = 0; i < num_files; i++) {
+                memset(data, 0, BLOCK_SIZE);
+                snprintf(data, BLOCK_SIZE, "document %d revision %d", i, r);
+                for (int b = 1; b < file_blocks; b++) {
+                    memcpy(data + b * BLOCK_SIZE, pool + (size_t)((i + b) % templates) * BLOCK_SIZE, BLOCK_SIZE);
+                }
+                snprintf(filename, sizeof(filename), "doc_%d.txt", i);
+                if (fs_write(filename, data, file_size) != 0) {
+                    printf("FAILED: Write of %s in %s mode\n", filename, modes[m]);
+                    fs_unmount();
+                    free(pool);
+                    free(data);
+                    free(buffer);
+                    return;
+                }
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        
+        fs_stats st;
+        fs_get_stats(&st);
+        int used = before.free_blocks - st.free_blocks;
+        double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("%-6s: %.1f us/write, %.1f MB/s, %d of %d blocks used (%.1fx capacity)\n",
+               modes[m], elapsed * 1e6 / (num_files * rounds),
+               (double) num_files * rounds * file_size / (1024 * 1024) / elapsed,
+               used, num_files * file_blocks, (double) num_files * file_blocks / used);
+        
+        // Every file reads back its own header and templates
+        fs_unmount();
+        fs_mount(STRESS_DISK);
+        for (int i = 0; i < num_files; i++) {
+            snprintf(filename, sizeof(filename), "doc_%d.txt", i);
+            char header[BLOCK_SIZE] = {0};
+            snprintf(header, BLOCK_SIZE, "document %d revision %d", i, rounds - 1);
+            if (fs_read(filename, buffer, file_size) != file_size ||
+                memcmp(buffer, header, BLOCK_SIZE) != 0 ||
+                memcmp(buffer + 3 * BLOCK_SIZE, pool + (size_t)((i + 3) % templates) * BLOCK_SIZE, BLOCK_SIZE) != 0) {
+                printf("FAILED: Data mismatch in %s in %s mode\n", filename, modes[m]);
+                break;
+            }
+        }
+        fs_unmount();
+    }
+    
+    free(pool);
+    free(data);
+    free(buffer);
+    printf("PASSED: Deduplication benchmark\n");
+}
+
+// Test 13: Copying files with fs_clone vs read + create + write
+void test_clone_copy() {
+    printf("=== Test 13: Clone vs Copy Benchmark ===\n");
+    
+    const int copies = 200;
+    const int file_size = MAX_DIRECT_BLOCKS * BLOCK_SIZE;
+    char filename[30];
+    char* data = malloc(file_size);
+    char* buffer = malloc(file_size);
+    for (int i = 0; i < file_size; i++) {
+        data[i] = rand();
+    }
+    
+    const char* modes[] = {"copy", "clone"};
+    for (int m = 0; m < 2; m++) {
+        setup_stress_disk();
+        fs_create("golden.bin");
+        fs_write("golden.bin", data, file_size);
+        fs_stats before;
+        fs_get_stats(&before);
+        
+        int done = 0;
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < copies; i++) {
+            snprintf(filename, sizeof(filename), "copy_%d.bin", i);
+            if (m == 1) {
+                if (fs_clone("golden.bin", filename) != 0) break;
+            } else {
+                if (fs_read("golden.bin", buffer, file_size) != file_size ||
+                    fs_create(filename) != 0 || fs_write(filename, buffer, file_size) != 0) break;
+            }
+            done++;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        
+        fs_stats st;
+        fs_get_stats(&st);
+        double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("%-5s: %d of %d copies, %.2f us/copy, %d blocks used\n", modes[m], done, copies,
+               done ? elapsed * 1e6 / done : 0.0, before.free_blocks - st.free_blocks);
+        
+        snprintf(filename, sizeof(filename), "copy_%d.bin", done - 1);
+        if (done == 0 || fs_read(filename, buffer, file_size) != file_size || memcmp(buffer, data, file_size) != 0) {
+            printf("FAILED: Last %s does not match the original\n", modes[m]);
+        }
+        fs_unmount();
+    }
+    
+    free(data);
+    free(buffer);
+    printf("PASSED: Clone benchmark\n");
+}
+
+// Read every file once from a cold cache, returning the read system calls issued
+unsigned long cold_read_calls(int num_files, char* buffer, int size) {
+    char filename[30];
+    fs_unmount();
+    fs_mount(STRESS_DISK);
+    for (int i = 0; i < num_files; i++) {
+        snprintf(filename, sizeof(filename), "churn_%d.dat", i);
+        fs_read(filename, buffer, size);
+    }
+    fs_stats st;
+    fs_get_stats(&st);
+    return st.disk_reads;
+}
+
+// Test 14: Defragmenting a churned filesystem
+void test_defrag_churn() {
+    printf("=== Test 14: Defragmentation Benchmark ===\n");
+    
+    setup_stress_disk();
+    
+    // Rewrite random files with random sizes until the layout is scattered
+    const int num_files = 150;
+    const int budget = 32;
+    char filename[30];
+    char* data = malloc(MAX_DIRECT_BLOCKS * BLOCK_SIZE);
+    char* buffer = malloc(MAX_DIRECT_BLOCKS * BLOCK_SIZE);
+    int sizes[150];
+    for (int i = 0; i < num_files; i++) {
+        snprintf(filename, sizeof(filename), "churn_%d.dat", i);
+        fs_create(filename);
+        sizes[i] = 0;
+    }
+    for (int round = 0; round < 3000; round++) {
+        int i = rand() % num_files;
+        sizes[i] = (1 + rand() % MAX_DIRECT_BLOCKS) * BLOCK_SIZE - rand() % 100;
+        memset(data, i, sizes[i]);
+        snprintf(filename, sizeof(filename), "churn_%d.dat", i);
+        fs_write(filename, data, sizes[i]);
+    }
+    
+    fs_frag_report before, after;
+    fs_fragmentation(&before);
+    unsigned long calls_before = cold_read_calls(num_files, buffer, MAX_DIRECT_BLOCKS * BLOCK_SIZE);
+    
+    int steps = 0, total = 0, moved, worst_us = 0;
+    struct timespec start, end;
+    while (1) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        moved = fs_defrag(budget);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (moved <= 0) break;
+        int us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+        if (us > worst_us) worst_us = us;
+        steps++;
+        total += moved;
+    }
+    fs_fragmentation(&after);
+    unsigned long calls_after = cold_read_calls(num_files, buffer, MAX_DIRECT_BLOCKS * BLOCK_SIZE);
+    
+    printf("Score %d -> %d, fragmented files %d -> %d, free extents %d -> %d\n",
+           before.score, after.score, before.fragmented_files, after.fragmented_files,
+           before.free_extents, after.free_extents);
+    printf("Relocated %d blocks in %d steps of <= %d (slowest step %d us)\n", total, steps, budget, worst_us);
+    printf("Cold read of all files: %lu read calls before, %lu after\n", calls_before, calls_after);
+    
+    for (int i = 0; i < num_files; i++) {
+        snprintf(filename, sizeof(filename), "churn_%d.dat", i);
+        memset(data, i, sizes[i]);
+        if (fs_read(filename, buffer, MAX_DIRECT_BLOCKS * BLOCK_SIZE) != sizes[i] || memcmp(buffer, data, sizes[i]) != 0) {
+            printf("FAILED: %s corrupted by defragmentation\n", filename);
+            break;
+        }
+    }
+    if (moved < 0 || after.score != 0) {
+        printf("FAILED: Defragmentation did not complete (%d, score %d)\n", moved, after.score);
+    }
+    
+    fs_unmount();
+    free(data);
+    free(buffer);
+    printf("PASSED: Defragmentation benchmark\n");
+}
+
+// Test 15: Cost and effect of discarding freed blocks
+void test_discard_churn() {
+    printf("=== Test 15: Discard Benchmark ===\n");
+    
+    const int num_files = 200;
+    const int file_size = 10 * BLOCK_SIZE;
+    char filename[30];
+    char* data = malloc(file_size);
+    memset(data, 'x', file_size);
+    
+    const char* modes[] = {"keep", "discard"};
+    const int options[] = {0, FS_MOUNT_DISCARD};
+    for (int m = 0; m < 2; m++) {
+        setup_stress_disk();
+        fs_unmount();
+        fs_mount_opts(STRESS_DISK, options[m]);
+        for (int i = 0; i < num_files; i++) {
+            snprintf(filename, sizeof(filename), "tmp_%d.bin", i);
+            fs_create(filename);
+            fs_write(filename, data, file_size);
+        }
+        
+        // Delete everything, then rewrite a tenth of it
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < num_files; i++) {
+            snprintf(filename, sizeof(filename), "tmp_%d.bin", i);
+            fs_delete(filename);
+        }
+        for (int i = 0; i < num_files / 10; i++) {
+            snprintf(filename, sizeof(filename), "tmp_%d.bin", i);
+            fs_create(filename);
+            fs_write(filename, data, file_size);
+        }
+        fs_unmount();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        
+        fs_stats st;
+        fs_get_stats(&st);
+        struct stat img;
+        stat(STRESS_DISK, &img);
+        double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("%-7s: %.2f ms for %d deletes + %d writes, %lu fallocate calls, image uses %ld KB\n",
+               modes[m], elapsed * 1e3, num_files, num_files / 10, st.discard_calls,
+               (long)img.st_blocks / 2);
+    }
+    
+    free(data);
+    printf("PASSED: Discard benchmark\n");
+}
+
+// Test 16: Time from mount to the first completed read
+void test_mount_latency() {
+    printf("=== Test 16: Mount Latency Benchmark ===\n");
+    
+    const int cycles = 2000;
+    char filename[30];
+    char buffer[64];
+    setup_stress_disk();
+    for (int i = 0; i < MAX_FILES; i++) {
+        snprintf(filename, sizeof(filename), "svc_%d.cfg", i);
+        fs_create(filename);
+        fs_write(filename, filename, strlen(filename) + 1);
+    }
+    fs_unmount();
+    
+    const char* modes[] = {"eager", "lazy", "prefetch"};
+    const int options[] = {0, FS_MOUNT_LAZY, FS_MOUNT_LAZY | FS_MOUNT_PREFETCH};
+    for (int m = 0; m < 3; m++) {
+        double mount_us = 0, first_read_us = 0;
+        for (int c = 0; c < cycles; c++) {
+            struct timespec start, mounted, read;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            fs_mount_opts(STRESS_DISK, options[m]);
+            clock_gettime(CLOCK_MONOTONIC, &mounted);
+            if (fs_read("svc_0.cfg", buffer, sizeof(buffer)) <= 0 || strcmp(buffer, "svc_0.cfg") != 0) {
+                printf("FAILED: First read after %s mount\n", modes[m]);
+                fs_unmount();
+                return;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &read);
+            fs_unmount();
+            mount_us += (mounted.tv_sec - start.tv_sec) * 1e6 + (mounted.tv_nsec - start.tv_nsec) / 1e3;
+            first_read_us += (read.tv_sec - start.tv_sec) * 1e6 + (read.tv_nsec - start.tv_nsec) / 1e3;
+        }
+        printf("%-8s: mount %.1f us, mount to first read %.1f us\n",
+               modes[m], mount_us / cycles, first_read_us / cycles);
+    }
+    printf("PASSED: Mount latency benchmark\n");
+}
+
+// Test 17: Prefix listing and name lookups with the sorted name index
+void test_prefix_listing() {
+    printf("=== Test 17: Prefix Listing Benchmark ===\n");
+    
+    const int rounds = 20000;
+    char filename[30];
+    setup_stress_disk();
+    for (int i = 0; i < MAX_FILES; i++) {
+        snprintf(filename, sizeof(filename), "%s_%03d", (i % 16 == 0) ? "hot" : "cold", i);
+        fs_create(filename);
+    }
+    
+    // Listing 16 of 256 files: cursor vs full fs_list + filter
+    struct timespec start, mid, end;
+    fs_dirent entries[32];
+    char names[MAX_FILES][MAX_FILENAME];
+    int found_cursor = 0, found_scan = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; r++) {
+        int cursor = fs_list_begin("hot_");
+        found_cursor = fs_list_next(cursor, entries, 32);
+        fs_list_end(cursor);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &mid);
+    for (int r = 0; r < rounds; r++) {
+        int n = fs_list(names, MAX_FILES);
+        found_scan = 0;
+        for (int i = 0; i < n; i++) found_scan += strncmp(names[i], "hot_", 4) == 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Prefix listing: cursor %.2f us, fs_list + filter %.2f us (%d and %d matches)\n",
+           ((mid.tv_sec - start.tv_sec) * 1e9 + (mid.tv_nsec - start.tv_nsec)) / 1e3 / rounds,
+           ((end.tv_sec - mid.tv_sec) * 1e9 + (end.tv_nsec - mid.tv_nsec)) / 1e3 / rounds,
+           found_cursor, found_scan);
+    if (found_cursor != 16 || found_scan != 16) {
+        printf("FAILED: Expected 16 matches\n");
+    }
+    
+    // Name lookups through the index, on a full table
+    char buffer[8];
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; r++) {
+        int i = rand() % MAX_FILES;
+        snprintf(filename, sizeof(filename), "%s_%03d", (i % 16 == 0) ? "hot" : "cold", i);
+        if (fs_read(filename, buffer, sizeof(buffer)) != 0) {
+            printf("FAILED: Lookup of %s\n", filename);
+            break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Name lookup (empty read): %.3f us\n",
+           ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / 1e3 / rounds);
+    
+    fs_unmount();
+    printf("PASSED: Prefix listing benchmark\n");
+}
+
+// Test 18: Sizing files with fs_stat_many vs reading them
+void test_stat_sizing() {
+    printf("=== Test 18: Metadata Query Benchmark ===\n");
+    
+    const int lookups = 10000;
+    char filename[30];
+    setup_stress_disk();
+    char* data = malloc(MAX_DIRECT_BLOCKS * BLOCK_SIZE);
+    memset(data, 's', MAX_DIRECT_BLOCKS * BLOCK_SIZE);
+    for (int i = 0; i < 200; i++) {
+        snprintf(filename, sizeof(filename), "sized_%d", i);
+        fs_create(filename);
+        fs_write(filename, data, 1 + i * 200);
+    }
+    
+    // Thousands of names, some missing
+    char (*storage)[30] = malloc(lookups * sizeof(*storage));
+    const char** names = malloc(lookups * sizeof(char*));
+    for (int i = 0; i < lookups; i++) {
+        snprintf(storage[i], 30, "sized_%d", rand() % 220);
+        names[i] = storage[i];
+    }
+    fs_file_stat* st = malloc(lookups * sizeof(fs_file_stat));
+    
+    struct timespec start, mid, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int found = fs_stat_many(names, lookups, st);
+    clock_gettime(CLOCK_MONOTONIC, &mid);
+    long total_read = 0;
+    for (int i = 0; i < lookups; i++) {
+        int n = fs_read(names[i], data, MAX_DIRECT_BLOCKS * BLOCK_SIZE);
+        if (n > 0) total_read += n;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    
+    long total_stat = 0;
+    for (int i = 0; i < lookups; i++) {
+        if (st[i].inode != -1) total_stat += st[i].size;
+    }
+    printf("%d names (%d found): fs_stat_many %.3f ms, fs_read %.3f ms\n", lookups, found,
+           ((mid.tv_sec - start.tv_sec) * 1e9 + (mid.tv_nsec - start.tv_nsec)) / 1e6,
+           ((end.tv_sec - mid.tv_sec) * 1e9 + (end.tv_nsec - mid.tv_nsec)) / 1e6);
+    if (total_stat != total_read) {
+        printf("FAILED: Sizes disagree (%ld vs %ld)\n", total_stat, total_read);
+    }
+    
+    fs_unmount();
+    free(storage);
+    free(names);
+    free(st);
+    free(data);
+    printf("PASSED: Metadata query benchmark\n");
+}
+
+// Test 19: Log-style 100-byte appends, fs_append vs rewriting the whole file
+void test_append_log() {
+    printf("=== Test 19: Append Benchmark ===\n");
+    
+    const int logs = 20;
+    const int max_size = MAX_DIRECT_BLOCKS * BLOCK_SIZE;
+    const int records = max_size / 100;
+    char record[100];
+    char filename[30];
+    char* contents = malloc(max_size);
+    char* check = malloc(max_size);
+    setup_stress_disk();
+    
+    struct timespec start, mid, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int f = 0; f < logs; f++) {
+        snprintf(filename, sizeof(filename), "append_%d", f);
+        fs_create(filename);
+        for (int r = 0; r < records; r++) {
+            memset(record, 'a' + r % 26, sizeof(record));
+            fs_append(filename, record, sizeof(record));
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &mid);
+    for (int f = 0; f < logs; f++) {
+        snprintf(filename, sizeof(filename), "rewrite_%d", f);
+        fs_create(filename);
+        for (int r = 0; r < records; r++) {
+            memset(contents + r * 100, 'a' + r % 26, 100);
+            fs_write(filename, contents, (r + 1) * 100);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    
+    double append_us = ((mid.tv_sec - start.tv_sec) * 1e9 + (mid.tv_nsec - start.tv_nsec)) / 1e3 / (logs * records);
+    double rewrite_us = ((end.tv_sec - mid.tv_sec) * 1e9 + (end.tv_nsec - mid.tv_nsec)) / 1e3 / (logs * records);
+    printf("%d records of 100 bytes per log: fs_append %.2f us/record, fs_write rewrite %.2f us/record (%.1fx)\n",
+           records, append_us, rewrite_us, rewrite_us / append_us);
+    
+    for (int f = 0; f < logs; f++) {
+        snprintf(filename, sizeof(filename), "append_%d", f);
+        if (fs_read(filename, check, max_size) != records * 100 || memcmp(check, contents, records * 100) != 0) {
+            printf("FAILED: %s has the wrong contents\n", filename);
+            break;
+        }
+    }
+    
+    // Trimming a full log back to one block
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int f = 0; f < logs; f++) {
+        snprintf(filename, sizeof(filename), "append_%d", f);
+        fs_truncate(filename, 100);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Truncate to one record: %.2f us\n",
+           ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / 1e3 / logs);
+    
+    fs_unmount();
+    free(contents);
+    free(check);
+    printf("PASSED: Append benchmark\n");
+}
+
+// Test 20: Streaming writer vs assembling the file in memory first
+void test_stream_writer_throughput() {
+    printf("=== Test 20: Streaming Writer Benchmark ===\n");
+    
+    const int files = 200;
+    const int piece = 512;
+    const int max_size = MAX_DIRECT_BLOCKS * BLOCK_SIZE;
+    char filename[30];
+    char record[512];
+    setup_stress_disk();
+    for (int f = 0; f < files; f++) {
+        snprintf(filename, sizeof(filename), "stream_%d", f);
+        fs_create(filename);
+    }
+    
+    // The producer hands out 512-byte pieces; the writer buffers one block
+    struct timespec start, mid, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int f = 0; f < files; f++) {
+        snprintf(filename, sizeof(filename), "stream_%d", f);
+        int writer = fs_writer_open(filename);
+        for (int off = 0; off < max_size; off += piece) {
+            memset(record, 'a' + (off / piece) % 26, piece);
+            fs_writer_write(writer, record, piece);
+        }
+        fs_writer_commit(writer);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &mid);
+    
+    // The same pieces gathered into a whole-file buffer for fs_write
+    for (int f = 0; f < files; f++) {
+        snprintf(filename, sizeof(filename), "stream_%d", f);
+        char* whole = malloc(max_size);
+        for (int off = 0; off < max_size; off += piece) memset(whole + off, 'a' + (off / piece) % 26, piece);
+        fs_write(filename, whole, max_size);
+        free(whole);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    
+    double stream_s = (mid.tv_sec - start.tv_sec) + (mid.tv_nsec - start.tv_nsec) / 1e9;
+    double buffered_s = (end.tv_sec - mid.tv_sec) + (end.tv_nsec - mid.tv_nsec) / 1e9;
+    double mb = (double)files * max_size / (1024 * 1024);
+    printf("%d files of %d KB in %d-byte pieces: writer %.1f MB/s (%d KB buffered), fs_write %.1f MB/s (%d KB buffered)\n",
+           files, max_size / 1024, piece, mb / stream_s, BLOCK_SIZE / 1024, mb / buffered_s, max_size / 1024);
+    
+    char* check = malloc(max_size);
+    if (fs_read("stream_0", check, max_size) != max_size || check[0] != 'a' || check[max_size - 1] != 'a' + (max_size / piece - 1) % 26) {
+        printf("FAILED: Streamed file has the wrong contents\n");
+    }
+    free(check);
+    fs_unmount();
+    printf("PASSED: Streaming writer benchmark\n");
+}
+
+// Checksums each streamed piece, with a little work per byte like a parser would do
+int checksum_piece(void* ctx, const void* data, int len) {
+    unsigned int* crc = ctx;
+    *crc = fs_crc32c(*crc, data, len);
+    return 0;
+}
+
+// Test 21: Hashing files with fs_read_stream vs reading them whole first
+void test_read_stream_throughput() {
+    printf("=== Test 21: Streaming Reader Benchmark ===\n");
+    
+    const int files = 200;
+    const int rounds = 5;
+    const int max_size = MAX_DIRECT_BLOCKS * BLOCK_SIZE;
+    char filename[30];
+    char* data = malloc(max_size);
+    for (int i = 0; i < max_size; i++) data[i] = (char)rand();
+    setup_stress_disk();
+    for (int f = 0; f < files; f++) {
+        snprintf(filename, sizeof(filename), "hash_%d", f);
+        fs_create(filename);
+        fs_write(filename, data, max_size);
+    }
+    
+    // Cold passes: remount and drop the host's copy before each
+    double stream_s = 0, whole_s = 0;
+    unsigned int crc_stream = 0, crc_whole = 0;
+    for (int r = 0; r < rounds; r++) {
+        struct timespec start, end;
+        fs_unmount();
+        drop_host_cache();
+        fs_mount(STRESS_DISK);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int f = 0; f < files; f++) {
+            snprintf(filename, sizeof(filename), "hash_%d", f);
+            unsigned int crc = 0;
+            fs_read_stream(filename, checksum_piece, &crc);
+            crc_stream ^= crc;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        stream_s += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        
+        fs_unmount();
+        drop_host_cache();
+        fs_mount(STRESS_DISK);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int f = 0; f < files; f++) {
+            snprintf(filename, sizeof(filename), "hash_%d", f);
+            char* whole = malloc(max_size);
+            fs_read(filename, whole, max_size);
+            crc_whole ^= fs_crc32c(0, whole, max_size);
+            free(whole);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        whole_s += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    }
+    
+    double mb = (double)rounds * files * max_size / (1024 * 1024);
+    printf("Hashing %d files of %d KB, cold: fs_read_stream %.1f MB/s (%d KB buffered), fs_read %.1f MB/s (%d KB buffered)\n",
+           files, max_size / 1024, mb / stream_s, BLOCK_SIZE / 1024, mb / whole_s, max_size / 1024);
+    if (crc_stream != crc_whole) {
+        printf("FAILED: Checksums disagree\n");
+    }
+    
+    fs_unmount();
+    free(data);
+    printf("PASSED: Streaming reader benchmark\n");
+}
+
+typedef struct {
+    int id;
+    int threads;
+    int files;
+    int size;
+    const char* data;
+    int errors;
+} stress_writer;
+
+void* write_own_files(void* arg) {
+    stress_writer* w = arg;
+    char filename[30];
+    char* check = malloc(w->size);
+    for (int f = w->id; f < w->files; f += w->threads) {
+        snprintf(filename, sizeof(filename), "par_%d", f);
+        if (fs_write(filename, w->data + f, w->size) != 0 ||
+            fs_read(filename, check, w->size) != w->size ||
+            memcmp(check, w->data + f, w->size) != 0) {
+            w->errors++;
+        }
+    }
+    free(check);
+    return NULL;
+}
+
+// Test 22: Write throughput from several threads at once
+void test_parallel_writers() {
+    printf("=== Test 22: Parallel Writers Benchmark ===\n");
+    
+    const int files = 64;
+    const int rounds = 20;
+    const int size = 4 * BLOCK_SIZE;
+    char* data = malloc(size + files);
+    for (int i = 0; i < size + files; i++) data[i] = (char)rand();
+    
+    for (int threads = 1; threads <= BLOCK_GROUPS; threads *= 2) {
+        setup_stress_disk();
+        char filename[30];
+        for (int f = 0; f < files; f++) {
+            snprintf(filename, sizeof(filename), "par_%d", f);
+            fs_create(filename);
+        }
+        
+        struct timespec start, end;
+        int errors = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int r = 0; r < rounds; r++) {
+            pthread_t tids[BLOCK_GROUPS];
+            stress_writer writers[BLOCK_GROUPS];
+            for (int t = 0; t < threads; t++) {
+                writers[t] = (stress_writer){t, threads, files, size, data, 0};
+                pthread_create(&tids[t], NULL, write_own_files, &writers[t]);
+            }
+            for (int t = 0; t < threads; t++) {
+                pthread_join(tids[t], NULL);
+                errors += writers[t].errors;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        double mb = (double)rounds * files * size / (1024 * 1024);
+        printf("%d thread(s): %.1f MB/s written and verified\n", threads, mb / elapsed);
+        if (errors != 0) {
+            printf("FAILED: %d files read back wrong with %d threads\n", errors, threads);
+        }
+        fs_unmount();
+    }
+    
+    free(data);
+    printf("PASSED: Parallel writers benchmark\n");
+}
+
+void* rewrite_own_files(void* arg) {
+    stress_writer* w = arg;
+    char filename[30];
+    for (int f = w->id; f < w->files; f += w->threads) {
+        snprintf(filename, sizeof(filename), "alloc_%d", f);
+        if (fs_write(filename, w->data + f, w->size) != 0) w->errors++;
+    }
+    return NULL;
+}
+
+// Test 23: Block allocation scaling with the number of writing threads
+void test_alloc_scaling() {
+    printf("=== Test 23: Allocation Scaling Benchmark ===\n");
+    
+    const int files = 128;
+    const int rounds = 50;
+    const int size = MAX_DIRECT_BLOCKS * BLOCK_SIZE;
+    const int max_threads = 8;
+    char* data = malloc(size + files);
+    for (int i = 0; i < size + files; i++) data[i] = (char)rand();
+    
+    double single = 0;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        setup_stress_disk();
+        char filename[30];
+        for (int f = 0; f < files; f++) {
+            snprintf(filename, sizeof(filename), "alloc_%d", f);
+            fs_create(filename);
+        }
+        
+        // Every rewrite frees a file's blocks and allocates new ones
+        struct timespec start, end;
+        fs_stats before, after;
+        int errors = 0;
+        fs_get_stats(&before);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int r = 0; r < rounds; r++) {
+            pthread_t tids[8];
+            stress_writer writers[8];
+            for (int t = 0; t < threads; t++) {
+                writers[t] = (stress_writer){t, threads, files, size, data, 0};
+                pthread_create(&tids[t], NULL, rewrite_own_files, &writers[t]);
+            }
+            for (int t = 0; t < threads; t++) {
+                pthread_join(tids[t], NULL);
+                errors += writers[t].errors;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        fs_get_stats(&after);
+        double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        double allocs = (double)rounds * files * MAX_DIRECT_BLOCKS;
+        if (threads == 1) single = elapsed;
+        printf("%d thread(s): %.2f M block allocations/s, %.2fx one thread, %.3f refills per allocation\n",
+               threads, allocs / elapsed / 1e6, single / elapsed,
+               (after.alloc_cache_refills - before.alloc_cache_refills) / allocs);
+        if (errors != 0 || after.free_blocks != before.free_blocks - files * MAX_DIRECT_BLOCKS) {
+            printf("FAILED: %d writes failed, %d blocks free\n", errors, after.free_blocks);
+        }
+        fs_unmount();
+    }
+    
+    free(data);
+    printf("PASSED: Allocation scaling benchmark\n");
+}
+
 int main() {
     printf("Starting Stress Tests...\n\n");
     
@@ -347,6 +1490,25 @@ int main() {
     
     fs_unmount();
     
+    test_inode_allocation();
+    test_streaming_reads();
+    test_direct_io();
+    test_sendfile_throughput();
+    test_checksum_overhead();
+    test_compression_throughput();
+    test_dedup_capacity();
+    test_clone_copy();
+    test_defrag_churn();
+    test_discard_churn();
+    test_mount_latency();
+    test_prefix_listing();
+    test_stat_sizing();
+    test_append_log();
+    test_stream_writer_throughput();
+    test_read_stream_throughput();
+    test_parallel_writers();
+    test_alloc_scaling();
+    
     printf("\n=== All Stress Tests Completed ===\n");
     return 0;
 } 
\ No newline at end of file